@@ -6,6 +6,7 @@
 #define GLM_ENABLE_EXPERIMENTAL
 #include <glm/glm.hpp>
 #include <glm/gtc/matrix_transform.hpp>
+#include <glm/gtc/packing.hpp>
 #include <glm/gtx/hash.hpp>
 
 #define STB_IMAGE_IMPLEMENTATION
@@ -16,6 +17,7 @@
 
 #include <iostream>
 #include <fstream>
+#include <filesystem>
 #include <stdexcept>
 #include <algorithm>
 #include <chrono>
@@ -27,16 +29,49 @@
 #include <array>
 #include <optional>
 #include <set>
+#include <map>
+#include <deque>
+#include <memory>
 #include <unordered_map>
+#include <thread>
+#include <future>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+#include <exception>
+#include <charconv>
+#include <sstream>
+#include <locale>
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
 
 const uint32_t WIDTH = 800;
 const uint32_t HEIGHT = 600;
 
 const std::string MODEL_PATH = "models/viking_room.obj";
 const std::string TEXTURE_PATH = "textures/viking_room.png";
+const std::string PIPELINE_CACHE_PATH = "pipeline_cache.bin";
+const std::string MESH_CACHE_PATH = "models/viking_room.meshcache";
 
 const int MAX_FRAMES_IN_FLIGHT = 2;
 
+const uint32_t DEFAULT_BENCHMARK_FRAMES = 1000;
+
+// Size of the persistently mapped staging ring, can be changed with --staging-ring-mb
+const uint32_t DEFAULT_STAGING_RING_MIB = 32;
+
+// Upper bound on the bindless texture table, further limited by the device
+const uint32_t MAX_BINDLESS_TEXTURES = 1024;
+
 const std::vector<const char*> validationLayers = {
     "VK_LAYER_KHRONOS_validation"
 };
@@ -67,9 +102,306 @@ void DestroyDebugUtilsMessengerEXT(VkInstance instance, VkDebugUtilsMessengerEXT
     }
 }
 
+uint64_t hashBytes(const void* data, size_t size, uint64_t hash = 14695981039346656037ull) {
+    // FNV-1a
+    const unsigned char* bytes = static_cast<const unsigned char*>(data);
+    for (size_t i = 0; i < size; i++) {
+        hash ^= bytes[i];
+        hash *= 1099511628211ull;
+    }
+    return hash;
+}
+
+// Written in front of the driver's pipeline cache data so truncated or corrupted files are detected
+struct PipelineCacheFileHeader {
+    uint32_t magic;
+    uint32_t dataSize;
+    uint64_t dataHash;
+};
+
+const uint32_t PIPELINE_CACHE_MAGIC = 0x43505456; // "VTPC"
+
+// Read-only memory mapping of a whole file, unmapped when the object is destroyed
+class MappedFile {
+public:
+    MappedFile() = default;
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+
+    MappedFile(MappedFile&& other) noexcept {
+        *this = std::move(other);
+    }
+
+    MappedFile& operator=(MappedFile&& other) noexcept {
+        if (this != &other) {
+            close();
+            std::swap(mappedData, other.mappedData);
+            std::swap(mappedSize, other.mappedSize);
+#ifdef _WIN32
+            std::swap(fileHandle, other.fileHandle);
+            std::swap(mappingHandle, other.mappingHandle);
+#endif
+        }
+        return *this;
+    }
+
+    ~MappedFile() {
+        close();
+    }
+
+    bool open(const std::string& path) {
+        close();
+
+#ifdef _WIN32
+        fileHandle = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+        if (fileHandle == INVALID_HANDLE_VALUE) {
+            return false;
+        }
+
+        LARGE_INTEGER fileSize;
+        if (!GetFileSizeEx(fileHandle, &fileSize) || fileSize.QuadPart == 0) {
+            close();
+            return false;
+        }
+
+        mappingHandle = CreateFileMappingA(fileHandle, nullptr, PAGE_READONLY, 0, 0, nullptr);
+        if (mappingHandle == nullptr) {
+            close();
+            return false;
+        }
+
+        mappedData = MapViewOfFile(mappingHandle, FILE_MAP_READ, 0, 0, 0);
+        if (mappedData == nullptr) {
+            close();
+            return false;
+        }
+
+        mappedSize = static_cast<size_t>(fileSize.QuadPart);
+#else
+        int fd = ::open(path.c_str(), O_RDONLY);
+        if (fd < 0) {
+            return false;
+        }
+
+        struct stat fileInfo;
+        if (fstat(fd, &fileInfo) != 0 || fileInfo.st_size == 0) {
+            ::close(fd);
+            return false;
+        }
+
+        void* data = mmap(nullptr, static_cast<size_t>(fileInfo.st_size), PROT_READ, MAP_PRIVATE, fd, 0);
+        ::close(fd);
+
+        if (data == MAP_FAILED) {
+            return false;
+        }
+
+        mappedData = data;
+        mappedSize = static_cast<size_t>(fileInfo.st_size);
+#endif
+
+        return true;
+    }
+
+    void close() {
+#ifdef _WIN32
+        if (mappedData != nullptr) {
+            UnmapViewOfFile(mappedData);
+        }
+        if (mappingHandle != nullptr) {
+            CloseHandle(mappingHandle);
+        }
+        if (fileHandle != INVALID_HANDLE_VALUE) {
+            CloseHandle(fileHandle);
+        }
+        mappingHandle = nullptr;
+        fileHandle = INVALID_HANDLE_VALUE;
+#else
+        if (mappedData != nullptr) {
+            munmap(mappedData, mappedSize);
+        }
+#endif
+
+        mappedData = nullptr;
+        mappedSize = 0;
+    }
+
+    const char* data() const {
+        return static_cast<const char*>(mappedData);
+    }
+
+    size_t size() const {
+        return mappedSize;
+    }
+
+private:
+    void* mappedData = nullptr;
+    size_t mappedSize = 0;
+
+#ifdef _WIN32
+    HANDLE fileHandle = INVALID_HANDLE_VALUE;
+    HANDLE mappingHandle = nullptr;
+#endif
+};
+
+// Deduplicated and optimized model data as stored on disk, so warm starts can skip OBJ parsing
+// and the mesh optimization.
+// The vertex and index arrays follow the header at 16 byte aligned offsets and are
+// used in place from the memory mapped file.
+struct MeshCacheHeader {
+    uint32_t magic;
+    uint32_t version;
+    uint64_t sourceHash;  // hash of the OBJ file the mesh was built from
+    uint64_t payloadHash; // hash of everything after the header
+    uint32_t vertexStride;
+    uint32_t indexStride;
+    uint32_t vertexCount;
+    uint32_t indexCount;
+    uint64_t vertexOffset;
+    uint64_t indexOffset;
+    uint32_t optimizeOverdraw; // OPTIMIZE_MESH_OVERDRAW when the mesh was optimized
+    uint32_t vertexCacheSize;  // VERTEX_CACHE_SIZE when the mesh was optimized
+    float acmrBefore;
+    float acmrAfter;
+    float atvrBefore;
+    float atvrAfter;
+};
+
+const uint32_t MESH_CACHE_MAGIC = 0x434D5456; // "VTMC"
+const uint32_t MESH_CACHE_VERSION = 4;
+
+// Fixed part of a KTX2 file, followed by one Ktx2LevelIndex per mip level
+struct Ktx2Header {
+    uint8_t identifier[12];
+    uint32_t vkFormat;
+    uint32_t typeSize;
+    uint32_t pixelWidth;
+    uint32_t pixelHeight;
+    uint32_t pixelDepth;
+    uint32_t layerCount;
+    uint32_t faceCount;
+    uint32_t levelCount;
+    uint32_t supercompressionScheme;
+    uint32_t dfdByteOffset;
+    uint32_t dfdByteLength;
+    uint32_t kvdByteOffset;
+    uint32_t kvdByteLength;
+    uint64_t sgdByteOffset;
+    uint64_t sgdByteLength;
+};
+
+struct Ktx2LevelIndex {
+    uint64_t byteOffset;
+    uint64_t byteLength;
+    uint64_t uncompressedByteLength;
+};
+
+const uint8_t KTX2_IDENTIFIER[12] = {0xAB, 0x4B, 0x54, 0x58, 0x20, 0x32, 0x30, 0xBB, 0x0D, 0x0A, 0x1A, 0x0A};
+
+struct CompressedTexture {
+    std::string path;
+    VkFormat format;
+    uint32_t blockSize;
+};
+
+// Written by texture_converter, in order of preference. If the device can't sample any
+// of them, createTextureImage falls back to TEXTURE_PATH and generates mipmaps itself.
+const std::vector<CompressedTexture> COMPRESSED_TEXTURES = {
+    {"textures/viking_room_bc7.ktx2", VK_FORMAT_BC7_SRGB_BLOCK, 16},
+    {"textures/viking_room_bc1.ktx2", VK_FORMAT_BC1_RGB_SRGB_BLOCK, 8},
+    {"textures/viking_room_etc2.ktx2", VK_FORMAT_ETC2_R8G8B8_SRGB_BLOCK, 8}
+};
+
+struct AppOptions {
+    bool headless = false;
+    uint32_t benchmarkFrames = DEFAULT_BENCHMARK_FRAMES;
+    uint32_t instanceCount = 1;
+    uint32_t recordingThreads = 0; // 0 records everything inline on the main thread
+    bool gpuDriven = false; // cull on the gpu and draw all visible instances with one indirect draw
+    bool packedVertices = false; // upload the mesh as PackedVertex instead of Vertex
+    uint32_t dedupBenchmarkTriangles = 0; // run the vertex deduplication benchmark instead of the app
+    uint32_t loadThreads = 0; // threads used to load OBJ models, 0 uses one per hardware thread
+    std::string objBenchmarkPath; // run the OBJ loading benchmark on this model instead of the app
+    uint32_t stagingRingMiB = DEFAULT_STAGING_RING_MIB;
+    bool bindless = false; // sample from a descriptor indexing texture table that can grow while frames are in flight
+    bool dynamicRendering = false; // render without render pass and framebuffer objects
+    bool profile = false; // print the gpu and cpu recording times every second, always done by the benchmark
+    bool memoryReport = false; // print what the multisampled attachments cost at every sample count on exit
+};
+
+// Option values are plain decimal counts, anything else is reported along with the usage line
+uint32_t parseCountArgument(const std::string& option, const std::string& value, const std::string& usage) {
+    size_t length = 0;
+    unsigned long count = 0;
+
+    try {
+        if (!value.empty() && value[0] >= '0' && value[0] <= '9') {
+            count = std::stoul(value, &length);
+        }
+    } catch (const std::out_of_range&) {
+        length = 0;
+    }
+
+    if (length == 0 || length != value.size() || count > std::numeric_limits<uint32_t>::max()) {
+        throw std::runtime_error(option + " expects a count, got " + value + "\n" + usage);
+    }
+
+    return static_cast<uint32_t>(count);
+}
+
+AppOptions parseArguments(int argc, char** argv) {
+    AppOptions options;
+    const std::string usage = std::string("usage: ") + argv[0] + " [--headless] [--frames N] [--instances N] [--threads N] [--gpu-driven] [--packed-vertices] [--dedup-benchmark TRIANGLES] [--load-threads N] [--obj-benchmark PATH] [--staging-ring-mb N] [--bindless] [--dynamic-rendering] [--profile] [--memory-report]";
+    bool framesGiven = false;
+
+    for (int i = 1; i < argc; i++) {
+        std::string argument = argv[i];
+
+        if (argument == "--headless") {
+            options.headless = true;
+        } else if (argument == "--frames" && i + 1 < argc) {
+            options.benchmarkFrames = parseCountArgument(argument, argv[++i], usage);
+            framesGiven = true;
+        } else if (argument == "--instances" && i + 1 < argc) {
+            options.instanceCount = std::max(1u, parseCountArgument(argument, argv[++i], usage));
+        } else if (argument == "--threads" && i + 1 < argc) {
+            options.recordingThreads = parseCountArgument(argument, argv[++i], usage);
+        } else if (argument == "--gpu-driven") {
+            options.gpuDriven = true;
+        } else if (argument == "--packed-vertices") {
+            options.packedVertices = true;
+        } else if (argument == "--dedup-benchmark" && i + 1 < argc) {
+            options.dedupBenchmarkTriangles = parseCountArgument(argument, argv[++i], usage);
+        } else if (argument == "--load-threads" && i + 1 < argc) {
+            options.loadThreads = parseCountArgument(argument, argv[++i], usage);
+        } else if (argument == "--obj-benchmark" && i + 1 < argc) {
+            options.objBenchmarkPath = argv[++i];
+        } else if (argument == "--staging-ring-mb" && i + 1 < argc) {
+            options.stagingRingMiB = std::max(1u, parseCountArgument(argument, argv[++i], usage));
+        } else if (argument == "--bindless") {
+            options.bindless = true;
+        } else if (argument == "--dynamic-rendering") {
+            options.dynamicRendering = true;
+        } else if (argument == "--profile") {
+            options.profile = true;
+        } else if (argument == "--memory-report") {
+            options.memoryReport = true;
+        } else {
+            throw std::runtime_error("unknown argument: " + argument + "\n" + usage);
+        }
+    }
+
+    if (framesGiven && !options.headless) {
+        throw std::runtime_error("--frames only applies to --headless runs\n" + usage);
+    }
+
+    return options;
+}
+
 struct QueueFamilyIndices {
     std::optional<uint32_t> graphicsFamily;
     std::optional<uint32_t> presentFamily;
+    std::optional<uint32_t> transferFamily; // transfer-only family, if the device has one
 
     bool isComplete() {
         return graphicsFamily.has_value() && presentFamily.has_value();
@@ -93,52 +425,2286 @@ struct Vertex {
         bindingDescription.stride = sizeof(Vertex);
         bindingDescription.inputRate = VK_VERTEX_INPUT_RATE_VERTEX;
 
-        return bindingDescription;
+        return bindingDescription;
+    }
+
+    // The color is always white and the vertex shader doesn't read it, so like PackedVertex
+    // only the position and texture coordinate are fed to it
+    static std::array<VkVertexInputAttributeDescription, 2> getAttributeDescriptions() {
+        std::array<VkVertexInputAttributeDescription, 2> attributeDescriptions{};
+
+        attributeDescriptions[0].binding = 0;
+        attributeDescriptions[0].location = 0;
+        attributeDescriptions[0].format = VK_FORMAT_R32G32B32_SFLOAT;
+        attributeDescriptions[0].offset = offsetof(Vertex, pos);
+
+        attributeDescriptions[1].binding = 0;
+        attributeDescriptions[1].location = 2;
+        attributeDescriptions[1].format = VK_FORMAT_R32G32_SFLOAT;
+        attributeDescriptions[1].offset = offsetof(Vertex, texCoord);
+
+        return attributeDescriptions;
+    }
+
+    bool operator==(const Vertex& other) const {
+        return pos == other.pos && color == other.color && texCoord == other.texCoord;
+    }
+};
+
+// Compact alternative to Vertex. Positions are 16 bit fractions of the mesh bounding box, which
+// the vertex shader scales back with the position offset and scale in the uniform buffer, and
+// texture coordinates are half floats. The color is always white, so it is left out entirely.
+// Both formats are required to support vertex buffers, so no device check is needed.
+struct PackedVertex {
+    uint16_t pos[4]; // the fourth component only pads to a four component format
+    uint32_t texCoord;
+
+    static VkVertexInputBindingDescription getBindingDescription() {
+        VkVertexInputBindingDescription bindingDescription{};
+        bindingDescription.binding = 0;
+        bindingDescription.stride = sizeof(PackedVertex);
+        bindingDescription.inputRate = VK_VERTEX_INPUT_RATE_VERTEX;
+
+        return bindingDescription;
+    }
+
+    static std::array<VkVertexInputAttributeDescription, 2> getAttributeDescriptions() {
+        std::array<VkVertexInputAttributeDescription, 2> attributeDescriptions{};
+
+        attributeDescriptions[0].binding = 0;
+        attributeDescriptions[0].location = 0;
+        attributeDescriptions[0].format = VK_FORMAT_R16G16B16A16_UNORM;
+        attributeDescriptions[0].offset = offsetof(PackedVertex, pos);
+
+        attributeDescriptions[1].binding = 0;
+        attributeDescriptions[1].location = 2;
+        attributeDescriptions[1].format = VK_FORMAT_R16G16_SFLOAT;
+        attributeDescriptions[1].offset = offsetof(PackedVertex, texCoord);
+
+        return attributeDescriptions;
+    }
+
+    static PackedVertex pack(const Vertex& vertex, glm::vec3 boundsMin, glm::vec3 boundsExtent) {
+        PackedVertex packed{};
+
+        for (int i = 0; i < 3; i++) {
+            float t = boundsExtent[i] > 0.0f ? (vertex.pos[i] - boundsMin[i]) / boundsExtent[i] : 0.0f;
+            packed.pos[i] = static_cast<uint16_t>(std::round(std::clamp(t, 0.0f, 1.0f) * 65535.0f));
+        }
+
+        packed.texCoord = glm::packHalf2x16(vertex.texCoord);
+
+        return packed;
+    }
+};
+
+namespace std {
+    template<> struct hash<Vertex> {
+        size_t operator()(Vertex const& vertex) const {
+            return ((hash<glm::vec3>()(vertex.pos) ^ (hash<glm::vec3>()(vertex.color) << 1)) >> 1) ^ (hash<glm::vec2>()(vertex.texCoord) << 1);
+        }
+    };
+}
+
+// Open addressing hash table from a position/texture coordinate index pair to the vertex built from
+// it. The indices are canonical (see canonicalAttributeIndices), so equal pairs mean equal attribute
+// values. Hashing two integers is cheap, and the table is two flat arrays sized once up front
+// instead of one heap node per vertex.
+class VertexIndexTable {
+public:
+    explicit VertexIndexTable(size_t maxEntries) {
+        // Keep the load factor at or below one half
+        size_t capacity = 16;
+        while (capacity < maxEntries * 2) {
+            capacity *= 2;
+        }
+
+        mask = capacity - 1;
+        keys.resize(capacity);
+        values.resize(capacity, EMPTY);
+    }
+
+    static uint64_t makeKey(uint32_t position, uint32_t texcoord) {
+        return (uint64_t(position) << 32) | texcoord;
+    }
+
+    // Returns the vertex stored for key, or stores and returns newVertex if there is none yet
+    uint32_t findOrInsert(uint64_t key, uint32_t newVertex) {
+        for (size_t slot = hash(key) & mask; ; slot = (slot + 1) & mask) {
+            if (values[slot] == EMPTY) {
+                keys[slot] = key;
+                values[slot] = newVertex;
+                return newVertex;
+            }
+
+            if (keys[slot] == key) {
+                return values[slot];
+            }
+        }
+    }
+
+    static uint64_t hash(uint64_t key) {
+        // MurmurHash3 finalizer, every key bit affects the low bits used for the slot
+        key ^= key >> 33;
+        key *= 0xff51afd7ed558ccdull;
+        key ^= key >> 33;
+        key *= 0xc4ceb9fe1a85ec53ull;
+        key ^= key >> 33;
+        return key;
+    }
+
+private:
+    static constexpr uint32_t EMPTY = std::numeric_limits<uint32_t>::max();
+
+    size_t mask;
+    std::vector<uint64_t> keys;
+    std::vector<uint32_t> values;
+};
+
+// Maps every element of an attribute array with the given number of components to the first element
+// with the same values. OBJ exporters do write the same position or texture coordinate more than
+// once, and vertices must be merged by value like the std::unordered_map<Vertex> the loader used to
+// use, not by which of the duplicates a face happens to reference. Values compare like floats do,
+// so -0 and 0 are the same.
+std::vector<uint32_t> canonicalAttributeIndices(const std::vector<float>& values, size_t components) {
+    size_t count = values.size() / components;
+
+    size_t capacity = 16;
+    while (capacity < count * 2) {
+        capacity *= 2;
+    }
+    size_t mask = capacity - 1;
+    std::vector<uint32_t> slots(capacity, std::numeric_limits<uint32_t>::max());
+
+    auto bits = [&](size_t element, size_t component) {
+        float value = values[element * components + component];
+        if (value == 0.0f) {
+            value = 0.0f;
+        }
+        uint32_t result;
+        memcpy(&result, &value, sizeof(result));
+        return result;
+    };
+
+    auto equal = [&](size_t a, size_t b) {
+        for (size_t c = 0; c < components; c++) {
+            if (bits(a, c) != bits(b, c)) {
+                return false;
+            }
+        }
+        return true;
+    };
+
+    std::vector<uint32_t> canonical(count);
+    for (size_t i = 0; i < count; i++) {
+        uint64_t key = 0;
+        for (size_t c = 0; c < components; c++) {
+            key = VertexIndexTable::hash(key ^ bits(i, c));
+        }
+
+        for (size_t slot = key & mask; ; slot = (slot + 1) & mask) {
+            if (slots[slot] == std::numeric_limits<uint32_t>::max()) {
+                slots[slot] = static_cast<uint32_t>(i);
+                canonical[i] = static_cast<uint32_t>(i);
+                break;
+            }
+
+            if (equal(slots[slot], i)) {
+                canonical[i] = slots[slot];
+                break;
+            }
+        }
+    }
+
+    return canonical;
+}
+
+// Texture coordinates the way they end up in Vertex::texCoord, flipped vertically, followed by one
+// (0, 0) entry for faces without texture coordinates, which sample the texture's top left corner
+std::vector<float> flipObjTexcoords(const std::vector<float>& texcoords) {
+    std::vector<float> flipped(texcoords.size() + 2, 0.0f);
+    for (size_t i = 0; i + 1 < texcoords.size(); i += 2) {
+        flipped[i + 0] = texcoords[i + 0];
+        flipped[i + 1] = 1.0f - texcoords[i + 1];
+    }
+    return flipped;
+}
+
+// Builds the deduplicated vertex and index arrays for the faces of an OBJ file
+void buildObjVertices(const tinyobj::attrib_t& attrib, const std::vector<tinyobj::shape_t>& shapes, std::vector<Vertex>& vertices, std::vector<uint32_t>& indices) {
+    size_t totalIndices = 0;
+    for (const auto& shape : shapes) {
+        totalIndices += shape.mesh.indices.size();
+    }
+
+    std::vector<float> texcoords = flipObjTexcoords(attrib.texcoords);
+    std::vector<uint32_t> canonicalPositions = canonicalAttributeIndices(attrib.vertices, 3);
+    std::vector<uint32_t> canonicalTexcoords = canonicalAttributeIndices(texcoords, 2);
+    uint32_t missingTexcoord = canonicalTexcoords.back();
+
+    VertexIndexTable uniqueVertices(totalIndices);
+    vertices.reserve(vertices.size() + totalIndices / 4);
+    indices.reserve(indices.size() + totalIndices);
+
+    for (const auto& shape : shapes) {
+        for (const auto& index : shape.mesh.indices) {
+            uint32_t position = canonicalPositions[index.vertex_index];
+            uint32_t texcoord = index.texcoord_index >= 0 ? canonicalTexcoords[index.texcoord_index] : missingTexcoord;
+
+            uint32_t newVertex = static_cast<uint32_t>(vertices.size());
+            uint32_t vertexIndex = uniqueVertices.findOrInsert(VertexIndexTable::makeKey(position, texcoord), newVertex);
+
+            if (vertexIndex == newVertex) {
+                Vertex vertex{};
+
+                vertex.pos = {
+                    attrib.vertices[3 * position + 0],
+                    attrib.vertices[3 * position + 1],
+                    attrib.vertices[3 * position + 2]
+                };
+
+                vertex.texCoord = {
+                    texcoords[2 * texcoord + 0],
+                    texcoords[2 * texcoord + 1]
+                };
+
+                vertex.color = {1.0f, 1.0f, 1.0f};
+
+                vertices.push_back(vertex);
+            }
+
+            indices.push_back(vertexIndex);
+        }
+    }
+}
+
+// Size of the FIFO post-transform vertex cache that meshes are optimized for and measured with.
+// Real hardware differs, but orderings that do well on a small FIFO do well on most GPUs
+const uint32_t VERTEX_CACHE_SIZE = 16;
+
+// Sort the vertex cache friendly clusters of a mesh so that outward facing parts are drawn first
+const bool OPTIMIZE_MESH_OVERDRAW = true;
+
+struct VertexCacheStats {
+    float acmr; // average cache miss ratio: transformed vertices per triangle, 0.5 at best and 3 at worst
+    float atvr; // average transformed to vertex ratio: 1 at best
+};
+
+VertexCacheStats analyzeVertexCache(const std::vector<uint32_t>& indices, size_t vertexCount) {
+    // Vertex v is in the cache if it was one of the last VERTEX_CACHE_SIZE vertices to miss
+    std::vector<uint32_t> cacheTimestamps(vertexCount, 0);
+    uint32_t misses = 0;
+
+    for (uint32_t index : indices) {
+        if (cacheTimestamps[index] == 0 || cacheTimestamps[index] + VERTEX_CACHE_SIZE <= misses) {
+            cacheTimestamps[index] = ++misses;
+        }
+    }
+
+    VertexCacheStats stats{};
+    stats.acmr = indices.empty() ? 0.0f : static_cast<float>(misses) / (indices.size() / 3);
+    stats.atvr = vertexCount == 0 ? 0.0f : static_cast<float>(misses) / vertexCount;
+    return stats;
+}
+
+// Tipsify from "Fast Triangle Reordering for Vertex Locality and Reduced Overdraw" (Sander, Nehab
+// and Barczak 2007). Fans around one vertex at a time and picks the next one among the vertices of
+// the emitted triangles that will still be in the cache. Returns the reordered triangles and the
+// first triangle of every cluster, which starts wherever the walk had to jump to a distant vertex.
+std::vector<uint32_t> optimizeVertexCache(const std::vector<uint32_t>& indices, size_t vertexCount, std::vector<uint32_t>& clusterStarts) {
+    size_t triangleCount = indices.size() / 3;
+
+    // Triangles adjacent to each vertex, as a compact offset table
+    std::vector<uint32_t> liveTriangles(vertexCount, 0);
+    for (uint32_t index : indices) {
+        liveTriangles[index]++;
+    }
+
+    std::vector<uint32_t> adjacencyOffsets(vertexCount + 1, 0);
+    for (size_t v = 0; v < vertexCount; v++) {
+        adjacencyOffsets[v + 1] = adjacencyOffsets[v] + liveTriangles[v];
+    }
+
+    std::vector<uint32_t> adjacency(indices.size());
+    std::vector<uint32_t> adjacencyFill(adjacencyOffsets.begin(), adjacencyOffsets.end() - 1);
+    for (size_t i = 0; i < indices.size(); i++) {
+        adjacency[adjacencyFill[indices[i]]++] = static_cast<uint32_t>(i / 3);
+    }
+
+    std::vector<uint32_t> cacheTimestamps(vertexCount, 0);
+    std::vector<bool> emitted(triangleCount, false);
+    std::vector<uint32_t> deadEnds;
+    std::vector<uint32_t> candidates;
+    uint32_t timestamp = VERTEX_CACHE_SIZE + 1;
+    size_t cursor = 0;
+
+    std::vector<uint32_t> result;
+    result.reserve(indices.size());
+    clusterStarts.clear();
+
+    // Falls back to recently used vertices, then to the first vertex in input order with triangles left
+    auto skipDeadEnd = [&]() -> int64_t {
+        while (!deadEnds.empty()) {
+            uint32_t vertex = deadEnds.back();
+            deadEnds.pop_back();
+            if (liveTriangles[vertex] > 0) {
+                return vertex;
+            }
+        }
+
+        while (cursor < vertexCount) {
+            if (liveTriangles[cursor] > 0) {
+                return static_cast<int64_t>(cursor);
+            }
+            cursor++;
+        }
+
+        return -1;
+    };
+
+    int64_t fanningVertex = vertexCount > 0 ? skipDeadEnd() : -1;
+    bool newCluster = true;
+
+    while (fanningVertex >= 0) {
+        if (newCluster) {
+            clusterStarts.push_back(static_cast<uint32_t>(result.size() / 3));
+            newCluster = false;
+        }
+
+        candidates.clear();
+
+        for (uint32_t a = adjacencyOffsets[fanningVertex]; a < adjacencyOffsets[fanningVertex + 1]; a++) {
+            uint32_t triangle = adjacency[a];
+            if (emitted[triangle]) {
+                continue;
+            }
+
+            for (uint32_t k = 0; k < 3; k++) {
+                uint32_t vertex = indices[triangle * 3 + k];
+                result.push_back(vertex);
+                deadEnds.push_back(vertex);
+                candidates.push_back(vertex);
+                liveTriangles[vertex]--;
+
+                if (timestamp - cacheTimestamps[vertex] > VERTEX_CACHE_SIZE) {
+                    cacheTimestamps[vertex] = timestamp++;
+                }
+            }
+
+            emitted[triangle] = true;
+        }
+
+        // Prefer the candidate that entered the cache earliest and will still be there after its
+        // remaining triangles are emitted
+        int64_t best = -1;
+        int64_t bestPriority = -1;
+        for (uint32_t vertex : candidates) {
+            if (liveTriangles[vertex] == 0) {
+                continue;
+            }
+
+            int64_t priority = 0;
+            if (timestamp - cacheTimestamps[vertex] + 2 * liveTriangles[vertex] <= VERTEX_CACHE_SIZE) {
+                priority = timestamp - cacheTimestamps[vertex];
+            }
+
+            if (priority > bestPriority) {
+                bestPriority = priority;
+                best = vertex;
+            }
+        }
+
+        if (best < 0) {
+            best = skipDeadEnd();
+            newCluster = true;
+        }
+
+        fanningVertex = best;
+    }
+
+    return result;
+}
+
+// Orders the clusters so that the ones facing away from the mesh center, which tend to occlude
+// the rest, are drawn first. The measure is view independent, so it only has to be computed once
+template<typename Position>
+std::vector<uint32_t> optimizeOverdraw(const std::vector<uint32_t>& indices, const std::vector<uint32_t>& clusterStarts, Position position) {
+    size_t triangleCount = indices.size() / 3;
+
+    glm::vec3 meshCentroid(0.0f);
+    float meshArea = 0.0f;
+    for (size_t t = 0; t < triangleCount; t++) {
+        glm::vec3 a = position(indices[t * 3 + 0]);
+        glm::vec3 b = position(indices[t * 3 + 1]);
+        glm::vec3 c = position(indices[t * 3 + 2]);
+        float area = glm::length(glm::cross(b - a, c - a));
+        meshCentroid += (a + b + c) / 3.0f * area;
+        meshArea += area;
+    }
+    if (meshArea > 0.0f) {
+        meshCentroid /= meshArea;
+    }
+
+    std::vector<float> clusterSortKeys(clusterStarts.size());
+    for (size_t i = 0; i < clusterStarts.size(); i++) {
+        size_t end = i + 1 < clusterStarts.size() ? clusterStarts[i + 1] : triangleCount;
+
+        glm::vec3 centroid(0.0f);
+        glm::vec3 normal(0.0f);
+        float area = 0.0f;
+        for (size_t t = clusterStarts[i]; t < end; t++) {
+            glm::vec3 a = position(indices[t * 3 + 0]);
+            glm::vec3 b = position(indices[t * 3 + 1]);
+            glm::vec3 c = position(indices[t * 3 + 2]);
+            glm::vec3 areaNormal = glm::cross(b - a, c - a);
+            float triangleArea = glm::length(areaNormal);
+            centroid += (a + b + c) / 3.0f * triangleArea;
+            normal += areaNormal;
+            area += triangleArea;
+        }
+
+        float normalLength = glm::length(normal);
+        if (area > 0.0f && normalLength > 0.0f) {
+            clusterSortKeys[i] = glm::dot(centroid / area - meshCentroid, normal / normalLength);
+        }
+    }
+
+    std::vector<uint32_t> clusterOrder(clusterStarts.size());
+    for (size_t i = 0; i < clusterOrder.size(); i++) {
+        clusterOrder[i] = static_cast<uint32_t>(i);
+    }
+    std::stable_sort(clusterOrder.begin(), clusterOrder.end(), [&](uint32_t a, uint32_t b) {
+        return clusterSortKeys[a] > clusterSortKeys[b];
+    });
+
+    std::vector<uint32_t> result;
+    result.reserve(indices.size());
+    for (uint32_t cluster : clusterOrder) {
+        size_t end = cluster + 1 < clusterStarts.size() ? clusterStarts[cluster + 1] : triangleCount;
+        result.insert(result.end(), indices.begin() + clusterStarts[cluster] * 3, indices.begin() + end * 3);
+    }
+
+    return result;
+}
+
+// Renumbers the vertices in the order the triangles first reference them, so vertex fetches walk
+// through the vertex buffer mostly sequentially. Unreferenced vertices are dropped
+template<typename VertexType>
+void optimizeVertexFetch(std::vector<VertexType>& vertices, std::vector<uint32_t>& indices) {
+    const uint32_t unassigned = std::numeric_limits<uint32_t>::max();
+    std::vector<uint32_t> remap(vertices.size(), unassigned);
+    std::vector<VertexType> reordered;
+    reordered.reserve(vertices.size());
+
+    for (uint32_t& index : indices) {
+        if (remap[index] == unassigned) {
+            remap[index] = static_cast<uint32_t>(reordered.size());
+            reordered.push_back(vertices[index]);
+        }
+        index = remap[index];
+    }
+
+    vertices = std::move(reordered);
+}
+
+// Range of the index buffer that is drawn with its own base vertex
+struct Submesh {
+    uint32_t firstIndex;
+    uint32_t indexCount;
+    int32_t vertexOffset;
+};
+
+// Splits the triangles, in order, into runs whose vertices all lie within 65536 of the run's lowest
+// vertex and stores their indices relative to it. Meshes with fewer vertices end up as a single
+// submesh, and meshes ordered by optimizeVertexFetch split into few long runs. Fails if a single
+// triangle spans too many vertices.
+bool buildSubmeshes16(const uint32_t* indices, uint32_t indexCount, std::vector<uint16_t>& indices16, std::vector<Submesh>& submeshes) {
+    const uint32_t maxRange = std::numeric_limits<uint16_t>::max();
+
+    indices16.resize(indexCount);
+    submeshes.clear();
+
+    uint32_t first = 0;
+    uint32_t lowest = std::numeric_limits<uint32_t>::max();
+    uint32_t highest = 0;
+
+    auto closeSubmesh = [&](uint32_t end) {
+        for (uint32_t i = first; i < end; i++) {
+            indices16[i] = static_cast<uint16_t>(indices[i] - lowest);
+        }
+        submeshes.push_back({first, end - first, static_cast<int32_t>(lowest)});
+    };
+
+    for (uint32_t i = 0; i + 2 < indexCount; i += 3) {
+        uint32_t triangleLowest = std::min({indices[i], indices[i + 1], indices[i + 2]});
+        uint32_t triangleHighest = std::max({indices[i], indices[i + 1], indices[i + 2]});
+
+        if (triangleHighest - triangleLowest > maxRange) {
+            return false;
+        }
+
+        if (std::max(highest, triangleHighest) - std::min(lowest, triangleLowest) > maxRange) {
+            closeSubmesh(i);
+            first = i;
+            lowest = triangleLowest;
+            highest = triangleHighest;
+        } else {
+            lowest = std::min(lowest, triangleLowest);
+            highest = std::max(highest, triangleHighest);
+        }
+    }
+
+    if (first < indexCount) {
+        closeSubmesh(indexCount);
+    }
+
+    return true;
+}
+
+struct UniformBufferObject {
+    alignas(16) glm::mat4 model;
+    alignas(16) glm::mat4 view;
+    alignas(16) glm::mat4 proj;
+    alignas(16) glm::vec4 positionOffset; // dequantizes PackedVertex positions, zero for Vertex
+    alignas(16) glm::vec4 positionScale;  // one for Vertex
+};
+
+struct MemoryBlock {
+    VkDeviceMemory memory = VK_NULL_HANDLE;
+    VkDeviceSize size = 0;
+    void* mapped = nullptr;
+    bool dedicated = false;
+    uint32_t allocationCount = 0;
+    std::map<VkDeviceSize, VkDeviceSize> freeRanges; // offset -> size
+};
+
+struct Allocation {
+    VkDeviceMemory memory = VK_NULL_HANDLE;
+    VkDeviceSize offset = 0;
+    VkDeviceSize size = 0;
+    void* mapped = nullptr;
+    MemoryBlock* block = nullptr;
+    uint32_t poolIndex = 0;
+};
+
+struct AllocatorStats {
+    uint64_t allocationRequests = 0;
+    uint32_t liveAllocations = 0;
+    uint32_t deviceMemoryAllocations = 0;
+    uint32_t liveBlocks = 0;
+    uint32_t peakBlocks = 0;
+    VkDeviceSize reservedBytes = 0;
+    VkDeviceSize usedBytes = 0;
+    VkDeviceSize peakUsedBytes = 0;
+};
+
+// Sub-allocates resources from large VkDeviceMemory blocks instead of calling
+// vkAllocateMemory for every buffer and image. Blocks are pooled per memory type,
+// and linear resources (buffers) never share a block with optimally tiled images,
+// so bufferImageGranularity can not cause aliasing between neighbours.
+class DeviceMemoryAllocator {
+public:
+    static constexpr VkDeviceSize DEFAULT_BLOCK_SIZE = 64 * 1024 * 1024;
+
+    void init(VkPhysicalDevice physicalDevice, VkDevice device) {
+        this->device = device;
+
+        vkGetPhysicalDeviceMemoryProperties(physicalDevice, &memProperties);
+
+        VkPhysicalDeviceProperties properties;
+        vkGetPhysicalDeviceProperties(physicalDevice, &properties);
+        maxAllocationCount = properties.limits.maxMemoryAllocationCount;
+    }
+
+    Allocation allocate(const VkMemoryRequirements& memRequirements, uint32_t memoryTypeIndex, bool linear, bool dedicated = false) {
+        uint32_t poolIndex = memoryTypeIndex * 2 + (linear ? 1 : 0);
+        VkDeviceSize blockSize = preferredBlockSize(memoryTypeIndex);
+
+        Allocation allocation{};
+        allocation.poolIndex = poolIndex;
+        allocation.size = memRequirements.size;
+
+        // Large resources get a block of their own so they don't fragment the shared blocks
+        if (dedicated || memRequirements.size > blockSize / 2) {
+            MemoryBlock* block = createBlock(poolIndex, memoryTypeIndex, memRequirements.size, true);
+            block->freeRanges.clear();
+            commit(allocation, block, 0);
+            return allocation;
+        }
+
+        for (auto& block : pools[poolIndex]) {
+            if (!block->dedicated && suballocate(*block, memRequirements, allocation)) {
+                return allocation;
+            }
+        }
+
+        MemoryBlock* block = createBlock(poolIndex, memoryTypeIndex, blockSize, false);
+        if (!suballocate(*block, memRequirements, allocation)) {
+            throw std::runtime_error("failed to sub-allocate from a new memory block!");
+        }
+
+        return allocation;
+    }
+
+    void free(Allocation& allocation) {
+        MemoryBlock* block = allocation.block;
+        if (block == nullptr) {
+            return;
+        }
+
+        block->allocationCount--;
+        stats.liveAllocations--;
+        stats.usedBytes -= allocation.size;
+
+        if (block->dedicated) {
+            destroyBlock(allocation.poolIndex, block);
+        } else {
+            releaseRange(*block, allocation.offset, allocation.size);
+        }
+
+        allocation = Allocation{};
+    }
+
+    void destroy() {
+        for (auto& pool : pools) {
+            for (auto& block : pool) {
+                vkFreeMemory(device, block->memory, nullptr);
+            }
+            pool.clear();
+        }
+        stats.liveBlocks = 0;
+        stats.reservedBytes = 0;
+    }
+
+    const AllocatorStats& getStats() const {
+        return stats;
+    }
+
+    VkMemoryPropertyFlags getMemoryProperties(const Allocation& allocation) const {
+        return memProperties.memoryTypes[allocation.poolIndex / 2].propertyFlags;
+    }
+
+    void printStats() const {
+        const double MiB = 1024.0 * 1024.0;
+        std::cout << "memory allocator: " << stats.allocationRequests << " allocations served by "
+                  << stats.deviceMemoryAllocations << " vkAllocateMemory calls ("
+                  << (stats.allocationRequests - stats.deviceMemoryAllocations) << " avoided), peak "
+                  << stats.peakBlocks << " of " << maxAllocationCount << " device memory objects in use, "
+                  << stats.peakUsedBytes / MiB << " MiB peak used of "
+                  << stats.reservedBytes / MiB << " MiB reserved" << std::endl;
+    }
+
+private:
+    VkDevice device = VK_NULL_HANDLE;
+    VkPhysicalDeviceMemoryProperties memProperties{};
+    uint32_t maxAllocationCount = 0;
+
+    std::array<std::vector<std::unique_ptr<MemoryBlock>>, VK_MAX_MEMORY_TYPES * 2> pools;
+    AllocatorStats stats;
+
+    VkDeviceSize preferredBlockSize(uint32_t memoryTypeIndex) const {
+        // Don't let a single block claim a large share of small heaps (e.g. 256 MiB BAR memory)
+        VkDeviceSize heapSize = memProperties.memoryHeaps[memProperties.memoryTypes[memoryTypeIndex].heapIndex].size;
+        return std::min(DEFAULT_BLOCK_SIZE, heapSize / 8);
+    }
+
+    MemoryBlock* createBlock(uint32_t poolIndex, uint32_t memoryTypeIndex, VkDeviceSize size, bool dedicated) {
+        VkMemoryAllocateInfo allocInfo{};
+        allocInfo.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
+        allocInfo.allocationSize = size;
+        allocInfo.memoryTypeIndex = memoryTypeIndex;
+
+        auto block = std::make_unique<MemoryBlock>();
+        if (vkAllocateMemory(device, &allocInfo, nullptr, &block->memory) != VK_SUCCESS) {
+            throw std::runtime_error("failed to allocate device memory block!");
+        }
+
+        // Host visible blocks stay mapped for their whole lifetime, since a VkDeviceMemory
+        // can only be mapped once and is now shared by many resources
+        if (memProperties.memoryTypes[memoryTypeIndex].propertyFlags & VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT) {
+            vkMapMemory(device, block->memory, 0, size, 0, &block->mapped);
+        }
+
+        block->size = size;
+        block->dedicated = dedicated;
+        block->freeRanges[0] = size;
+
+        stats.deviceMemoryAllocations++;
+        stats.liveBlocks++;
+        stats.peakBlocks = std::max(stats.peakBlocks, stats.liveBlocks);
+        stats.reservedBytes += size;
+
+        pools[poolIndex].push_back(std::move(block));
+        return pools[poolIndex].back().get();
+    }
+
+    void destroyBlock(uint32_t poolIndex, MemoryBlock* block) {
+        vkFreeMemory(device, block->memory, nullptr);
+
+        stats.liveBlocks--;
+        stats.reservedBytes -= block->size;
+
+        auto& pool = pools[poolIndex];
+        pool.erase(std::remove_if(pool.begin(), pool.end(), [block](const std::unique_ptr<MemoryBlock>& b) { return b.get() == block; }), pool.end());
+    }
+
+    bool suballocate(MemoryBlock& block, const VkMemoryRequirements& memRequirements, Allocation& allocation) {
+        // First fit over the free ranges, which are kept sorted by offset
+        for (auto it = block.freeRanges.begin(); it != block.freeRanges.end(); ++it) {
+            VkDeviceSize rangeOffset = it->first;
+            VkDeviceSize rangeEnd = it->first + it->second;
+            VkDeviceSize alignedOffset = (rangeOffset + memRequirements.alignment - 1) / memRequirements.alignment * memRequirements.alignment;
+
+            if (alignedOffset + memRequirements.size > rangeEnd) {
+                continue;
+            }
+
+            block.freeRanges.erase(it);
+            if (alignedOffset > rangeOffset) {
+                block.freeRanges[rangeOffset] = alignedOffset - rangeOffset;
+            }
+            if (alignedOffset + memRequirements.size < rangeEnd) {
+                block.freeRanges[alignedOffset + memRequirements.size] = rangeEnd - (alignedOffset + memRequirements.size);
+            }
+
+            commit(allocation, &block, alignedOffset);
+            return true;
+        }
+
+        return false;
+    }
+
+    void commit(Allocation& allocation, MemoryBlock* block, VkDeviceSize offset) {
+        allocation.memory = block->memory;
+        allocation.offset = offset;
+        allocation.block = block;
+        allocation.mapped = block->mapped != nullptr ? static_cast<char*>(block->mapped) + offset : nullptr;
+
+        block->allocationCount++;
+
+        stats.allocationRequests++;
+        stats.liveAllocations++;
+        stats.usedBytes += allocation.size;
+        stats.peakUsedBytes = std::max(stats.peakUsedBytes, stats.usedBytes);
+    }
+
+    void releaseRange(MemoryBlock& block, VkDeviceSize offset, VkDeviceSize size) {
+        auto next = block.freeRanges.lower_bound(offset);
+
+        // Merge with the free range that follows
+        if (next != block.freeRanges.end() && offset + size == next->first) {
+            size += next->second;
+            next = block.freeRanges.erase(next);
+        }
+
+        // Merge with the free range that precedes
+        if (next != block.freeRanges.begin()) {
+            auto prev = std::prev(next);
+            if (prev->first + prev->second == offset) {
+                prev->second += size;
+                return;
+            }
+        }
+
+        block.freeRanges[offset] = size;
+    }
+};
+
+struct UploadToken {
+    uint64_t value = 0;
+};
+
+// Part of the staging ring that the caller fills through the persistent mapping
+struct StagingRegion {
+    VkBuffer buffer = VK_NULL_HANDLE;
+    VkDeviceSize offset = 0;
+    void* mapped = nullptr;
+};
+
+struct StagingRingStats {
+    VkDeviceSize capacity = 0;
+    uint64_t allocations = 0;
+    VkDeviceSize peakUsedBytes = 0;  // high-water mark over all partitions still in flight
+    VkDeviceSize peakBatchBytes = 0; // largest single partition
+    uint32_t stalls = 0;             // allocations that had to wait for the GPU to retire a partition
+    uint32_t oversizedRequests = 0;  // requests larger than the whole ring
+};
+
+// Hands out staging memory from one persistently mapped buffer, so streaming uploads
+// never create buffers or map memory. Allocations are grouped into partitions, one per
+// submitted batch of work, and a partition is recycled once the value it was closed with
+// retires. Offsets grow monotonically and wrap around the buffer, so the bytes in use
+// are always head - tail.
+class StagingRing {
+public:
+    void init(VkBuffer buffer, void* mapped, VkDeviceSize capacity, VkDeviceSize alignment) {
+        this->buffer = buffer;
+        this->mapped = static_cast<char*>(mapped);
+        this->capacity = capacity;
+        this->alignment = alignment;
+        stats.capacity = capacity;
+    }
+
+    bool fits(VkDeviceSize size) const {
+        return size <= capacity;
+    }
+
+    std::optional<StagingRegion> allocate(VkDeviceSize size) {
+        // An empty ring restarts at offset zero so the whole capacity is contiguous
+        if (head == tail) {
+            head = tail = (head + capacity - 1) / capacity * capacity;
+            partitionStart = head;
+        }
+
+        VkDeviceSize offset = head % capacity;
+        VkDeviceSize alignedOffset = (offset + alignment - 1) / alignment * alignment;
+        VkDeviceSize newHead = head + (alignedOffset - offset) + size;
+
+        // Never split a region across the end of the buffer, skip the remainder instead
+        if (alignedOffset + size > capacity) {
+            alignedOffset = 0;
+            newHead = head + (capacity - offset) + size;
+        }
+
+        if (newHead - tail > capacity) {
+            return std::nullopt;
+        }
+
+        head = newHead;
+
+        stats.allocations++;
+        stats.peakUsedBytes = std::max(stats.peakUsedBytes, head - tail);
+        stats.peakBatchBytes = std::max(stats.peakBatchBytes, head - partitionStart);
+
+        StagingRegion region{};
+        region.buffer = buffer;
+        region.offset = alignedOffset;
+        region.mapped = mapped + alignedOffset;
+        return region;
+    }
+
+    bool hasOpenPartition() const {
+        return head != partitionStart;
+    }
+
+    // Everything allocated since the last call stays in use until retire(value)
+    void closePartition(uint64_t value) {
+        if (!hasOpenPartition()) {
+            return;
+        }
+
+        partitions.push_back({value, head});
+        partitionStart = head;
+    }
+
+    void retire(uint64_t completedValue) {
+        while (!partitions.empty() && partitions.front().value <= completedValue) {
+            tail = partitions.front().end;
+            partitions.pop_front();
+        }
+    }
+
+    StagingRingStats& getStats() {
+        return stats;
+    }
+
+    void printStats() const {
+        const double MiB = 1024.0 * 1024.0;
+        std::cout << "staging ring: " << stats.allocations << " allocations, peak "
+                  << stats.peakUsedBytes / MiB << " MiB in flight of " << stats.capacity / MiB << " MiB, largest batch "
+                  << stats.peakBatchBytes / MiB << " MiB, " << stats.stalls << " stalls, "
+                  << stats.oversizedRequests << " oversized uploads" << std::endl;
+    }
+
+private:
+    struct Partition {
+        uint64_t value;
+        VkDeviceSize end;
+    };
+
+    VkBuffer buffer = VK_NULL_HANDLE;
+    char* mapped = nullptr;
+    VkDeviceSize capacity = 0;
+    VkDeviceSize alignment = 1;
+
+    VkDeviceSize head = 0;
+    VkDeviceSize tail = 0;
+    VkDeviceSize partitionStart = 0;
+    std::deque<Partition> partitions;
+
+    StagingRingStats stats;
+};
+
+// Records staging copies into batches that are submitted without stalling the CPU.
+// When the device exposes a transfer-only queue family the copies run there, and
+// ownership of every destination is released to the graphics family, which acquires
+// it at the start of the batch's graphics command buffer. Each flush returns a token
+// backed by a fence; staging memory handed out by the engine is recycled once it signals.
+class UploadEngine {
+public:
+    void init(VkDevice device, DeviceMemoryAllocator* allocator, uint32_t graphicsFamily, VkQueue graphicsQueue, std::optional<uint32_t> transferFamily, VkQueue transferQueue) {
+        this->device = device;
+        this->allocator = allocator;
+        this->graphicsFamily = graphicsFamily;
+        this->graphicsQueue = graphicsQueue;
+        this->transferFamily = transferFamily.value_or(graphicsFamily);
+        this->transferQueue = transferFamily.has_value() ? transferQueue : graphicsQueue;
+
+        graphicsCommandPool = createCommandPool(graphicsFamily);
+        if (hasDedicatedTransferQueue()) {
+            transferCommandPool = createCommandPool(this->transferFamily);
+        }
+    }
+
+    void destroy() {
+        waitIdle();
+
+        if (hasDedicatedTransferQueue()) {
+            vkDestroyCommandPool(device, transferCommandPool, nullptr);
+        }
+        vkDestroyCommandPool(device, graphicsCommandPool, nullptr);
+    }
+
+    bool hasDedicatedTransferQueue() const {
+        return transferFamily != graphicsFamily;
+    }
+
+    // The ring buffer must stay persistently mapped and outlive the engine
+    void initStagingRing(VkBuffer buffer, void* mapped, VkDeviceSize capacity, VkDeviceSize alignment) {
+        stagingRing.init(buffer, mapped, capacity, alignment);
+    }
+
+    // Returns staging memory that stays valid until the current batch has finished executing.
+    // Blocks only when the ring is exhausted by batches still in flight, and returns nothing
+    // for requests larger than the whole ring.
+    std::optional<StagingRegion> allocateStaging(VkDeviceSize size) {
+        if (!stagingRing.fits(size)) {
+            stagingRing.getStats().oversizedRequests++;
+            return std::nullopt;
+        }
+
+        openBatch();
+
+        std::optional<StagingRegion> region = stagingRing.allocate(size);
+        if (region.has_value()) {
+            return region;
+        }
+
+        stagingRing.getStats().stalls++;
+
+        // The current batch may hold part of the ring itself, so it has to be submitted before waiting
+        flush();
+        while (!(region = stagingRing.allocate(size)).has_value()) {
+            if (inFlight.empty()) {
+                throw std::runtime_error("failed to allocate staging memory!");
+            }
+            wait(UploadToken{inFlight.front().id});
+        }
+
+        openBatch();
+        return region;
+    }
+
+    void copyBuffer(const StagingRegion& src, VkBuffer dstBuffer, VkDeviceSize size, VkPipelineStageFlags dstStage, VkAccessFlags dstAccess) {
+        Batch& batch = openBatch();
+
+        VkBufferCopy copyRegion{};
+        copyRegion.srcOffset = src.offset;
+        copyRegion.size = size;
+        vkCmdCopyBuffer(batch.transferCommandBuffer, src.buffer, dstBuffer, 1, &copyRegion);
+
+        VkBufferMemoryBarrier barrier{};
+        barrier.sType = VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER;
+        barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+        barrier.dstAccessMask = dstAccess;
+        barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+        barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+        barrier.buffer = dstBuffer;
+        barrier.offset = 0;
+        barrier.size = VK_WHOLE_SIZE;
+
+        if (!hasDedicatedTransferQueue()) {
+            vkCmdPipelineBarrier(batch.graphicsCommandBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT, dstStage, 0, 0, nullptr, 1, &barrier, 0, nullptr);
+            return;
+        }
+
+        barrier.srcQueueFamilyIndex = transferFamily;
+        barrier.dstQueueFamilyIndex = graphicsFamily;
+
+        // Release on the transfer queue; the destination access mask is ignored here
+        barrier.dstAccessMask = 0;
+        vkCmdPipelineBarrier(batch.transferCommandBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, 0, 0, nullptr, 1, &barrier, 0, nullptr);
+
+        // Acquire on the graphics queue; the source access mask is ignored here
+        barrier.srcAccessMask = 0;
+        barrier.dstAccessMask = dstAccess;
+        vkCmdPipelineBarrier(batch.graphicsCommandBuffer, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, dstStage, 0, 0, nullptr, 1, &barrier, 0, nullptr);
+    }
+
+    // Copies the buffer into mip level 0. Afterwards every mip level of the image is owned
+    // by the graphics queue in VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, so the caller can
+    // continue with graphics-only work (e.g. blits) in graphicsCommandBuffer().
+    void copyBufferToImage(const StagingRegion& src, VkImage image, uint32_t width, uint32_t height, uint32_t mipLevels) {
+        VkBufferImageCopy region{};
+        region.bufferOffset = 0;
+        region.bufferRowLength = 0;
+        region.bufferImageHeight = 0;
+        region.imageSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+        region.imageSubresource.mipLevel = 0;
+        region.imageSubresource.baseArrayLayer = 0;
+        region.imageSubresource.layerCount = 1;
+        region.imageOffset = {0, 0, 0};
+        region.imageExtent = {
+            width,
+            height,
+            1
+        };
+
+        copyBufferToImage(src, image, {region}, mipLevels);
+    }
+
+    // Same as above, but with arbitrary regions, e.g. one per prebuilt mip level.
+    // Buffer offsets are relative to the start of the staging region.
+    void copyBufferToImage(const StagingRegion& src, VkImage image, std::vector<VkBufferImageCopy> regions, uint32_t mipLevels) {
+        Batch& batch = openBatch();
+
+        for (auto& region : regions) {
+            region.bufferOffset += src.offset;
+        }
+
+        VkImageMemoryBarrier barrier{};
+        barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+        barrier.oldLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+        barrier.newLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+        barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+        barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+        barrier.image = image;
+        barrier.subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+        barrier.subresourceRange.baseMipLevel = 0;
+        barrier.subresourceRange.levelCount = mipLevels;
+        barrier.subresourceRange.baseArrayLayer = 0;
+        barrier.subresourceRange.layerCount = 1;
+        barrier.srcAccessMask = 0;
+        barrier.dstAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+
+        vkCmdPipelineBarrier(batch.transferCommandBuffer, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT, 0, 0, nullptr, 0, nullptr, 1, &barrier);
+
+        vkCmdCopyBufferToImage(batch.transferCommandBuffer, src.buffer, image, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, static_cast<uint32_t>(regions.size()), regions.data());
+
+        if (!hasDedicatedTransferQueue()) {
+            return;
+        }
+
+        // The layout stays the same, the barrier pair only moves ownership to the graphics family
+        barrier.oldLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+        barrier.srcQueueFamilyIndex = transferFamily;
+        barrier.dstQueueFamilyIndex = graphicsFamily;
+
+        barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+        barrier.dstAccessMask = 0;
+        vkCmdPipelineBarrier(batch.transferCommandBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, 0, 0, nullptr, 0, nullptr, 1, &barrier);
+
+        barrier.srcAccessMask = 0;
+        barrier.dstAccessMask = VK_ACCESS_TRANSFER_READ_BIT | VK_ACCESS_TRANSFER_WRITE_BIT;
+        vkCmdPipelineBarrier(batch.graphicsCommandBuffer, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT, 0, 0, nullptr, 0, nullptr, 1, &barrier);
+    }
+
+    // Commands recorded here execute on the graphics queue after all ownership
+    // acquires recorded so far in the current batch
+    VkCommandBuffer graphicsCommandBuffer() {
+        return openBatch().graphicsCommandBuffer;
+    }
+
+    // The staging buffer is destroyed once the current batch has finished executing
+    void releaseAfterUpload(VkBuffer stagingBuffer, const Allocation& stagingAllocation) {
+        openBatch().stagingBuffers.push_back({stagingBuffer, stagingAllocation});
+    }
+
+    UploadToken flush() {
+        if (!currentBatch.has_value()) {
+            return UploadToken{lastSubmitted};
+        }
+
+        Batch batch = std::move(currentBatch.value());
+        currentBatch.reset();
+
+        stagingRing.closePartition(batch.id);
+
+        VkFenceCreateInfo fenceInfo{};
+        fenceInfo.sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO;
+
+        if (vkCreateFence(device, &fenceInfo, nullptr, &batch.fence) != VK_SUCCESS) {
+            throw std::runtime_error("failed to create upload fence!");
+        }
+
+        VkSubmitInfo graphicsSubmitInfo{};
+        graphicsSubmitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+        graphicsSubmitInfo.commandBufferCount = 1;
+        graphicsSubmitInfo.pCommandBuffers = &batch.graphicsCommandBuffer;
+
+        VkPipelineStageFlags waitStage = VK_PIPELINE_STAGE_ALL_COMMANDS_BIT;
+
+        if (hasDedicatedTransferQueue()) {
+            vkEndCommandBuffer(batch.transferCommandBuffer);
+
+            VkSemaphoreCreateInfo semaphoreInfo{};
+            semaphoreInfo.sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO;
+
+            if (vkCreateSemaphore(device, &semaphoreInfo, nullptr, &batch.transferFinished) != VK_SUCCESS) {
+                throw std::runtime_error("failed to create upload semaphore!");
+            }
+
+            VkSubmitInfo transferSubmitInfo{};
+            transferSubmitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+            transferSubmitInfo.commandBufferCount = 1;
+            transferSubmitInfo.pCommandBuffers = &batch.transferCommandBuffer;
+            transferSubmitInfo.signalSemaphoreCount = 1;
+            transferSubmitInfo.pSignalSemaphores = &batch.transferFinished;
+
+            if (vkQueueSubmit(transferQueue, 1, &transferSubmitInfo, VK_NULL_HANDLE) != VK_SUCCESS) {
+                throw std::runtime_error("failed to submit upload batch to the transfer queue!");
+            }
+
+            graphicsSubmitInfo.waitSemaphoreCount = 1;
+            graphicsSubmitInfo.pWaitSemaphores = &batch.transferFinished;
+            graphicsSubmitInfo.pWaitDstStageMask = &waitStage;
+        }
+
+        vkEndCommandBuffer(batch.graphicsCommandBuffer);
+
+        // Later graphics submissions are ordered after the acquire barriers, so nothing
+        // has to wait on the CPU; the fence only tells us when staging memory is reusable
+        if (vkQueueSubmit(graphicsQueue, 1, &graphicsSubmitInfo, batch.fence) != VK_SUCCESS) {
+            throw std::runtime_error("failed to submit upload batch to the graphics queue!");
+        }
+
+        lastSubmitted = batch.id;
+        inFlight.push_back(std::move(batch));
+
+        return UploadToken{lastSubmitted};
+    }
+
+    bool isComplete(UploadToken token) {
+        collect();
+        return token.value <= lastCompleted;
+    }
+
+    void wait(UploadToken token) {
+        for (const Batch& batch : inFlight) {
+            if (batch.id <= token.value) {
+                vkWaitForFences(device, 1, &batch.fence, VK_TRUE, UINT64_MAX);
+            }
+        }
+        collect();
+    }
+
+    void waitIdle() {
+        wait(flush());
+    }
+
+    // Frees the resources of every batch that has finished executing
+    void collect() {
+        while (!inFlight.empty() && vkGetFenceStatus(device, inFlight.front().fence) == VK_SUCCESS) {
+            Batch& batch = inFlight.front();
+
+            for (auto& staging : batch.stagingBuffers) {
+                vkDestroyBuffer(device, staging.first, nullptr);
+                allocator->free(staging.second);
+            }
+
+            vkDestroyFence(device, batch.fence, nullptr);
+            vkFreeCommandBuffers(device, graphicsCommandPool, 1, &batch.graphicsCommandBuffer);
+            if (hasDedicatedTransferQueue()) {
+                vkDestroySemaphore(device, batch.transferFinished, nullptr);
+                vkFreeCommandBuffers(device, transferCommandPool, 1, &batch.transferCommandBuffer);
+            }
+
+            lastCompleted = batch.id;
+            inFlight.pop_front();
+        }
+
+        stagingRing.retire(lastCompleted);
+    }
+
+    void printStats() const {
+        stagingRing.printStats();
+    }
+
+private:
+    struct Batch {
+        uint64_t id = 0;
+        VkCommandBuffer transferCommandBuffer = VK_NULL_HANDLE;
+        VkCommandBuffer graphicsCommandBuffer = VK_NULL_HANDLE;
+        VkSemaphore transferFinished = VK_NULL_HANDLE;
+        VkFence fence = VK_NULL_HANDLE;
+        std::vector<std::pair<VkBuffer, Allocation>> stagingBuffers;
+    };
+
+    VkDevice device = VK_NULL_HANDLE;
+    DeviceMemoryAllocator* allocator = nullptr;
+
+    uint32_t graphicsFamily = 0;
+    uint32_t transferFamily = 0;
+    VkQueue graphicsQueue = VK_NULL_HANDLE;
+    VkQueue transferQueue = VK_NULL_HANDLE;
+    VkCommandPool graphicsCommandPool = VK_NULL_HANDLE;
+    VkCommandPool transferCommandPool = VK_NULL_HANDLE;
+
+    std::optional<Batch> currentBatch;
+    std::deque<Batch> inFlight;
+    StagingRing stagingRing;
+    uint64_t lastSubmitted = 0;
+    uint64_t lastCompleted = 0;
+
+    VkCommandPool createCommandPool(uint32_t queueFamily) {
+        VkCommandPoolCreateInfo poolInfo{};
+        poolInfo.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
+        poolInfo.flags = VK_COMMAND_POOL_CREATE_TRANSIENT_BIT;
+        poolInfo.queueFamilyIndex = queueFamily;
+
+        VkCommandPool pool;
+        if (vkCreateCommandPool(device, &poolInfo, nullptr, &pool) != VK_SUCCESS) {
+            throw std::runtime_error("failed to create upload command pool!");
+        }
+
+        return pool;
+    }
+
+    VkCommandBuffer beginCommandBuffer(VkCommandPool pool) {
+        VkCommandBufferAllocateInfo allocInfo{};
+        allocInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+        allocInfo.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
+        allocInfo.commandPool = pool;
+        allocInfo.commandBufferCount = 1;
+
+        VkCommandBuffer commandBuffer;
+        if (vkAllocateCommandBuffers(device, &allocInfo, &commandBuffer) != VK_SUCCESS) {
+            throw std::runtime_error("failed to allocate upload command buffer!");
+        }
+
+        VkCommandBufferBeginInfo beginInfo{};
+        beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+        beginInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+
+        vkBeginCommandBuffer(commandBuffer, &beginInfo);
+
+        return commandBuffer;
+    }
+
+    Batch& openBatch() {
+        if (!currentBatch.has_value()) {
+            Batch batch;
+            batch.id = lastSubmitted + 1;
+            batch.graphicsCommandBuffer = beginCommandBuffer(graphicsCommandPool);
+            // Without a dedicated transfer queue the copies are simply recorded on the graphics side
+            batch.transferCommandBuffer = hasDedicatedTransferQueue() ? beginCommandBuffer(transferCommandPool) : batch.graphicsCommandBuffer;
+            currentBatch = std::move(batch);
+        }
+
+        return currentBatch.value();
+    }
+};
+
+// Descriptor writes for one set, collected so identical sets can be looked up before they are built
+class DescriptorWrites {
+public:
+    DescriptorWrites& buffer(uint32_t binding, VkDescriptorType type, VkBuffer buffer, VkDeviceSize offset, VkDeviceSize range) {
+        Entry entry{};
+        entry.binding = binding;
+        entry.type = type;
+        entry.bufferInfo = {buffer, offset, range};
+        entries.push_back(entry);
+        return *this;
+    }
+
+    DescriptorWrites& image(uint32_t binding, VkDescriptorType type, VkImageView imageView, VkSampler sampler, VkImageLayout imageLayout) {
+        Entry entry{};
+        entry.binding = binding;
+        entry.type = type;
+        entry.imageInfo = {sampler, imageView, imageLayout};
+        entries.push_back(entry);
+        return *this;
+    }
+
+    // Every handle, offset and type that ends up in the set, prefixed with the layout
+    std::vector<uint64_t> key(VkDescriptorSetLayout layout) const {
+        std::vector<uint64_t> words;
+        words.push_back(handleValue(layout));
+
+        for (const auto& entry : entries) {
+            words.push_back((static_cast<uint64_t>(entry.binding) << 32) | static_cast<uint64_t>(entry.type));
+            if (isImage(entry.type)) {
+                words.push_back(handleValue(entry.imageInfo.imageView));
+                words.push_back(handleValue(entry.imageInfo.sampler));
+                words.push_back(static_cast<uint64_t>(entry.imageInfo.imageLayout));
+            } else {
+                words.push_back(handleValue(entry.bufferInfo.buffer));
+                words.push_back(entry.bufferInfo.offset);
+                words.push_back(entry.bufferInfo.range);
+            }
+        }
+
+        return words;
+    }
+
+    void update(VkDevice device, VkDescriptorSet set) const {
+        std::vector<VkWriteDescriptorSet> writes(entries.size());
+
+        for (size_t i = 0; i < entries.size(); i++) {
+            writes[i].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+            writes[i].dstSet = set;
+            writes[i].dstBinding = entries[i].binding;
+            writes[i].dstArrayElement = 0;
+            writes[i].descriptorType = entries[i].type;
+            writes[i].descriptorCount = 1;
+            if (isImage(entries[i].type)) {
+                writes[i].pImageInfo = &entries[i].imageInfo;
+            } else {
+                writes[i].pBufferInfo = &entries[i].bufferInfo;
+            }
+        }
+
+        vkUpdateDescriptorSets(device, static_cast<uint32_t>(writes.size()), writes.data(), 0, nullptr);
+    }
+
+private:
+    struct Entry {
+        uint32_t binding;
+        VkDescriptorType type;
+        VkDescriptorBufferInfo bufferInfo;
+        VkDescriptorImageInfo imageInfo;
+    };
+
+    std::vector<Entry> entries;
+
+    static bool isImage(VkDescriptorType type) {
+        return type == VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER || type == VK_DESCRIPTOR_TYPE_SAMPLED_IMAGE || type == VK_DESCRIPTOR_TYPE_STORAGE_IMAGE || type == VK_DESCRIPTOR_TYPE_SAMPLER;
+    }
+
+    // Non-dispatchable handles are pointers on 64 bit platforms and uint64_t elsewhere
+    template<typename Handle>
+    static uint64_t handleValue(Handle handle) {
+        uint64_t value = 0;
+        memcpy(&value, &handle, sizeof(handle));
+        return value;
+    }
+};
+
+struct DescriptorAllocatorStats {
+    uint64_t allocations = 0;
+    uint64_t transientAllocations = 0;
+    uint64_t cacheHits = 0;
+    uint32_t poolsCreated = 0;
+    uint32_t poolGrowths = 0; // allocations that ran out of pool memory and moved on to a new pool
+    uint32_t frameResets = 0;
+};
+
+// Allocates descriptor sets from chains of pools, so adding sets never means resizing a pool by hand.
+// When a pool runs out of memory the next one is taken, each new pool twice the size of the last.
+// Persistent sets live until destroy(); transient sets come from per frame chains that are reset
+// wholesale with vkResetDescriptorPool once the frame's fence has signaled. Persistent sets built
+// through getOrCreate() are cached by layout and writes, so identical sets are only built once.
+class DescriptorAllocator {
+public:
+    static constexpr uint32_t INITIAL_SETS_PER_POOL = 16;
+    static constexpr uint32_t MAX_SETS_PER_POOL = 4096;
+
+    // The ratios give the number of descriptors of each type reserved per set
+    void init(VkDevice device, uint32_t framesInFlight, const std::vector<VkDescriptorPoolSize>& ratios) {
+        this->device = device;
+        this->ratios = ratios;
+        frameChains.resize(framesInFlight);
+    }
+
+    void destroy() {
+        destroyChain(persistentChain);
+        for (auto& chain : frameChains) {
+            destroyChain(chain);
+        }
+        cache.clear();
+    }
+
+    VkDescriptorSet allocate(VkDescriptorSetLayout layout) {
+        stats.allocations++;
+        return allocate(persistentChain, layout);
+    }
+
+    // Valid until resetFrame(frame) is called for the same frame
+    VkDescriptorSet allocateTransient(uint32_t frame, VkDescriptorSetLayout layout) {
+        stats.transientAllocations++;
+        return allocate(frameChains[frame], layout);
+    }
+
+    // Only call once the GPU has finished with every set allocated for this frame
+    void resetFrame(uint32_t frame) {
+        PoolChain& chain = frameChains[frame];
+        if (chain.usedPools.empty()) {
+            return;
+        }
+
+        for (VkDescriptorPool pool : chain.usedPools) {
+            vkResetDescriptorPool(device, pool, 0);
+            chain.freePools.push_back(pool);
+        }
+        chain.usedPools.clear();
+        stats.frameResets++;
+    }
+
+    VkDescriptorSet getOrCreate(VkDescriptorSetLayout layout, const DescriptorWrites& writes) {
+        std::vector<uint64_t> key = writes.key(layout);
+
+        auto it = cache.find(key);
+        if (it != cache.end()) {
+            stats.cacheHits++;
+            return it->second;
+        }
+
+        VkDescriptorSet set = allocate(layout);
+        writes.update(device, set);
+
+        cache.emplace(std::move(key), set);
+        return set;
+    }
+
+    const DescriptorAllocatorStats& getStats() const {
+        return stats;
+    }
+
+    void printStats() const {
+        std::cout << "descriptor allocator: " << stats.allocations << " persistent and " << stats.transientAllocations << " transient sets from "
+                  << stats.poolsCreated << " pools (" << stats.poolGrowths << " times out of pool memory), "
+                  << stats.cacheHits << " cache hits, " << stats.frameResets << " frame resets" << std::endl;
+    }
+
+private:
+    struct PoolChain {
+        std::vector<VkDescriptorPool> usedPools; // the last one is allocated from
+        std::vector<VkDescriptorPool> freePools;
+        uint32_t setsPerPool = INITIAL_SETS_PER_POOL;
+    };
+
+    struct KeyHash {
+        size_t operator()(const std::vector<uint64_t>& key) const {
+            return static_cast<size_t>(hashBytes(key.data(), key.size() * sizeof(uint64_t)));
+        }
+    };
+
+    VkDevice device = VK_NULL_HANDLE;
+    std::vector<VkDescriptorPoolSize> ratios;
+
+    PoolChain persistentChain;
+    std::vector<PoolChain> frameChains;
+    std::unordered_map<std::vector<uint64_t>, VkDescriptorSet, KeyHash> cache;
+
+    DescriptorAllocatorStats stats;
+
+    VkDescriptorSet allocate(PoolChain& chain, VkDescriptorSetLayout layout) {
+        if (chain.usedPools.empty()) {
+            chain.usedPools.push_back(acquirePool(chain));
+        }
+
+        VkDescriptorSetAllocateInfo allocInfo{};
+        allocInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
+        allocInfo.descriptorPool = chain.usedPools.back();
+        allocInfo.descriptorSetCount = 1;
+        allocInfo.pSetLayouts = &layout;
+
+        VkDescriptorSet set;
+        VkResult result = vkAllocateDescriptorSets(device, &allocInfo, &set);
+
+        if (result == VK_ERROR_OUT_OF_POOL_MEMORY || result == VK_ERROR_FRAGMENTED_POOL) {
+            stats.poolGrowths++;
+
+            chain.usedPools.push_back(acquirePool(chain));
+            allocInfo.descriptorPool = chain.usedPools.back();
+            result = vkAllocateDescriptorSets(device, &allocInfo, &set);
+        }
+
+        if (result != VK_SUCCESS) {
+            throw std::runtime_error("failed to allocate descriptor sets!");
+        }
+
+        return set;
+    }
+
+    VkDescriptorPool acquirePool(PoolChain& chain) {
+        if (!chain.freePools.empty()) {
+            VkDescriptorPool pool = chain.freePools.back();
+            chain.freePools.pop_back();
+            return pool;
+        }
+
+        std::vector<VkDescriptorPoolSize> poolSizes = ratios;
+        for (auto& poolSize : poolSizes) {
+            poolSize.descriptorCount *= chain.setsPerPool;
+        }
+
+        VkDescriptorPoolCreateInfo poolInfo{};
+        poolInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
+        poolInfo.poolSizeCount = static_cast<uint32_t>(poolSizes.size());
+        poolInfo.pPoolSizes = poolSizes.data();
+        poolInfo.maxSets = chain.setsPerPool;
+
+        VkDescriptorPool pool;
+        if (vkCreateDescriptorPool(device, &poolInfo, nullptr, &pool) != VK_SUCCESS) {
+            throw std::runtime_error("failed to create descriptor pool!");
+        }
+
+        stats.poolsCreated++;
+        chain.setsPerPool = std::min(chain.setsPerPool * 2, MAX_SETS_PER_POOL);
+        return pool;
+    }
+
+    void destroyChain(PoolChain& chain) {
+        for (VkDescriptorPool pool : chain.usedPools) {
+            vkDestroyDescriptorPool(device, pool, nullptr);
+        }
+        for (VkDescriptorPool pool : chain.freePools) {
+            vkDestroyDescriptorPool(device, pool, nullptr);
+        }
+        chain = PoolChain{};
+    }
+};
+
+// Fixed size window of the most recent samples
+class RollingStats {
+public:
+    static const size_t WINDOW_SIZE = 256;
+
+    void add(double sample) {
+        if (samples.size() < WINDOW_SIZE) {
+            samples.push_back(sample);
+        } else {
+            samples[next] = sample;
+        }
+        next = (next + 1) % WINDOW_SIZE;
+    }
+
+    bool empty() const {
+        return samples.empty();
+    }
+
+    double min() const {
+        return *std::min_element(samples.begin(), samples.end());
+    }
+
+    double avg() const {
+        double sum = 0.0;
+        for (double sample : samples) {
+            sum += sample;
+        }
+        return sum / samples.size();
+    }
+
+    double percentile(double p) const {
+        std::vector<double> sorted = samples;
+        size_t rank = static_cast<size_t>(std::ceil(p * sorted.size())) - 1;
+        std::nth_element(sorted.begin(), sorted.begin() + rank, sorted.end());
+        return sorted[rank];
+    }
+
+private:
+    std::vector<double> samples;
+    size_t next = 0;
+};
+
+const VkQueryPipelineStatisticFlags PROFILER_PIPELINE_STATISTICS =
+    VK_QUERY_PIPELINE_STATISTIC_INPUT_ASSEMBLY_VERTICES_BIT |
+    VK_QUERY_PIPELINE_STATISTIC_INPUT_ASSEMBLY_PRIMITIVES_BIT |
+    VK_QUERY_PIPELINE_STATISTIC_VERTEX_SHADER_INVOCATIONS_BIT |
+    VK_QUERY_PIPELINE_STATISTIC_CLIPPING_PRIMITIVES_BIT |
+    VK_QUERY_PIPELINE_STATISTIC_FRAGMENT_SHADER_INVOCATIONS_BIT |
+    VK_QUERY_PIPELINE_STATISTIC_COMPUTE_SHADER_INVOCATIONS_BIT;
+
+const size_t PROFILER_STATISTIC_COUNT = 6;
+
+// In the order the results are written, which follows the bit order above
+const std::array<const char*, PROFILER_STATISTIC_COUNT> PROFILER_STATISTIC_NAMES = {
+    "vertices", "primitives", "vertex invocations", "clipped primitives", "fragment invocations", "compute invocations"
+};
+
+// Measures the GPU time and pipeline statistics of named scopes in command buffers.
+// Each frame in flight has its own query pools. The results of a scope are read back
+// right before the scope is recorded again for the same frame, at which point the
+// frame's fence has been waited on, so vkGetQueryPoolResults never has to block.
+class GpuProfiler {
+public:
+    void init(VkPhysicalDevice physicalDevice, VkDevice device, uint32_t queueFamily, uint32_t framesInFlight, const std::vector<std::string>& scopeNames) {
+        this->device = device;
+
+        VkPhysicalDeviceProperties properties;
+        vkGetPhysicalDeviceProperties(physicalDevice, &properties);
+        timestampPeriod = properties.limits.timestampPeriod;
+
+        uint32_t queueFamilyCount = 0;
+        vkGetPhysicalDeviceQueueFamilyProperties(physicalDevice, &queueFamilyCount, nullptr);
+        std::vector<VkQueueFamilyProperties> queueFamilies(queueFamilyCount);
+        vkGetPhysicalDeviceQueueFamilyProperties(physicalDevice, &queueFamilyCount, queueFamilies.data());
+
+        uint32_t validBits = queueFamilies[queueFamily].timestampValidBits;
+        timestampsSupported = validBits > 0;
+        timestampMask = validBits >= 64 ? ~0ull : (1ull << validBits) - 1;
+
+        VkPhysicalDeviceFeatures supportedFeatures;
+        vkGetPhysicalDeviceFeatures(physicalDevice, &supportedFeatures);
+        statisticsSupported = supportedFeatures.pipelineStatisticsQuery;
+        // The device enables inheritedQueries whenever it is supported
+        inheritedStatisticsSupported = statisticsSupported && supportedFeatures.inheritedQueries;
+
+        if (!timestampsSupported) {
+            std::cerr << "gpu profiler: timestamps are not supported on this queue family" << std::endl;
+        }
+
+        for (const auto& name : scopeNames) {
+            scopes.push_back(Scope{name});
+        }
+
+        uint32_t scopeCount = static_cast<uint32_t>(scopes.size());
+
+        frames.resize(framesInFlight);
+        for (auto& frame : frames) {
+            frame.pending.resize(scopeCount, false);
+            frame.statisticsActive.resize(scopeCount, false);
+
+            VkQueryPoolCreateInfo poolInfo{};
+            poolInfo.sType = VK_STRUCTURE_TYPE_QUERY_POOL_CREATE_INFO;
+
+            if (timestampsSupported) {
+                poolInfo.queryType = VK_QUERY_TYPE_TIMESTAMP;
+                poolInfo.queryCount = scopeCount * 2;
+
+                if (vkCreateQueryPool(device, &poolInfo, nullptr, &frame.timestampPool) != VK_SUCCESS) {
+                    throw std::runtime_error("failed to create timestamp query pool!");
+                }
+            }
+
+            if (statisticsSupported) {
+                poolInfo.queryType = VK_QUERY_TYPE_PIPELINE_STATISTICS;
+                poolInfo.queryCount = scopeCount;
+                poolInfo.pipelineStatistics = PROFILER_PIPELINE_STATISTICS;
+
+                if (vkCreateQueryPool(device, &poolInfo, nullptr, &frame.statisticsPool) != VK_SUCCESS) {
+                    throw std::runtime_error("failed to create pipeline statistics query pool!");
+                }
+            }
+        }
+
+        lastReportTime = std::chrono::steady_clock::now();
+    }
+
+    void destroy() {
+        for (auto& frame : frames) {
+            if (frame.timestampPool != VK_NULL_HANDLE) {
+                vkDestroyQueryPool(device, frame.timestampPool, nullptr);
+            }
+            if (frame.statisticsPool != VK_NULL_HANDLE) {
+                vkDestroyQueryPool(device, frame.statisticsPool, nullptr);
+            }
+        }
+        frames.clear();
+    }
+
+    // Must be recorded outside of a render pass. Scopes that execute secondary command buffers only
+    // collect pipeline statistics if the device supports inherited queries
+    void beginScope(VkCommandBuffer commandBuffer, uint32_t frameIndex, uint32_t scope, bool executesSecondaries = false) {
+        FrameQueries& frame = frames[frameIndex];
+
+        if (frame.pending[scope]) {
+            collect(frame, scope);
+        }
+
+        frame.statisticsActive[scope] = statisticsSupported && (!executesSecondaries || inheritedStatisticsSupported);
+
+        if (timestampsSupported) {
+            vkCmdResetQueryPool(commandBuffer, frame.timestampPool, scope * 2, 2);
+            vkCmdWriteTimestamp(commandBuffer, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, frame.timestampPool, scope * 2);
+        }
+
+        if (frame.statisticsActive[scope]) {
+            vkCmdResetQueryPool(commandBuffer, frame.statisticsPool, scope, 1);
+            vkCmdBeginQuery(commandBuffer, frame.statisticsPool, scope, 0);
+        }
+    }
+
+    void endScope(VkCommandBuffer commandBuffer, uint32_t frameIndex, uint32_t scope) {
+        FrameQueries& frame = frames[frameIndex];
+
+        if (frame.statisticsActive[scope]) {
+            vkCmdEndQuery(commandBuffer, frame.statisticsPool, scope);
+        }
+
+        if (timestampsSupported) {
+            vkCmdWriteTimestamp(commandBuffer, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, frame.timestampPool, scope * 2 + 1);
+        }
+
+        frame.pending[scope] = true;
+    }
+
+    // Secondary command buffers executed while a scope is active must be recorded with these statistics
+    VkQueryPipelineStatisticFlags getInheritedPipelineStatistics() const {
+        return inheritedStatisticsSupported ? PROFILER_PIPELINE_STATISTICS : 0;
+    }
+
+    const RollingStats& getGpuTime(uint32_t scope) const {
+        return scopes[scope].gpuTime;
+    }
+
+    void printReport(double intervalSeconds) {
+        auto now = std::chrono::steady_clock::now();
+        if (std::chrono::duration<double>(now - lastReportTime).count() < intervalSeconds) {
+            return;
+        }
+        lastReportTime = now;
+
+        for (const auto& scope : scopes) {
+            if (scope.gpuTime.empty() && !scope.hasStatistics) {
+                continue;
+            }
+
+            std::cout << "gpu " << scope.name << ":";
+            if (!scope.gpuTime.empty()) {
+                std::cout << " " << scope.gpuTime.min() << " ms min, " << scope.gpuTime.avg() << " ms avg, "
+                          << scope.gpuTime.percentile(0.99) << " ms p99";
+            }
+            for (size_t i = 0; i < PROFILER_STATISTIC_COUNT; i++) {
+                if (scope.statistics[i] != 0) {
+                    std::cout << ", " << scope.statistics[i] << " " << PROFILER_STATISTIC_NAMES[i];
+                }
+            }
+            std::cout << std::endl;
+        }
+    }
+
+private:
+    struct Scope {
+        std::string name;
+        RollingStats gpuTime;
+        std::array<uint64_t, PROFILER_STATISTIC_COUNT> statistics{};
+        bool hasStatistics = false;
+    };
+
+    struct FrameQueries {
+        VkQueryPool timestampPool = VK_NULL_HANDLE;
+        VkQueryPool statisticsPool = VK_NULL_HANDLE;
+        std::vector<bool> pending;
+        std::vector<bool> statisticsActive;
+    };
+
+    VkDevice device = VK_NULL_HANDLE;
+    bool timestampsSupported = false;
+    bool statisticsSupported = false;
+    bool inheritedStatisticsSupported = false;
+    float timestampPeriod = 1.0f;
+    uint64_t timestampMask = ~0ull;
+
+    std::vector<Scope> scopes;
+    std::vector<FrameQueries> frames;
+    std::chrono::steady_clock::time_point lastReportTime;
+
+    void collect(FrameQueries& frame, uint32_t scope) {
+        frame.pending[scope] = false;
+
+        // Each result is followed by its availability value. Without VK_QUERY_RESULT_WAIT_BIT
+        // unavailable results are skipped instead of stalling
+        if (timestampsSupported) {
+            std::array<uint64_t, 4> timestamps{};
+            vkGetQueryPoolResults(device, frame.timestampPool, scope * 2, 2, sizeof(timestamps), timestamps.data(), sizeof(uint64_t) * 2,
+                VK_QUERY_RESULT_64_BIT | VK_QUERY_RESULT_WITH_AVAILABILITY_BIT);
+
+            if (timestamps[1] != 0 && timestamps[3] != 0) {
+                uint64_t ticks = (timestamps[2] - timestamps[0]) & timestampMask;
+                scopes[scope].gpuTime.add(ticks * timestampPeriod / 1000000.0);
+            }
+        }
+
+        if (frame.statisticsActive[scope]) {
+            std::array<uint64_t, PROFILER_STATISTIC_COUNT + 1> statistics{};
+            vkGetQueryPoolResults(device, frame.statisticsPool, scope, 1, sizeof(statistics), statistics.data(), sizeof(statistics),
+                VK_QUERY_RESULT_64_BIT | VK_QUERY_RESULT_WITH_AVAILABILITY_BIT);
+
+            if (statistics.back() != 0) {
+                std::copy(statistics.begin(), statistics.end() - 1, scopes[scope].statistics.begin());
+                scopes[scope].hasStatistics = true;
+            }
+        }
+    }
+};
+
+// Fixed set of worker threads that all run the same job, each with its own thread
+// index, while the calling thread waits for them to finish
+class WorkerPool {
+public:
+    WorkerPool() = default;
+    WorkerPool(const WorkerPool&) = delete;
+    WorkerPool& operator=(const WorkerPool&) = delete;
+
+    ~WorkerPool() {
+        stop();
+    }
+
+    void start(uint32_t threadCount) {
+        for (uint32_t i = 0; i < threadCount; i++) {
+            threads.emplace_back(&WorkerPool::workerLoop, this, i);
+        }
+    }
+
+    void stop() {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            stopping = true;
+        }
+        workAvailable.notify_all();
+
+        for (auto& thread : threads) {
+            thread.join();
+        }
+        threads.clear();
+    }
+
+    uint32_t size() const {
+        return static_cast<uint32_t>(threads.size());
+    }
+
+    // Runs job(threadIndex) on every worker and blocks until all of them have returned.
+    // The first exception thrown by a worker is rethrown on the calling thread.
+    void run(const std::function<void(uint32_t)>& job) {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            currentJob = &job;
+            pendingWorkers = size();
+            generation++;
+        }
+        workAvailable.notify_all();
+
+        std::unique_lock<std::mutex> lock(mutex);
+        workDone.wait(lock, [this] { return pendingWorkers == 0; });
+        currentJob = nullptr;
+
+        if (error) {
+            std::exception_ptr workerError = error;
+            error = nullptr;
+            std::rethrow_exception(workerError);
+        }
+    }
+
+private:
+    std::vector<std::thread> threads;
+    std::mutex mutex;
+    std::condition_variable workAvailable;
+    std::condition_variable workDone;
+
+    const std::function<void(uint32_t)>* currentJob = nullptr;
+    uint64_t generation = 0;
+    uint32_t pendingWorkers = 0;
+    bool stopping = false;
+    std::exception_ptr error;
+
+    void workerLoop(uint32_t threadIndex) {
+        uint64_t completedGeneration = 0;
+
+        while (true) {
+            const std::function<void(uint32_t)>* job;
+            {
+                std::unique_lock<std::mutex> lock(mutex);
+                workAvailable.wait(lock, [&] { return stopping || generation != completedGeneration; });
+                if (stopping) {
+                    return;
+                }
+                completedGeneration = generation;
+                job = currentJob;
+            }
+
+            std::exception_ptr jobError;
+            try {
+                (*job)(threadIndex);
+            } catch (...) {
+                jobError = std::current_exception();
+            }
+
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                if (jobError && !error) {
+                    error = jobError;
+                }
+                if (--pendingWorkers == 0) {
+                    workDone.notify_one();
+                }
+            }
+        }
+    }
+};
+
+// Contents of one line aligned chunk of an OBJ file. Faces are fan triangulated like tinyobj does.
+// Indices are 0 based. Those written relative to the end of the attribute list (negative in the
+// file) can only be resolved against this chunk's attributes until the chunks are merged, which
+// is marked with these flags in the otherwise unused normal index.
+const int OBJ_RELATIVE_POSITION = 1;
+const int OBJ_RELATIVE_TEXCOORD = 2;
+
+struct ObjChunk {
+    const char* begin;
+    const char* end;
+
+    std::vector<float> positions;
+    std::vector<float> texcoords;
+    std::vector<tinyobj::index_t> faceIndices;
+
+    size_t positionBase = 0;
+    size_t texcoordBase = 0;
+    size_t indexBase = 0;
+
+    std::vector<uint64_t> uniqueKeys;      // VertexIndexTable keys in order of first use in this chunk
+    std::vector<uint32_t> localIndices;    // faceIndices as indices into uniqueKeys
+    std::vector<uint32_t> globalVertices;  // uniqueKeys as indices into the merged vertex array
+};
+
+bool isObjSpace(char c) {
+    return c == ' ' || c == '\t';
+}
+
+const char* skipObjSpaces(const char* p, const char* end) {
+    while (p < end && isObjSpace(*p)) {
+        p++;
+    }
+    return p;
+}
+
+// Parsed as double and then rounded, like tinyobj does
+bool parseObjFloat(const char*& p, const char* end, float& value) {
+    p = skipObjSpaces(p, end);
+    if (p < end && *p == '+') {
+        p++;
+    }
+
+    double parsed;
+#ifdef __cpp_lib_to_chars
+    auto result = std::from_chars(p, end, parsed);
+    if (result.ec != std::errc()) {
+        return false;
+    }
+
+    p = result.ptr;
+#else
+    // Older libc++ versions have no floating point from_chars. The stream is imbued with the
+    // classic locale, so a user locale with a decimal comma can't change how numbers are read.
+    const char* tokenEnd = p;
+    while (tokenEnd < end && !isObjSpace(*tokenEnd)) {
+        tokenEnd++;
+    }
+
+    std::istringstream stream(std::string(p, tokenEnd));
+    stream.imbue(std::locale::classic());
+    stream >> parsed;
+    if (stream.fail()) {
+        return false;
+    }
+
+    p = stream.eof() ? tokenEnd : p + static_cast<std::ptrdiff_t>(stream.tellg());
+#endif
+    value = static_cast<float>(parsed);
+    return true;
+}
+
+// Parses one "v", "v/vt", "v//vn" or "v/vt/vn" face vertex
+bool parseObjFaceVertex(const char*& p, const char* end, int& position, int& texcoord) {
+    auto result = std::from_chars(p, end, position);
+    if (result.ec != std::errc() || position == 0) {
+        return false;
+    }
+    p = result.ptr;
+
+    texcoord = 0;
+    if (p < end && *p == '/') {
+        p++;
+        if (p < end && *p != '/') {
+            result = std::from_chars(p, end, texcoord);
+            if (result.ec != std::errc()) {
+                return false;
+            }
+            p = result.ptr;
+        }
+
+        // The normal isn't used
+        if (p < end && *p == '/') {
+            p++;
+            int normal;
+            result = std::from_chars(p, end, normal);
+            if (result.ec != std::errc()) {
+                return false;
+            }
+            p = result.ptr;
+        }
+    }
+
+    return p == end || isObjSpace(*p);
+}
+
+void parseObjChunk(ObjChunk& chunk) {
+    std::vector<tinyobj::index_t> polygon;
+
+    for (const char* line = chunk.begin; line < chunk.end; ) {
+        const char* lineEnd = static_cast<const char*>(memchr(line, '\n', chunk.end - line));
+        if (lineEnd == nullptr) {
+            lineEnd = chunk.end;
+        }
+        const char* next = lineEnd + (lineEnd < chunk.end ? 1 : 0);
+        if (lineEnd > line && lineEnd[-1] == '\r') {
+            lineEnd--;
+        }
+
+        const char* p = skipObjSpaces(line, lineEnd);
+        size_t length = lineEnd - p;
+
+        if (length >= 2 && p[0] == 'v' && isObjSpace(p[1])) {
+            p += 2;
+            float x, y, z;
+            if (!parseObjFloat(p, lineEnd, x) || !parseObjFloat(p, lineEnd, y) || !parseObjFloat(p, lineEnd, z)) {
+                throw std::runtime_error("failed to parse OBJ vertex position!");
+            }
+            chunk.positions.insert(chunk.positions.end(), {x, y, z});
+        } else if (length >= 3 && p[0] == 'v' && p[1] == 't' && isObjSpace(p[2])) {
+            p += 3;
+            float u, v = 0.0f;
+            if (!parseObjFloat(p, lineEnd, u)) {
+                throw std::runtime_error("failed to parse OBJ texture coordinate!");
+            }
+            parseObjFloat(p, lineEnd, v);
+            chunk.texcoords.insert(chunk.texcoords.end(), {u, v});
+        } else if (length >= 2 && p[0] == 'f' && isObjSpace(p[1])) {
+            p += 2;
+            polygon.clear();
+
+            for (p = skipObjSpaces(p, lineEnd); p < lineEnd; p = skipObjSpaces(p, lineEnd)) {
+                int position, texcoord;
+                if (!parseObjFaceVertex(p, lineEnd, position, texcoord)) {
+                    throw std::runtime_error("failed to parse OBJ face!");
+                }
+
+                tinyobj::index_t index{};
+                index.normal_index = 0;
+
+                if (position > 0) {
+                    index.vertex_index = position - 1;
+                } else {
+                    index.vertex_index = static_cast<int>(chunk.positions.size() / 3) + position;
+                    index.normal_index |= OBJ_RELATIVE_POSITION;
+                }
+
+                if (texcoord > 0) {
+                    index.texcoord_index = texcoord - 1;
+                } else if (texcoord < 0) {
+                    index.texcoord_index = static_cast<int>(chunk.texcoords.size() / 2) + texcoord;
+                    index.normal_index |= OBJ_RELATIVE_TEXCOORD;
+                } else {
+                    index.texcoord_index = -1;
+                }
+
+                polygon.push_back(index);
+            }
+
+            if (polygon.size() < 3) {
+                throw std::runtime_error("failed to parse OBJ face!");
+            }
+
+            for (size_t i = 1; i + 1 < polygon.size(); i++) {
+                chunk.faceIndices.insert(chunk.faceIndices.end(), {polygon[0], polygon[i], polygon[i + 1]});
+            }
+        }
+
+        line = next;
+    }
+}
+
+// Loads the same vertices and indices as tinyobj::LoadObj followed by buildObjVertices, with the
+// parsing and deduplication spread across threadCount threads. Each thread parses and deduplicates
+// one line aligned chunk of the file. The chunks are then merged in file order, so the result
+// doesn't depend on the thread count. Only positions, texture coordinates and faces are read.
+void loadObjParallel(const std::string& path, uint32_t threadCount, std::vector<Vertex>& vertices, std::vector<uint32_t>& indices) {
+    MappedFile file;
+    if (!file.open(path)) {
+        throw std::runtime_error("failed to open model file!");
+    }
+
+    threadCount = std::max(1u, threadCount);
+
+    std::vector<ObjChunk> chunks(threadCount);
+    const char* fileEnd = file.data() + file.size();
+    const char* chunkBegin = file.data();
+    for (uint32_t i = 0; i < threadCount; i++) {
+        const char* chunkEnd = i + 1 == threadCount ? fileEnd : std::max(chunkBegin, file.data() + file.size() * (i + 1) / threadCount);
+        if (chunkEnd < fileEnd) {
+            const char* newline = static_cast<const char*>(memchr(chunkEnd, '\n', fileEnd - chunkEnd));
+            chunkEnd = newline != nullptr ? newline + 1 : fileEnd;
+        }
+
+        chunks[i].begin = chunkBegin;
+        chunks[i].end = chunkEnd;
+        chunkBegin = chunkEnd;
+    }
+
+    WorkerPool workers;
+    workers.start(threadCount);
+
+    workers.run([&](uint32_t threadIndex) {
+        parseObjChunk(chunks[threadIndex]);
+    });
+
+    size_t positionCount = 0;
+    size_t texcoordCount = 0;
+    size_t indexCount = 0;
+    for (auto& chunk : chunks) {
+        chunk.positionBase = positionCount;
+        chunk.texcoordBase = texcoordCount;
+        chunk.indexBase = indexCount;
+        positionCount += chunk.positions.size() / 3;
+        texcoordCount += chunk.texcoords.size() / 2;
+        indexCount += chunk.faceIndices.size();
+    }
+
+    std::vector<float> positions(positionCount * 3);
+    std::vector<float> objTexcoords(texcoordCount * 2);
+
+    workers.run([&](uint32_t threadIndex) {
+        const ObjChunk& chunk = chunks[threadIndex];
+
+        std::copy(chunk.positions.begin(), chunk.positions.end(), positions.begin() + chunk.positionBase * 3);
+        std::copy(chunk.texcoords.begin(), chunk.texcoords.end(), objTexcoords.begin() + chunk.texcoordBase * 2);
+    });
+
+    // Duplicate attribute values can be anywhere in the file, so these are found over all of them at once
+    std::vector<float> texcoords = flipObjTexcoords(objTexcoords);
+    std::vector<uint32_t> canonicalPositions = canonicalAttributeIndices(positions, 3);
+    std::vector<uint32_t> canonicalTexcoords = canonicalAttributeIndices(texcoords, 2);
+    uint32_t missingTexcoord = canonicalTexcoords.back();
+
+    // Deduplicate every chunk on its own
+    workers.run([&](uint32_t threadIndex) {
+        ObjChunk& chunk = chunks[threadIndex];
+
+        VertexIndexTable uniqueVertices(chunk.faceIndices.size());
+        chunk.localIndices.reserve(chunk.faceIndices.size());
+
+        for (tinyobj::index_t index : chunk.faceIndices) {
+            if (index.normal_index & OBJ_RELATIVE_POSITION) {
+                index.vertex_index += static_cast<int>(chunk.positionBase);
+            }
+            if (index.normal_index & OBJ_RELATIVE_TEXCOORD) {
+                index.texcoord_index += static_cast<int>(chunk.texcoordBase);
+            }
+
+            if (index.vertex_index < 0 || static_cast<size_t>(index.vertex_index) >= positionCount
+                || index.texcoord_index < -1 || index.texcoord_index >= static_cast<int64_t>(texcoordCount)) {
+                throw std::runtime_error("OBJ face references a missing vertex attribute!");
+            }
+
+            uint32_t position = canonicalPositions[index.vertex_index];
+            uint32_t texcoord = index.texcoord_index >= 0 ? canonicalTexcoords[index.texcoord_index] : missingTexcoord;
+
+            uint64_t key = VertexIndexTable::makeKey(position, texcoord);
+            uint32_t newVertex = static_cast<uint32_t>(chunk.uniqueKeys.size());
+            uint32_t vertexIndex = uniqueVertices.findOrInsert(key, newVertex);
+            if (vertexIndex == newVertex) {
+                chunk.uniqueKeys.push_back(key);
+            }
+            chunk.localIndices.push_back(vertexIndex);
+        }
+    });
+
+    // Every vertex first appears in the chunk that first uses it, and the chunks are visited in
+    // file order, so this assigns the same numbers as a single pass over the whole file
+    size_t uniqueKeyCount = 0;
+    for (const auto& chunk : chunks) {
+        uniqueKeyCount += chunk.uniqueKeys.size();
     }
 
-    static std::array<VkVertexInputAttributeDescription, 3> getAttributeDescriptions() {
-        std::array<VkVertexInputAttributeDescription, 3> attributeDescriptions{};
+    VertexIndexTable globalVertices(uniqueKeyCount);
+    std::vector<uint64_t> vertexKeys;
+    vertexKeys.reserve(uniqueKeyCount);
+
+    for (auto& chunk : chunks) {
+        chunk.globalVertices.resize(chunk.uniqueKeys.size());
+        for (size_t i = 0; i < chunk.uniqueKeys.size(); i++) {
+            uint32_t newVertex = static_cast<uint32_t>(vertexKeys.size());
+            chunk.globalVertices[i] = globalVertices.findOrInsert(chunk.uniqueKeys[i], newVertex);
+            if (chunk.globalVertices[i] == newVertex) {
+                vertexKeys.push_back(chunk.uniqueKeys[i]);
+            }
+        }
+    }
 
-        attributeDescriptions[0].binding = 0;
-        attributeDescriptions[0].location = 0;
-        attributeDescriptions[0].format = VK_FORMAT_R32G32B32_SFLOAT;
-        attributeDescriptions[0].offset = offsetof(Vertex, pos);
+    size_t vertexBase = vertices.size();
+    size_t indexBase = indices.size();
+    vertices.resize(vertexBase + vertexKeys.size());
+    indices.resize(indexBase + indexCount);
 
-        attributeDescriptions[1].binding = 0;
-        attributeDescriptions[1].location = 1;
-        attributeDescriptions[1].format = VK_FORMAT_R32G32B32_SFLOAT;
-        attributeDescriptions[1].offset = offsetof(Vertex, color);
+    workers.run([&](uint32_t threadIndex) {
+        const ObjChunk& chunk = chunks[threadIndex];
 
-        attributeDescriptions[2].binding = 0;
-        attributeDescriptions[2].location = 2;
-        attributeDescriptions[2].format = VK_FORMAT_R32G32_SFLOAT;
-        attributeDescriptions[2].offset = offsetof(Vertex, texCoord);
+        for (size_t i = 0; i < chunk.localIndices.size(); i++) {
+            indices[indexBase + chunk.indexBase + i] = static_cast<uint32_t>(vertexBase) + chunk.globalVertices[chunk.localIndices[i]];
+        }
 
-        return attributeDescriptions;
-    }
+        size_t firstVertex = vertexKeys.size() * threadIndex / threadCount;
+        size_t lastVertex = vertexKeys.size() * (threadIndex + 1) / threadCount;
 
-    bool operator==(const Vertex& other) const {
-        return pos == other.pos && color == other.color && texCoord == other.texCoord;
-    }
-};
+        for (size_t i = firstVertex; i < lastVertex; i++) {
+            uint32_t positionIndex = static_cast<uint32_t>(vertexKeys[i] >> 32);
+            uint32_t texcoordIndex = static_cast<uint32_t>(vertexKeys[i]);
 
-namespace std {
-    template<> struct hash<Vertex> {
-        size_t operator()(Vertex const& vertex) const {
-            return ((hash<glm::vec3>()(vertex.pos) ^ (hash<glm::vec3>()(vertex.color) << 1)) >> 1) ^ (hash<glm::vec2>()(vertex.texCoord) << 1);
+            Vertex& vertex = vertices[vertexBase + i];
+            vertex = Vertex{};
+
+            vertex.pos = {
+                positions[3 * positionIndex + 0],
+                positions[3 * positionIndex + 1],
+                positions[3 * positionIndex + 2]
+            };
+
+            vertex.texCoord = {
+                texcoords[2 * texcoordIndex + 0],
+                texcoords[2 * texcoordIndex + 1]
+            };
+
+            vertex.color = {1.0f, 1.0f, 1.0f};
         }
-    };
+    });
 }
 
-struct UniformBufferObject {
-    alignas(16) glm::mat4 model;
-    alignas(16) glm::mat4 view;
-    alignas(16) glm::mat4 proj;
+struct InstancePushConstants {
+    glm::mat4 model;
+    uint32_t materialIndex; // index into the texture table, passed on to the fragment shader
+};
+
+// One entry of the instance buffer, the gpu driven draw reads the material of each instance from here
+struct InstanceData {
+    glm::mat4 transform;
+    alignas(16) uint32_t materialIndex;
+};
+
+const uint32_t CULL_WORKGROUP_SIZE = 64;
+
+struct CullPushConstants {
+    glm::vec4 boundingSphere; // mesh space center and radius
+    uint32_t instanceCount;
+    uint32_t submeshCount;
+};
+
+// The indirect draw buffer holds the draw count followed by one VkDrawIndexedIndirectCommand per
+// submesh, all filled in by the culling shader every frame. The count is 0 when no instance is
+// visible, so vkCmdDrawIndexedIndirectCount skips the draws entirely
+const VkDeviceSize INDIRECT_DRAW_COUNT_OFFSET = 0;
+const VkDeviceSize INDIRECT_DRAW_COMMANDS_OFFSET = sizeof(uint32_t);
+
+enum ProfilerScope : uint32_t {
+    PROFILER_SCOPE_RENDER_PASS,
+    PROFILER_SCOPE_CULLING
 };
 
 class HelloTriangleApplication {
 public:
-    void run() {
+    void run(const AppOptions& options) {
+        this->options = options;
+
         initWindow();
         initVulkan();
         mainLoop();
@@ -146,71 +2712,139 @@ public:
     }
 
 private:
-    GLFWwindow* window;
+    AppOptions options;
+
+    GLFWwindow* window = nullptr;
 
     VkInstance instance;
     VkDebugUtilsMessengerEXT debugMessenger;
-    VkSurfaceKHR surface;
+    VkSurfaceKHR surface = VK_NULL_HANDLE;
 
     VkPhysicalDevice physicalDevice = VK_NULL_HANDLE;
     VkSampleCountFlagBits msaaSamples = VK_SAMPLE_COUNT_1_BIT;
     VkDevice device;
 
+    DeviceMemoryAllocator allocator;
+    UploadEngine uploadEngine;
+    VkBuffer stagingRingBuffer;
+    Allocation stagingRingAllocation;
+
     VkQueue graphicsQueue;
     VkQueue presentQueue;
+    VkQueue transferQueue = VK_NULL_HANDLE;
 
     VkSwapchainKHR swapChain;
     std::vector<VkImage> swapChainImages;
+    std::vector<Allocation> offscreenImagesAllocation;
     VkFormat swapChainImageFormat;
+    VkFormat colorAttachmentFormat; // known before the swap chain exists
     VkExtent2D swapChainExtent;
     std::vector<VkImageView> swapChainImageViews;
     std::vector<VkFramebuffer> swapChainFramebuffers;
 
-    VkRenderPass renderPass;
+    VkPipelineCache pipelineCache;
+    bool pipelineCacheWarm = false;
+
+    VkRenderPass renderPass = VK_NULL_HANDLE;
     VkDescriptorSetLayout descriptorSetLayout;
     VkPipelineLayout pipelineLayout;
     VkPipeline graphicsPipeline;
 
+    VkPipelineLayout cullPipelineLayout = VK_NULL_HANDLE;
+    VkPipeline cullPipeline = VK_NULL_HANDLE;
+    PFN_vkCmdDrawIndexedIndirectCountKHR cmdDrawIndexedIndirectCount = nullptr;
+
+    PFN_vkCmdBeginRenderingKHR cmdBeginRendering = nullptr;
+    PFN_vkCmdEndRenderingKHR cmdEndRendering = nullptr;
+    PFN_vkCmdPipelineBarrier2KHR cmdPipelineBarrier2 = nullptr;
+
     VkCommandPool commandPool;
 
     VkImage colorImage;
-    VkDeviceMemory colorImageMemory;
+    Allocation colorImageAllocation;
     VkImageView colorImageView;
 
     VkImage depthImage;
-    VkDeviceMemory depthImageMemory;
+    Allocation depthImageAllocation;
     VkImageView depthImageView;
 
     uint32_t mipLevels;
+    VkFormat textureFormat;
     VkImage textureImage;
-    VkDeviceMemory textureImageMemory;
+    Allocation textureImageAllocation;
     VkImageView textureImageView;
     VkSampler textureSampler;
 
     std::vector<Vertex> vertices;
     std::vector<uint32_t> indices;
+    MappedFile meshCacheFile;
+    const Vertex* vertexData = nullptr;
+    uint32_t vertexCount = 0;
+    const uint32_t* indexData = nullptr;
+    uint32_t indexCount = 0;
+    VkIndexType indexType = VK_INDEX_TYPE_UINT32;
+    std::vector<Submesh> submeshes;
+    std::array<VertexCacheStats, 2> meshStats{}; // before and after optimizeMesh
+    glm::vec3 meshBoundsMin;
+    glm::vec3 meshBoundsMax;
     VkBuffer vertexBuffer;
-    VkDeviceMemory vertexBufferMemory;
+    Allocation vertexBufferAllocation;
     VkBuffer indexBuffer;
-    VkDeviceMemory indexBufferMemory;
+    Allocation indexBufferAllocation;
 
-    std::vector<VkBuffer> uniformBuffers;
-    std::vector<VkDeviceMemory> uniformBuffersMemory;
-    std::vector<void*> uniformBuffersMapped;
+    // One slice per frame in flight, selected with a dynamic offset when binding the descriptor set
+    VkBuffer uniformBuffer;
+    Allocation uniformBufferAllocation;
+    VkDeviceSize uniformBufferStride = 0;
 
-    VkDescriptorPool descriptorPool;
+    // Set 0 is rebuilt every frame from that frame's transient pool chain
+    DescriptorAllocator descriptorAllocator;
     std::vector<VkDescriptorSet> descriptorSets;
 
+    // Set 1 holds every sampled texture and draws pick theirs with the material index in the push
+    // constants. Without --bindless the table has room for exactly one texture.
+    VkDescriptorSetLayout textureTableLayout;
+    VkDescriptorPool textureTablePool = VK_NULL_HANDLE;
+    VkDescriptorSet textureTableSet;
+    uint32_t textureTableCapacity = 1;
+    uint32_t textureTableSize = 0;
+    uint32_t materialIndex = 0;
+
     std::vector<VkCommandBuffer> commandBuffers;
 
+    std::vector<glm::mat4> instanceTransforms;
+    std::vector<uint32_t> instanceMaterials;
+    float sceneScale = 1.0f;
+
+    // Instance data read by the culling shader and the vertex shader in gpu driven mode
+    glm::vec4 meshBoundingSphere;
+    VkBuffer instanceBuffer;
+    Allocation instanceBufferAllocation;
+    std::vector<VkBuffer> visibleInstanceBuffers;
+    std::vector<Allocation> visibleInstanceBuffersAllocation;
+    std::vector<VkBuffer> indirectDrawBuffers;
+    std::vector<Allocation> indirectDrawBuffersAllocation;
+
+    WorkerPool recordingWorkers;
+    std::vector<std::array<VkCommandPool, MAX_FRAMES_IN_FLIGHT>> threadCommandPools;
+    std::vector<std::array<VkCommandBuffer, MAX_FRAMES_IN_FLIGHT>> threadCommandBuffers;
+    RollingStats recordingTimes;
+    std::chrono::steady_clock::time_point lastRecordingReport;
+
     std::vector<VkSemaphore> imageAvailableSemaphores;
     std::vector<VkSemaphore> renderFinishedSemaphores;
     std::vector<VkFence> inFlightFences;
     uint32_t currentFrame = 0;
 
+    GpuProfiler gpuProfiler;
+
     bool framebufferResized = false;
 
     void initWindow() {
+        if (options.headless) {
+            return;
+        }
+
         glfwInit();
 
         glfwWindowHint(GLFW_CLIENT_API, GLFW_NO_API);
@@ -231,15 +2865,35 @@ private:
         createSurface();
         pickPhysicalDevice();
         createLogicalDevice();
+        createPipelineCache();
+        createMemoryAllocator();
+        createUploadEngine();
+        createDescriptorSetLayout();
+        createTextureTableLayout();
+
+        // Without a render pass the pipelines only depend on the attachment formats, so they are
+        // compiled on another thread while the swap chain is created and the assets are loaded
+        std::future<void> pipelinesCreated;
+        if (options.dynamicRendering) {
+            pipelinesCreated = std::async(std::launch::async, [this] {
+                createGraphicsPipeline();
+                createCullPipeline();
+            });
+        }
+
         createSwapChain();
         createImageViews();
-        createRenderPass();
-        createDescriptorSetLayout();
-        createGraphicsPipeline();
+        if (!options.dynamicRendering) {
+            createRenderPass();
+            createGraphicsPipeline();
+            createCullPipeline();
+        }
         createCommandPool();
         createColorResources();
         createDepthResources();
-        createFramebuffers();
+        if (!options.dynamicRendering) {
+            createFramebuffers();
+        }
         createTextureImage();
         createTextureImageView();
         createTextureSampler();
@@ -247,29 +2901,91 @@ private:
         createVertexBuffer();
         createIndexBuffer();
         createUniformBuffers();
-        createDescriptorPool();
-        createDescriptorSets();
+        createDescriptorAllocator();
+        createTextureTable();
+        createSceneInstances();
+        createInstanceBuffers();
+        if (pipelinesCreated.valid()) {
+            pipelinesCreated.get();
+        }
         createCommandBuffers();
+        createRecordingThreads();
+        createGpuProfiler();
         createSyncObjects();
     }
 
     void mainLoop() {
+        if (options.headless) {
+            runBenchmark();
+            return;
+        }
+
         while (!glfwWindowShouldClose(window)) {
             glfwPollEvents();
             drawFrame();
+
+            if (options.profile) {
+                gpuProfiler.printReport(1.0);
+                printRecordingStats(1.0);
+            }
+        }
+
+        vkDeviceWaitIdle(device);
+    }
+
+    void runBenchmark() {
+        std::vector<double> frameTimes;
+        frameTimes.reserve(options.benchmarkFrames);
+
+        auto benchmarkStart = std::chrono::high_resolution_clock::now();
+        auto frameStart = benchmarkStart;
+
+        for (uint32_t i = 0; i < options.benchmarkFrames; i++) {
+            drawFrame();
+            gpuProfiler.printReport(1.0);
+            printRecordingStats(1.0);
+
+            auto frameEnd = std::chrono::high_resolution_clock::now();
+            frameTimes.push_back(std::chrono::duration<double, std::chrono::milliseconds::period>(frameEnd - frameStart).count());
+            frameStart = frameEnd;
         }
 
         vkDeviceWaitIdle(device);
+
+        double totalSeconds = std::chrono::duration<double>(std::chrono::high_resolution_clock::now() - benchmarkStart).count();
+        printFrameTimeStats(frameTimes, totalSeconds);
+        gpuProfiler.printReport(0.0);
+        printRecordingStats(0.0);
+    }
+
+    void printFrameTimeStats(std::vector<double> frameTimes, double totalSeconds) {
+        if (frameTimes.empty()) {
+            return;
+        }
+
+        std::sort(frameTimes.begin(), frameTimes.end());
+
+        double sum = 0.0;
+        for (double frameTime : frameTimes) {
+            sum += frameTime;
+        }
+
+        size_t p99Rank = static_cast<size_t>(std::ceil(0.99 * frameTimes.size())) - 1;
+
+        std::cout << "benchmark: " << frameTimes.size() << " frames in " << totalSeconds << " s ("
+                  << frameTimes.size() / totalSeconds << " fps), frame time " << frameTimes.front() << " ms min, "
+                  << sum / frameTimes.size() << " ms avg, " << frameTimes[p99Rank] << " ms p99, "
+                  << frameTimes.back() << " ms max" << std::endl;
     }
 
     void cleanupSwapChain() {
         vkDestroyImageView(device, depthImageView, nullptr);
         vkDestroyImage(device, depthImage, nullptr);
-        vkFreeMemory(device, depthImageMemory, nullptr);
+        allocator.free(depthImageAllocation);
 
         vkDestroyImageView(device, colorImageView, nullptr);
         vkDestroyImage(device, colorImage, nullptr);
-        vkFreeMemory(device, colorImageMemory, nullptr);
+        allocator.free(colorImageAllocation);
 
         for (auto framebuffer : swapChainFramebuffers) {
             vkDestroyFramebuffer(device, framebuffer, nullptr);
@@ -279,36 +2995,67 @@ private:
             vkDestroyImageView(device, imageView, nullptr);
         }
 
-        vkDestroySwapchainKHR(device, swapChain, nullptr);
+        if (options.headless) {
+            for (size_t i = 0; i < swapChainImages.size(); i++) {
+                vkDestroyImage(device, swapChainImages[i], nullptr);
+                allocator.free(offscreenImagesAllocation[i]);
+            }
+        } else {
+            vkDestroySwapchainKHR(device, swapChain, nullptr);
+        }
     }
 
     void cleanup() {
+        if (options.memoryReport) {
+            printAttachmentMemoryReport();
+        }
         cleanupSwapChain();
 
+        savePipelineCache();
+        vkDestroyPipelineCache(device, pipelineCache, nullptr);
+
         vkDestroyPipeline(device, graphicsPipeline, nullptr);
         vkDestroyPipelineLayout(device, pipelineLayout, nullptr);
-        vkDestroyRenderPass(device, renderPass, nullptr);
+        vkDestroyPipeline(device, cullPipeline, nullptr);
+        vkDestroyPipelineLayout(device, cullPipelineLayout, nullptr);
+        if (renderPass != VK_NULL_HANDLE) {
+            vkDestroyRenderPass(device, renderPass, nullptr);
+        }
+
+        vkDestroyBuffer(device, uniformBuffer, nullptr);
+        allocator.free(uniformBufferAllocation);
 
         for (size_t i = 0; i < MAX_FRAMES_IN_FLIGHT; i++) {
-            vkDestroyBuffer(device, uniformBuffers[i], nullptr);
-            vkFreeMemory(device, uniformBuffersMemory[i], nullptr);
+            vkDestroyBuffer(device, visibleInstanceBuffers[i], nullptr);
+            allocator.free(visibleInstanceBuffersAllocation[i]);
+
+            vkDestroyBuffer(device, indirectDrawBuffers[i], nullptr);
+            allocator.free(indirectDrawBuffersAllocation[i]);
         }
 
-        vkDestroyDescriptorPool(device, descriptorPool, nullptr);
+        vkDestroyBuffer(device, instanceBuffer, nullptr);
+        allocator.free(instanceBufferAllocation);
+
+        descriptorAllocator.printStats();
+        descriptorAllocator.destroy();
+        if (textureTablePool != VK_NULL_HANDLE) {
+            vkDestroyDescriptorPool(device, textureTablePool, nullptr);
+        }
 
         vkDestroySampler(device, textureSampler, nullptr);
         vkDestroyImageView(device, textureImageView, nullptr);
 
         vkDestroyImage(device, textureImage, nullptr);
-        vkFreeMemory(device, textureImageMemory, nullptr);
+        allocator.free(textureImageAllocation);
 
         vkDestroyDescriptorSetLayout(device, descriptorSetLayout, nullptr);
+        vkDestroyDescriptorSetLayout(device, textureTableLayout, nullptr);
 
         vkDestroyBuffer(device, indexBuffer, nullptr);
-        vkFreeMemory(device, indexBufferMemory, nullptr);
+        allocator.free(indexBufferAllocation);
 
         vkDestroyBuffer(device, vertexBuffer, nullptr);
-        vkFreeMemory(device, vertexBufferMemory, nullptr);
+        allocator.free(vertexBufferAllocation);
 
         for (size_t i = 0; i < MAX_FRAMES_IN_FLIGHT; i++) {
             vkDestroySemaphore(device, renderFinishedSemaphores[i], nullptr);
@@ -318,18 +3065,39 @@ private:
 
         vkDestroyCommandPool(device, commandPool, nullptr);
 
+        recordingWorkers.stop();
+        for (auto& pools : threadCommandPools) {
+            for (auto pool : pools) {
+                vkDestroyCommandPool(device, pool, nullptr);
+            }
+        }
+
+        gpuProfiler.destroy();
+        uploadEngine.destroy();
+        uploadEngine.printStats();
+
+        vkDestroyBuffer(device, stagingRingBuffer, nullptr);
+        allocator.free(stagingRingAllocation);
+
+        allocator.printStats();
+        allocator.destroy();
+
         vkDestroyDevice(device, nullptr);
 
         if (enableValidationLayers) {
             DestroyDebugUtilsMessengerEXT(instance, debugMessenger, nullptr);
         }
 
-        vkDestroySurfaceKHR(instance, surface, nullptr);
+        if (!options.headless) {
+            vkDestroySurfaceKHR(instance, surface, nullptr);
+        }
         vkDestroyInstance(instance, nullptr);
 
-        glfwDestroyWindow(window);
+        if (!options.headless) {
+            glfwDestroyWindow(window);
 
-        glfwTerminate();
+            glfwTerminate();
+        }
     }
 
     void recreateSwapChain() {
@@ -348,7 +3116,9 @@ private:
         createImageViews();
         createColorResources();
         createDepthResources();
-        createFramebuffers();
+        if (!options.dynamicRendering) {
+            createFramebuffers();
+        }
     }
 
     void createInstance() {
@@ -410,6 +3180,10 @@ private:
     }
 
     void createSurface() {
+        if (options.headless) {
+            return;
+        }
+
         if (glfwCreateWindowSurface(instance, window, nullptr, &surface) != VK_SUCCESS) {
             throw std::runtime_error("failed to create window surface!");
         }
@@ -430,6 +3204,7 @@ private:
             if (isDeviceSuitable(device)) {
                 physicalDevice = device;
                 msaaSamples = getMaxUsableSampleCount();
+                colorAttachmentFormat = chooseColorAttachmentFormat();
                 break;
             }
         }
@@ -444,6 +3219,9 @@ private:
 
         std::vector<VkDeviceQueueCreateInfo> queueCreateInfos;
         std::set<uint32_t> uniqueQueueFamilies = {indices.graphicsFamily.value(), indices.presentFamily.value()};
+        if (indices.transferFamily.has_value()) {
+            uniqueQueueFamilies.insert(indices.transferFamily.value());
+        }
 
         float queuePriority = 1.0f;
         for (uint32_t queueFamily : uniqueQueueFamilies) {
@@ -458,6 +3236,33 @@ private:
         VkPhysicalDeviceFeatures deviceFeatures{};
         deviceFeatures.samplerAnisotropy = VK_TRUE;
 
+        VkPhysicalDeviceFeatures supportedFeatures;
+        vkGetPhysicalDeviceFeatures(physicalDevice, &supportedFeatures);
+        deviceFeatures.pipelineStatisticsQuery = supportedFeatures.pipelineStatisticsQuery;
+        // Lets the profiler's statistics query stay active around secondary command buffers
+        deviceFeatures.inheritedQueries = supportedFeatures.inheritedQueries;
+        deviceFeatures.textureCompressionBC = supportedFeatures.textureCompressionBC;
+        deviceFeatures.textureCompressionETC2 = supportedFeatures.textureCompressionETC2;
+        // Meshes split into several submeshes need one indirect draw per submesh
+        deviceFeatures.multiDrawIndirect = options.gpuDriven && supportedFeatures.multiDrawIndirect;
+        deviceFeatures.shaderSampledImageArrayDynamicIndexing = options.bindless ? VK_TRUE : VK_FALSE;
+
+        VkPhysicalDeviceDescriptorIndexingFeaturesEXT indexingFeatures{};
+        indexingFeatures.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_DESCRIPTOR_INDEXING_FEATURES_EXT;
+        indexingFeatures.descriptorBindingPartiallyBound = VK_TRUE;
+        indexingFeatures.descriptorBindingSampledImageUpdateAfterBind = VK_TRUE;
+        indexingFeatures.descriptorBindingUpdateUnusedWhilePending = VK_TRUE;
+        indexingFeatures.shaderSampledImageArrayNonUniformIndexing = VK_TRUE;
+
+        VkPhysicalDeviceSynchronization2FeaturesKHR synchronization2Features{};
+        synchronization2Features.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_SYNCHRONIZATION_2_FEATURES_KHR;
+        synchronization2Features.synchronization2 = VK_TRUE;
+
+        VkPhysicalDeviceDynamicRenderingFeaturesKHR dynamicRenderingFeatures{};
+        dynamicRenderingFeatures.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_DYNAMIC_RENDERING_FEATURES_KHR;
+        dynamicRenderingFeatures.pNext = &synchronization2Features;
+        dynamicRenderingFeatures.dynamicRendering = VK_TRUE;
+
         VkDeviceCreateInfo createInfo{};
         createInfo.sType = VK_STRUCTURE_TYPE_DEVICE_CREATE_INFO;
 
@@ -466,8 +3271,19 @@ private:
 
         createInfo.pEnabledFeatures = &deviceFeatures;
 
-        createInfo.enabledExtensionCount = static_cast<uint32_t>(deviceExtensions.size());
-        createInfo.ppEnabledExtensionNames = deviceExtensions.data();
+        if (options.bindless) {
+            createInfo.pNext = &indexingFeatures;
+        }
+
+        // Chained in front of the descriptor indexing features when both are enabled
+        if (options.dynamicRendering) {
+            synchronization2Features.pNext = const_cast<void*>(createInfo.pNext);
+            createInfo.pNext = &dynamicRenderingFeatures;
+        }
+
+        auto extensions = getRequiredDeviceExtensions();
+        createInfo.enabledExtensionCount = static_cast<uint32_t>(extensions.size());
+        createInfo.ppEnabledExtensionNames = extensions.data();
 
         if (enableValidationLayers) {
             createInfo.enabledLayerCount = static_cast<uint32_t>(validationLayers.size());
@@ -482,9 +3298,165 @@ private:
 
         vkGetDeviceQueue(device, indices.graphicsFamily.value(), 0, &graphicsQueue);
         vkGetDeviceQueue(device, indices.presentFamily.value(), 0, &presentQueue);
+        if (indices.transferFamily.has_value()) {
+            vkGetDeviceQueue(device, indices.transferFamily.value(), 0, &transferQueue);
+        }
+
+        if (options.gpuDriven) {
+            cmdDrawIndexedIndirectCount = (PFN_vkCmdDrawIndexedIndirectCountKHR) vkGetDeviceProcAddr(device, "vkCmdDrawIndexedIndirectCountKHR");
+            if (cmdDrawIndexedIndirectCount == nullptr) {
+                throw std::runtime_error("failed to load vkCmdDrawIndexedIndirectCountKHR!");
+            }
+        }
+
+        if (options.dynamicRendering) {
+            cmdBeginRendering = (PFN_vkCmdBeginRenderingKHR) vkGetDeviceProcAddr(device, "vkCmdBeginRenderingKHR");
+            cmdEndRendering = (PFN_vkCmdEndRenderingKHR) vkGetDeviceProcAddr(device, "vkCmdEndRenderingKHR");
+            cmdPipelineBarrier2 = (PFN_vkCmdPipelineBarrier2KHR) vkGetDeviceProcAddr(device, "vkCmdPipelineBarrier2KHR");
+            if (cmdBeginRendering == nullptr || cmdEndRendering == nullptr || cmdPipelineBarrier2 == nullptr) {
+                throw std::runtime_error("failed to load dynamic rendering functions!");
+            }
+        }
+    }
+
+    void createMemoryAllocator() {
+        allocator.init(physicalDevice, device);
+    }
+
+    void createUploadEngine() {
+        QueueFamilyIndices indices = findQueueFamilies(physicalDevice);
+
+        uploadEngine.init(device, &allocator, indices.graphicsFamily.value(), graphicsQueue, indices.transferFamily, transferQueue);
+
+        VkPhysicalDeviceProperties properties;
+        vkGetPhysicalDeviceProperties(physicalDevice, &properties);
+
+        // 16 bytes covers the texel block size of every texture format we upload
+        VkDeviceSize alignment = std::max<VkDeviceSize>(16, properties.limits.optimalBufferCopyOffsetAlignment);
+        VkDeviceSize capacity = static_cast<VkDeviceSize>(options.stagingRingMiB) * 1024 * 1024;
+
+        createBuffer(capacity, VK_BUFFER_USAGE_TRANSFER_SRC_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, stagingRingBuffer, stagingRingAllocation);
+        uploadEngine.initStagingRing(stagingRingBuffer, stagingRingAllocation.mapped, capacity, alignment);
+    }
+
+    void createPipelineCache() {
+        std::vector<char> cacheData = loadPipelineCacheData();
+        pipelineCacheWarm = !cacheData.empty();
+
+        VkPipelineCacheCreateInfo cacheInfo{};
+        cacheInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_CACHE_CREATE_INFO;
+        cacheInfo.initialDataSize = cacheData.size();
+        cacheInfo.pInitialData = cacheData.empty() ? nullptr : cacheData.data();
+
+        if (vkCreatePipelineCache(device, &cacheInfo, nullptr, &pipelineCache) != VK_SUCCESS) {
+            throw std::runtime_error("failed to create pipeline cache!");
+        }
+    }
+
+    std::vector<char> loadPipelineCacheData() {
+        std::ifstream file(PIPELINE_CACHE_PATH, std::ios::ate | std::ios::binary);
+
+        if (!file.is_open()) {
+            return {};
+        }
+
+        size_t fileSize = (size_t) file.tellg();
+        PipelineCacheFileHeader fileHeader{};
+        if (fileSize < sizeof(fileHeader)) {
+            std::cerr << "pipeline cache: ignoring truncated file" << std::endl;
+            return {};
+        }
+
+        file.seekg(0);
+        file.read(reinterpret_cast<char*>(&fileHeader), sizeof(fileHeader));
+
+        if (fileHeader.magic != PIPELINE_CACHE_MAGIC || fileHeader.dataSize != fileSize - sizeof(fileHeader)) {
+            std::cerr << "pipeline cache: ignoring corrupt file" << std::endl;
+            return {};
+        }
+
+        std::vector<char> data(fileHeader.dataSize);
+        file.read(data.data(), data.size());
+
+        if (!file || hashBytes(data.data(), data.size()) != fileHeader.dataHash) {
+            std::cerr << "pipeline cache: ignoring corrupt file" << std::endl;
+            return {};
+        }
+
+        if (!isPipelineCacheCompatible(data)) {
+            std::cerr << "pipeline cache: ignoring cache created by a different device or driver" << std::endl;
+            return {};
+        }
+
+        return data;
+    }
+
+    bool isPipelineCacheCompatible(const std::vector<char>& data) {
+        VkPipelineCacheHeaderVersionOne cacheHeader{};
+        if (data.size() < sizeof(cacheHeader)) {
+            return false;
+        }
+        memcpy(&cacheHeader, data.data(), sizeof(cacheHeader));
+
+        VkPhysicalDeviceProperties properties;
+        vkGetPhysicalDeviceProperties(physicalDevice, &properties);
+
+        return cacheHeader.headerSize >= sizeof(cacheHeader) &&
+               cacheHeader.headerVersion == VK_PIPELINE_CACHE_HEADER_VERSION_ONE &&
+               cacheHeader.vendorID == properties.vendorID &&
+               cacheHeader.deviceID == properties.deviceID &&
+               memcmp(cacheHeader.pipelineCacheUUID, properties.pipelineCacheUUID, VK_UUID_SIZE) == 0;
+    }
+
+    void savePipelineCache() {
+        size_t dataSize = 0;
+        if (vkGetPipelineCacheData(device, pipelineCache, &dataSize, nullptr) != VK_SUCCESS || dataSize == 0) {
+            return;
+        }
+
+        std::vector<char> data(dataSize);
+        if (vkGetPipelineCacheData(device, pipelineCache, &dataSize, data.data()) != VK_SUCCESS) {
+            return;
+        }
+
+        PipelineCacheFileHeader fileHeader{};
+        fileHeader.magic = PIPELINE_CACHE_MAGIC;
+        fileHeader.dataSize = static_cast<uint32_t>(dataSize);
+        fileHeader.dataHash = hashBytes(data.data(), dataSize);
+
+        // Write to a temporary file first and rename it over the old cache, so that
+        // a crash halfway through never leaves a partially written cache behind
+        std::string tempPath = PIPELINE_CACHE_PATH + ".tmp";
+        {
+            std::ofstream file(tempPath, std::ios::binary | std::ios::trunc);
+            if (!file.is_open()) {
+                std::cerr << "pipeline cache: failed to write " << tempPath << std::endl;
+                return;
+            }
+
+            file.write(reinterpret_cast<const char*>(&fileHeader), sizeof(fileHeader));
+            file.write(data.data(), dataSize);
+
+            if (!file) {
+                std::cerr << "pipeline cache: failed to write " << tempPath << std::endl;
+                return;
+            }
+        }
+
+        std::error_code error;
+        std::filesystem::rename(tempPath, PIPELINE_CACHE_PATH, error);
+        if (error) {
+            std::cerr << "pipeline cache: failed to replace " << PIPELINE_CACHE_PATH << ": " << error.message() << std::endl;
+            std::filesystem::remove(tempPath, error);
+        }
     }
 
     void createSwapChain() {
+        if (options.headless) {
+            createOffscreenImages();
+            return;
+        }
+
         SwapChainSupportDetails swapChainSupport = querySwapChainSupport(physicalDevice);
 
         VkSurfaceFormatKHR surfaceFormat = chooseSwapSurfaceFormat(swapChainSupport.formats);
@@ -535,6 +3507,19 @@ private:
         swapChainExtent = extent;
     }
 
+    // Stand-ins for the swap chain images in headless mode, one per frame in flight
+    void createOffscreenImages() {
+        swapChainImageFormat = colorAttachmentFormat;
+        swapChainExtent = {WIDTH, HEIGHT};
+
+        swapChainImages.resize(MAX_FRAMES_IN_FLIGHT);
+        offscreenImagesAllocation.resize(MAX_FRAMES_IN_FLIGHT);
+
+        for (size_t i = 0; i < MAX_FRAMES_IN_FLIGHT; i++) {
+            createImage(WIDTH, HEIGHT, 1, VK_SAMPLE_COUNT_1_BIT, swapChainImageFormat, VK_IMAGE_TILING_OPTIMAL, VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT | VK_IMAGE_USAGE_TRANSFER_SRC_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, swapChainImages[i], offscreenImagesAllocation[i]);
+        }
+    }
+
     void createImageViews() {
         swapChainImageViews.resize(swapChainImages.size());
 
@@ -548,7 +3533,7 @@ private:
         colorAttachment.format = swapChainImageFormat;
         colorAttachment.samples = msaaSamples;
         colorAttachment.loadOp = VK_ATTACHMENT_LOAD_OP_CLEAR;
-        colorAttachment.storeOp = VK_ATTACHMENT_STORE_OP_STORE;
+        colorAttachment.storeOp = VK_ATTACHMENT_STORE_OP_DONT_CARE; // only the resolved image is kept
         colorAttachment.stencilLoadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE;
         colorAttachment.stencilStoreOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
         colorAttachment.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
@@ -572,7 +3557,7 @@ private:
         colorAttachmentResolve.stencilLoadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE;
         colorAttachmentResolve.stencilStoreOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
         colorAttachmentResolve.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
-        colorAttachmentResolve.finalLayout = VK_IMAGE_LAYOUT_PRESENT_SRC_KHR;
+        colorAttachmentResolve.finalLayout = options.headless ? VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL : VK_IMAGE_LAYOUT_PRESENT_SRC_KHR;
 
         VkAttachmentReference colorAttachmentRef{};
         colorAttachmentRef.attachment = 0;
@@ -620,18 +3605,35 @@ private:
         VkDescriptorSetLayoutBinding uboLayoutBinding{};
         uboLayoutBinding.binding = 0;
         uboLayoutBinding.descriptorCount = 1;
-        uboLayoutBinding.descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
+        uboLayoutBinding.descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC;
         uboLayoutBinding.pImmutableSamplers = nullptr;
-        uboLayoutBinding.stageFlags = VK_SHADER_STAGE_VERTEX_BIT;
-
-        VkDescriptorSetLayoutBinding samplerLayoutBinding{};
-        samplerLayoutBinding.binding = 1;
-        samplerLayoutBinding.descriptorCount = 1;
-        samplerLayoutBinding.descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
-        samplerLayoutBinding.pImmutableSamplers = nullptr;
-        samplerLayoutBinding.stageFlags = VK_SHADER_STAGE_FRAGMENT_BIT;
-
-        std::array<VkDescriptorSetLayoutBinding, 2> bindings = {uboLayoutBinding, samplerLayoutBinding};
+        uboLayoutBinding.stageFlags = VK_SHADER_STAGE_VERTEX_BIT | VK_SHADER_STAGE_COMPUTE_BIT;
+
+        // Binding 1 used to be the texture, which now lives in the texture table (set 1)
+
+        // The culling shader shares this layout, so one set per frame serves both pipelines
+        VkDescriptorSetLayoutBinding instanceLayoutBinding{};
+        instanceLayoutBinding.binding = 2;
+        instanceLayoutBinding.descriptorCount = 1;
+        instanceLayoutBinding.descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+        instanceLayoutBinding.pImmutableSamplers = nullptr;
+        instanceLayoutBinding.stageFlags = VK_SHADER_STAGE_VERTEX_BIT | VK_SHADER_STAGE_COMPUTE_BIT;
+
+        VkDescriptorSetLayoutBinding visibleInstancesLayoutBinding{};
+        visibleInstancesLayoutBinding.binding = 3;
+        visibleInstancesLayoutBinding.descriptorCount = 1;
+        visibleInstancesLayoutBinding.descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+        visibleInstancesLayoutBinding.pImmutableSamplers = nullptr;
+        visibleInstancesLayoutBinding.stageFlags = VK_SHADER_STAGE_VERTEX_BIT | VK_SHADER_STAGE_COMPUTE_BIT;
+
+        VkDescriptorSetLayoutBinding indirectDrawLayoutBinding{};
+        indirectDrawLayoutBinding.binding = 4;
+        indirectDrawLayoutBinding.descriptorCount = 1;
+        indirectDrawLayoutBinding.descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+        indirectDrawLayoutBinding.pImmutableSamplers = nullptr;
+        indirectDrawLayoutBinding.stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+
+        std::array<VkDescriptorSetLayoutBinding, 4> bindings = {uboLayoutBinding, instanceLayoutBinding, visibleInstancesLayoutBinding, indirectDrawLayoutBinding};
         VkDescriptorSetLayoutCreateInfo layoutInfo{};
         layoutInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
         layoutInfo.bindingCount = static_cast<uint32_t>(bindings.size());
@@ -642,32 +3644,110 @@ private:
         }
     }
 
+    void createTextureTableLayout() {
+        VkDescriptorSetLayoutBinding textureLayoutBinding{};
+        textureLayoutBinding.binding = 0;
+        textureLayoutBinding.descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+        textureLayoutBinding.pImmutableSamplers = nullptr;
+        textureLayoutBinding.stageFlags = VK_SHADER_STAGE_FRAGMENT_BIT;
+
+        VkDescriptorSetLayoutCreateInfo layoutInfo{};
+        layoutInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
+        layoutInfo.bindingCount = 1;
+        layoutInfo.pBindings = &textureLayoutBinding;
+
+        // Partially bound, so unused entries may stay empty, and update after bind plus update unused
+        // while pending, so textures can be added to free entries while command buffers that use the
+        // set are pending
+        VkDescriptorBindingFlagsEXT bindingFlags = VK_DESCRIPTOR_BINDING_PARTIALLY_BOUND_BIT_EXT | VK_DESCRIPTOR_BINDING_UPDATE_AFTER_BIND_BIT_EXT | VK_DESCRIPTOR_BINDING_UPDATE_UNUSED_WHILE_PENDING_BIT_EXT;
+
+        VkDescriptorSetLayoutBindingFlagsCreateInfoEXT bindingFlagsInfo{};
+        bindingFlagsInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_BINDING_FLAGS_CREATE_INFO_EXT;
+        bindingFlagsInfo.bindingCount = 1;
+        bindingFlagsInfo.pBindingFlags = &bindingFlags;
+
+        if (options.bindless) {
+            VkPhysicalDeviceDescriptorIndexingPropertiesEXT indexingProperties = queryDescriptorIndexingProperties(physicalDevice);
+
+            // Combined image samplers count against both the sampler and the sampled image limits
+            textureTableCapacity = std::min({MAX_BINDLESS_TEXTURES,
+                indexingProperties.maxPerStageDescriptorUpdateAfterBindSamplers, indexingProperties.maxPerStageDescriptorUpdateAfterBindSampledImages,
+                indexingProperties.maxDescriptorSetUpdateAfterBindSamplers, indexingProperties.maxDescriptorSetUpdateAfterBindSampledImages});
+
+            layoutInfo.flags = VK_DESCRIPTOR_SET_LAYOUT_CREATE_UPDATE_AFTER_BIND_POOL_BIT_EXT;
+            layoutInfo.pNext = &bindingFlagsInfo;
+        }
+
+        textureLayoutBinding.descriptorCount = textureTableCapacity;
+
+        if (vkCreateDescriptorSetLayout(device, &layoutInfo, nullptr, &textureTableLayout) != VK_SUCCESS) {
+            throw std::runtime_error("failed to create texture table layout!");
+        }
+    }
+
     void createGraphicsPipeline() {
         auto vertShaderCode = readFile("shaders/vert.spv");
-        auto fragShaderCode = readFile("shaders/frag.spv");
+        auto fragShaderCode = readFile(options.bindless ? "shaders/frag_bindless.spv" : "shaders/frag.spv");
 
         VkShaderModule vertShaderModule = createShaderModule(vertShaderCode);
         VkShaderModule fragShaderModule = createShaderModule(fragShaderCode);
 
+        struct SpecializationData {
+            // Selects where the vertex shader takes the instance transform from: the push constants
+            // or the visible instance list written by the culling shader
+            VkBool32 gpuDriven;
+            // Size of the texture array in the fragment shader
+            uint32_t textureCount;
+        } specializationData;
+
+        specializationData.gpuDriven = options.gpuDriven ? VK_TRUE : VK_FALSE;
+        specializationData.textureCount = textureTableCapacity;
+
+        std::array<VkSpecializationMapEntry, 2> specializationEntries{};
+        specializationEntries[0].constantID = 0;
+        specializationEntries[0].offset = offsetof(SpecializationData, gpuDriven);
+        specializationEntries[0].size = sizeof(specializationData.gpuDriven);
+        specializationEntries[1].constantID = 1;
+        specializationEntries[1].offset = offsetof(SpecializationData, textureCount);
+        specializationEntries[1].size = sizeof(specializationData.textureCount);
+
+        // Both stages share the constants, each only picks up the ids it declares
+        VkSpecializationInfo specializationInfo{};
+        specializationInfo.mapEntryCount = static_cast<uint32_t>(specializationEntries.size());
+        specializationInfo.pMapEntries = specializationEntries.data();
+        specializationInfo.dataSize = sizeof(specializationData);
+        specializationInfo.pData = &specializationData;
+
         VkPipelineShaderStageCreateInfo vertShaderStageInfo{};
         vertShaderStageInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
         vertShaderStageInfo.stage = VK_SHADER_STAGE_VERTEX_BIT;
         vertShaderStageInfo.module = vertShaderModule;
         vertShaderStageInfo.pName = "main";
+        vertShaderStageInfo.pSpecializationInfo = &specializationInfo;
 
         VkPipelineShaderStageCreateInfo fragShaderStageInfo{};
         fragShaderStageInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
         fragShaderStageInfo.stage = VK_SHADER_STAGE_FRAGMENT_BIT;
         fragShaderStageInfo.module = fragShaderModule;
         fragShaderStageInfo.pName = "main";
+        fragShaderStageInfo.pSpecializationInfo = &specializationInfo;
 
         VkPipelineShaderStageCreateInfo shaderStages[] = {vertShaderStageInfo, fragShaderStageInfo};
 
         VkPipelineVertexInputStateCreateInfo vertexInputInfo{};
         vertexInputInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_VERTEX_INPUT_STATE_CREATE_INFO;
 
-        auto bindingDescription = Vertex::getBindingDescription();
-        auto attributeDescriptions = Vertex::getAttributeDescriptions();
+        VkVertexInputBindingDescription bindingDescription;
+        std::vector<VkVertexInputAttributeDescription> attributeDescriptions;
+        if (options.packedVertices) {
+            auto packedAttributeDescriptions = PackedVertex::getAttributeDescriptions();
+            bindingDescription = PackedVertex::getBindingDescription();
+            attributeDescriptions.assign(packedAttributeDescriptions.begin(), packedAttributeDescriptions.end());
+        } else {
+            auto vertexAttributeDescriptions = Vertex::getAttributeDescriptions();
+            bindingDescription = Vertex::getBindingDescription();
+            attributeDescriptions.assign(vertexAttributeDescriptions.begin(), vertexAttributeDescriptions.end());
+        }
 
         vertexInputInfo.vertexBindingDescriptionCount = 1;
         vertexInputInfo.vertexAttributeDescriptionCount = static_cast<uint32_t>(attributeDescriptions.size());
@@ -731,10 +3811,20 @@ private:
         dynamicState.dynamicStateCount = static_cast<uint32_t>(dynamicStates.size());
         dynamicState.pDynamicStates = dynamicStates.data();
 
+        std::array<VkDescriptorSetLayout, 2> setLayouts = {descriptorSetLayout, textureTableLayout};
+
         VkPipelineLayoutCreateInfo pipelineLayoutInfo{};
         pipelineLayoutInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
-        pipelineLayoutInfo.setLayoutCount = 1;
-        pipelineLayoutInfo.pSetLayouts = &descriptorSetLayout;
+        pipelineLayoutInfo.setLayoutCount = static_cast<uint32_t>(setLayouts.size());
+        pipelineLayoutInfo.pSetLayouts = setLayouts.data();
+
+        VkPushConstantRange pushConstantRange{};
+        pushConstantRange.stageFlags = VK_SHADER_STAGE_VERTEX_BIT;
+        pushConstantRange.offset = 0;
+        pushConstantRange.size = sizeof(InstancePushConstants);
+
+        pipelineLayoutInfo.pushConstantRangeCount = 1;
+        pipelineLayoutInfo.pPushConstantRanges = &pushConstantRange;
 
         if (vkCreatePipelineLayout(device, &pipelineLayoutInfo, nullptr, &pipelineLayout) != VK_SUCCESS) {
             throw std::runtime_error("failed to create pipeline layout!");
@@ -757,14 +3847,77 @@ private:
         pipelineInfo.subpass = 0;
         pipelineInfo.basePipelineHandle = VK_NULL_HANDLE;
 
-        if (vkCreateGraphicsPipelines(device, VK_NULL_HANDLE, 1, &pipelineInfo, nullptr, &graphicsPipeline) != VK_SUCCESS) {
+        // With dynamic rendering the pipeline is only tied to the attachment formats
+        VkPipelineRenderingCreateInfoKHR renderingInfo{};
+        renderingInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_RENDERING_CREATE_INFO_KHR;
+        renderingInfo.colorAttachmentCount = 1;
+        renderingInfo.pColorAttachmentFormats = &colorAttachmentFormat;
+        renderingInfo.depthAttachmentFormat = findDepthFormat();
+
+        if (options.dynamicRendering) {
+            pipelineInfo.pNext = &renderingInfo;
+            pipelineInfo.renderPass = VK_NULL_HANDLE;
+        }
+
+        auto pipelineStart = std::chrono::high_resolution_clock::now();
+
+        if (vkCreateGraphicsPipelines(device, pipelineCache, 1, &pipelineInfo, nullptr, &graphicsPipeline) != VK_SUCCESS) {
             throw std::runtime_error("failed to create graphics pipeline!");
         }
 
+        printPipelineCreationTime("graphics", pipelineStart);
+
         vkDestroyShaderModule(device, fragShaderModule, nullptr);
         vkDestroyShaderModule(device, vertShaderModule, nullptr);
     }
 
+    void createCullPipeline() {
+        if (!options.gpuDriven) {
+            return;
+        }
+
+        auto compShaderCode = readFile("shaders/comp.spv");
+
+        VkShaderModule compShaderModule = createShaderModule(compShaderCode);
+
+        VkPipelineShaderStageCreateInfo compShaderStageInfo{};
+        compShaderStageInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
+        compShaderStageInfo.stage = VK_SHADER_STAGE_COMPUTE_BIT;
+        compShaderStageInfo.module = compShaderModule;
+        compShaderStageInfo.pName = "main";
+
+        VkPushConstantRange pushConstantRange{};
+        pushConstantRange.stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+        pushConstantRange.offset = 0;
+        pushConstantRange.size = sizeof(CullPushConstants);
+
+        VkPipelineLayoutCreateInfo pipelineLayoutInfo{};
+        pipelineLayoutInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
+        pipelineLayoutInfo.setLayoutCount = 1;
+        pipelineLayoutInfo.pSetLayouts = &descriptorSetLayout;
+        pipelineLayoutInfo.pushConstantRangeCount = 1;
+        pipelineLayoutInfo.pPushConstantRanges = &pushConstantRange;
+
+        if (vkCreatePipelineLayout(device, &pipelineLayoutInfo, nullptr, &cullPipelineLayout) != VK_SUCCESS) {
+            throw std::runtime_error("failed to create culling pipeline layout!");
+        }
+
+        VkComputePipelineCreateInfo pipelineInfo{};
+        pipelineInfo.sType = VK_STRUCTURE_TYPE_COMPUTE_PIPELINE_CREATE_INFO;
+        pipelineInfo.layout = cullPipelineLayout;
+        pipelineInfo.stage = compShaderStageInfo;
+
+        auto pipelineStart = std::chrono::high_resolution_clock::now();
+
+        if (vkCreateComputePipelines(device, pipelineCache, 1, &pipelineInfo, nullptr, &cullPipeline) != VK_SUCCESS) {
+            throw std::runtime_error("failed to create culling pipeline!");
+        }
+
+        printPipelineCreationTime("culling", pipelineStart);
+
+        vkDestroyShaderModule(device, compShaderModule, nullptr);
+    }
+
     void createFramebuffers() {
         swapChainFramebuffers.resize(swapChainImageViews.size());
 
@@ -798,23 +3951,91 @@ private:
         poolInfo.flags = VK_COMMAND_POOL_CREATE_RESET_COMMAND_BUFFER_BIT;
         poolInfo.queueFamilyIndex = queueFamilyIndices.graphicsFamily.value();
 
-        if (vkCreateCommandPool(device, &poolInfo, nullptr, &commandPool) != VK_SUCCESS) {
-            throw std::runtime_error("failed to create graphics command pool!");
+        if (vkCreateCommandPool(device, &poolInfo, nullptr, &commandPool) != VK_SUCCESS) {
+            throw std::runtime_error("failed to create graphics command pool!");
+        }
+    }
+
+    // The multisampled color is only resolved and the depth is discarded, so neither ever has to leave
+    // on-chip tile memory. As transient attachments they can be backed by lazily allocated memory, which
+    // is only committed if the driver actually needs it
+    void createColorResources() {
+        VkFormat colorFormat = swapChainImageFormat;
+
+        createImage(swapChainExtent.width, swapChainExtent.height, 1, msaaSamples, colorFormat, VK_IMAGE_TILING_OPTIMAL, VK_IMAGE_USAGE_TRANSIENT_ATTACHMENT_BIT | VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT | VK_MEMORY_PROPERTY_LAZILY_ALLOCATED_BIT, colorImage, colorImageAllocation);
+        colorImageView = createImageView(colorImage, colorFormat, VK_IMAGE_ASPECT_COLOR_BIT, 1);
+    }
+
+    void createDepthResources() {
+        VkFormat depthFormat = findDepthFormat();
+
+        createImage(swapChainExtent.width, swapChainExtent.height, 1, msaaSamples, depthFormat, VK_IMAGE_TILING_OPTIMAL, VK_IMAGE_USAGE_TRANSIENT_ATTACHMENT_BIT | VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT | VK_MEMORY_PROPERTY_LAZILY_ALLOCATED_BIT, depthImage, depthImageAllocation);
+        depthImageView = createImageView(depthImage, depthFormat, VK_IMAGE_ASPECT_DEPTH_BIT, 1);
+    }
+
+    VkDeviceSize getAttachmentSize(VkSampleCountFlagBits samples, VkFormat format, VkImageUsageFlags usage) {
+        VkImageCreateInfo imageInfo{};
+        imageInfo.sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO;
+        imageInfo.imageType = VK_IMAGE_TYPE_2D;
+        imageInfo.extent = {swapChainExtent.width, swapChainExtent.height, 1};
+        imageInfo.mipLevels = 1;
+        imageInfo.arrayLayers = 1;
+        imageInfo.format = format;
+        imageInfo.tiling = VK_IMAGE_TILING_OPTIMAL;
+        imageInfo.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+        imageInfo.usage = usage;
+        imageInfo.samples = samples;
+        imageInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+
+        VkImage image;
+        if (vkCreateImage(device, &imageInfo, nullptr, &image) != VK_SUCCESS) {
+            throw std::runtime_error("failed to create image!");
         }
-    }
 
-    void createColorResources() {
-        VkFormat colorFormat = swapChainImageFormat;
+        VkMemoryRequirements memRequirements;
+        vkGetImageMemoryRequirements(device, image, &memRequirements);
+        vkDestroyImage(device, image, nullptr);
 
-        createImage(swapChainExtent.width, swapChainExtent.height, 1, msaaSamples, colorFormat, VK_IMAGE_TILING_OPTIMAL, VK_IMAGE_USAGE_TRANSIENT_ATTACHMENT_BIT | VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, colorImage, colorImageMemory);
-        colorImageView = createImageView(colorImage, colorFormat, VK_IMAGE_ASPECT_COLOR_BIT, 1);
+        return memRequirements.size;
     }
 
-    void createDepthResources() {
+    // What the multisampled attachments would cost at every sample count the device supports, and how
+    // much of the current ones the driver actually committed if they live in lazily allocated memory
+    void printAttachmentMemoryReport() {
+        VkPhysicalDeviceProperties properties;
+        vkGetPhysicalDeviceProperties(physicalDevice, &properties);
+        VkSampleCountFlags counts = properties.limits.framebufferColorSampleCounts & properties.limits.framebufferDepthSampleCounts;
+
+        const double MiB = 1024.0 * 1024.0;
         VkFormat depthFormat = findDepthFormat();
 
-        createImage(swapChainExtent.width, swapChainExtent.height, 1, msaaSamples, depthFormat, VK_IMAGE_TILING_OPTIMAL, VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, depthImage, depthImageMemory);
-        depthImageView = createImageView(depthImage, depthFormat, VK_IMAGE_ASPECT_DEPTH_BIT, 1);
+        std::cout << "attachment memory at " << swapChainExtent.width << "x" << swapChainExtent.height << ":" << std::endl;
+        for (VkSampleCountFlags samples = VK_SAMPLE_COUNT_1_BIT; samples <= VK_SAMPLE_COUNT_64_BIT; samples <<= 1) {
+            if (!(counts & samples)) {
+                continue;
+            }
+
+            auto sampleCount = static_cast<VkSampleCountFlagBits>(samples);
+            VkDeviceSize colorSize = getAttachmentSize(sampleCount, swapChainImageFormat, VK_IMAGE_USAGE_TRANSIENT_ATTACHMENT_BIT | VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT);
+            VkDeviceSize depthSize = getAttachmentSize(sampleCount, depthFormat, VK_IMAGE_USAGE_TRANSIENT_ATTACHMENT_BIT | VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT);
+
+            std::cout << "  " << samples << "x: " << colorSize / MiB << " MiB color + " << depthSize / MiB << " MiB depth = "
+                      << (colorSize + depthSize) / MiB << " MiB" << (sampleCount == msaaSamples ? " (in use)" : "") << std::endl;
+        }
+
+        bool lazilyAllocated = (allocator.getMemoryProperties(colorImageAllocation) & VK_MEMORY_PROPERTY_LAZILY_ALLOCATED_BIT)
+                            && (allocator.getMemoryProperties(depthImageAllocation) & VK_MEMORY_PROPERTY_LAZILY_ALLOCATED_BIT);
+        if (lazilyAllocated) {
+            VkDeviceSize colorCommitted = 0;
+            VkDeviceSize depthCommitted = 0;
+            vkGetDeviceMemoryCommitment(device, colorImageAllocation.memory, &colorCommitted);
+            vkGetDeviceMemoryCommitment(device, depthImageAllocation.memory, &depthCommitted);
+
+            std::cout << "  lazily allocated, " << (colorCommitted + depthCommitted) / MiB << " MiB of "
+                      << (colorImageAllocation.size + depthImageAllocation.size) / MiB << " MiB committed" << std::endl;
+        } else {
+            std::cout << "  no lazily allocated memory, fully backed by device local memory" << std::endl;
+        }
     }
 
     VkFormat findSupportedFormat(const std::vector<VkFormat>& candidates, VkImageTiling tiling, VkFormatFeatureFlags features) {
@@ -845,8 +4066,21 @@ private:
     }
 
     void createTextureImage() {
+        for (const CompressedTexture& texture : COMPRESSED_TEXTURES) {
+            if (isCompressedFormatSupported(texture.format) && loadCompressedTexture(texture)) {
+                // Submit right away so the texture upload overlaps with loading the model
+                uploadEngine.flush();
+                return;
+            }
+        }
+
+        textureFormat = VK_FORMAT_R8G8B8A8_SRGB;
+
+        // Decode straight from the mapped file instead of letting stb_image read it into its own buffer
+        MappedFile textureFile = readFile(TEXTURE_PATH);
+
         int texWidth, texHeight, texChannels;
-        stbi_uc* pixels = stbi_load(TEXTURE_PATH.c_str(), &texWidth, &texHeight, &texChannels, STBI_rgb_alpha);
+        stbi_uc* pixels = stbi_load_from_memory(reinterpret_cast<const stbi_uc*>(textureFile.data()), static_cast<int>(textureFile.size()), &texWidth, &texHeight, &texChannels, STBI_rgb_alpha);
         VkDeviceSize imageSize = texWidth * texHeight * 4;
         mipLevels = static_cast<uint32_t>(std::floor(std::log2(std::max(texWidth, texHeight)))) + 1;
 
@@ -854,30 +4088,121 @@ private:
             throw std::runtime_error("failed to load texture image!");
         }
 
-        VkBuffer stagingBuffer;
-        VkDeviceMemory stagingBufferMemory;
-        createBuffer(imageSize, VK_BUFFER_USAGE_TRANSFER_SRC_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, stagingBuffer, stagingBufferMemory);
+        StagingRegion staging = allocateStaging(imageSize);
 
-        void* data;
-        vkMapMemory(device, stagingBufferMemory, 0, imageSize, 0, &data);
-            memcpy(data, pixels, static_cast<size_t>(imageSize));
-        vkUnmapMemory(device, stagingBufferMemory);
+        memcpy(staging.mapped, pixels, static_cast<size_t>(imageSize));
 
         stbi_image_free(pixels);
 
-        createImage(texWidth, texHeight, mipLevels, VK_SAMPLE_COUNT_1_BIT, VK_FORMAT_R8G8B8A8_SRGB, VK_IMAGE_TILING_OPTIMAL, VK_IMAGE_USAGE_TRANSFER_SRC_BIT | VK_IMAGE_USAGE_TRANSFER_DST_BIT | VK_IMAGE_USAGE_SAMPLED_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, textureImage, textureImageMemory);
+        createImage(texWidth, texHeight, mipLevels, VK_SAMPLE_COUNT_1_BIT, VK_FORMAT_R8G8B8A8_SRGB, VK_IMAGE_TILING_OPTIMAL, VK_IMAGE_USAGE_TRANSFER_SRC_BIT | VK_IMAGE_USAGE_TRANSFER_DST_BIT | VK_IMAGE_USAGE_SAMPLED_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, textureImage, textureImageAllocation);
+
+        uploadEngine.copyBufferToImage(staging, textureImage, static_cast<uint32_t>(texWidth), static_cast<uint32_t>(texHeight), mipLevels);
 
-        transitionImageLayout(textureImage, VK_FORMAT_R8G8B8A8_SRGB, VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, mipLevels);
-        copyBufferToImage(stagingBuffer, textureImage, static_cast<uint32_t>(texWidth), static_cast<uint32_t>(texHeight));
         //transitioned to VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL while generating mipmaps
+        generateMipmaps(uploadEngine.graphicsCommandBuffer(), textureImage, VK_FORMAT_R8G8B8A8_SRGB, texWidth, texHeight, mipLevels);
+
+        // Submit right away so the texture upload overlaps with loading the model
+        uploadEngine.flush();
+    }
+
+    bool isCompressedFormatSupported(VkFormat format) {
+        VkPhysicalDeviceFeatures supportedFeatures;
+        vkGetPhysicalDeviceFeatures(physicalDevice, &supportedFeatures);
+
+        bool isBC = format >= VK_FORMAT_BC1_RGB_UNORM_BLOCK && format <= VK_FORMAT_BC7_SRGB_BLOCK;
+        if (isBC ? !supportedFeatures.textureCompressionBC : !supportedFeatures.textureCompressionETC2) {
+            return false;
+        }
+
+        VkFormatProperties formatProperties;
+        vkGetPhysicalDeviceFormatProperties(physicalDevice, format, &formatProperties);
+
+        VkFormatFeatureFlags required = VK_FORMAT_FEATURE_SAMPLED_IMAGE_BIT | VK_FORMAT_FEATURE_SAMPLED_IMAGE_FILTER_LINEAR_BIT;
+        return (formatProperties.optimalTilingFeatures & required) == required;
+    }
+
+    // Uploads every mip level of a KTX2 file as is. Returns false if the file is missing or
+    // isn't something we can use, so the caller can try the next candidate.
+    bool loadCompressedTexture(const CompressedTexture& texture) {
+        MappedFile file;
+        if (!file.open(texture.path) || file.size() < sizeof(Ktx2Header)) {
+            return false;
+        }
+
+        Ktx2Header header;
+        memcpy(&header, file.data(), sizeof(header));
+
+        if (memcmp(header.identifier, KTX2_IDENTIFIER, sizeof(KTX2_IDENTIFIER)) != 0 || header.vkFormat != static_cast<uint32_t>(texture.format)
+            || header.supercompressionScheme != 0 || header.pixelDepth != 0 || header.layerCount > 1 || header.faceCount != 1
+            || header.pixelWidth == 0 || header.pixelHeight == 0 || header.levelCount == 0
+            || file.size() < sizeof(header) + header.levelCount * sizeof(Ktx2LevelIndex)) {
+            std::cerr << "ignoring unsupported texture file " << texture.path << std::endl;
+            return false;
+        }
+
+        std::vector<Ktx2LevelIndex> levels(header.levelCount);
+        memcpy(levels.data(), file.data() + sizeof(header), levels.size() * sizeof(Ktx2LevelIndex));
+
+        // Staging offsets must be a multiple of the block size (and of 4)
+        std::vector<VkBufferImageCopy> regions(levels.size());
+        VkDeviceSize stagingSize = 0;
+        for (uint32_t i = 0; i < header.levelCount; i++) {
+            uint32_t width = std::max(1u, header.pixelWidth >> i);
+            uint32_t height = std::max(1u, header.pixelHeight >> i);
+            VkDeviceSize expectedSize = static_cast<VkDeviceSize>((width + 3) / 4) * ((height + 3) / 4) * texture.blockSize;
+
+            if (levels[i].byteLength != expectedSize || levels[i].byteOffset > file.size() || file.size() - levels[i].byteOffset < levels[i].byteLength) {
+                std::cerr << "ignoring corrupt texture file " << texture.path << std::endl;
+                return false;
+            }
+
+            regions[i].bufferOffset = stagingSize;
+            regions[i].imageSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+            regions[i].imageSubresource.mipLevel = i;
+            regions[i].imageSubresource.baseArrayLayer = 0;
+            regions[i].imageSubresource.layerCount = 1;
+            regions[i].imageOffset = {0, 0, 0};
+            regions[i].imageExtent = {width, height, 1};
+
+            stagingSize += (levels[i].byteLength + 15) / 16 * 16;
+        }
+
+        StagingRegion staging = allocateStaging(stagingSize);
+
+        for (uint32_t i = 0; i < header.levelCount; i++) {
+            memcpy(static_cast<char*>(staging.mapped) + regions[i].bufferOffset, file.data() + levels[i].byteOffset, static_cast<size_t>(levels[i].byteLength));
+        }
+
+        mipLevels = header.levelCount;
+        textureFormat = texture.format;
+
+        createImage(header.pixelWidth, header.pixelHeight, mipLevels, VK_SAMPLE_COUNT_1_BIT, textureFormat, VK_IMAGE_TILING_OPTIMAL, VK_IMAGE_USAGE_TRANSFER_DST_BIT | VK_IMAGE_USAGE_SAMPLED_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, textureImage, textureImageAllocation);
+
+        uploadEngine.copyBufferToImage(staging, textureImage, regions, mipLevels);
+
+        VkImageMemoryBarrier barrier{};
+        barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+        barrier.oldLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+        barrier.newLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+        barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+        barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+        barrier.image = textureImage;
+        barrier.subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+        barrier.subresourceRange.baseMipLevel = 0;
+        barrier.subresourceRange.levelCount = mipLevels;
+        barrier.subresourceRange.baseArrayLayer = 0;
+        barrier.subresourceRange.layerCount = 1;
+        barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+        barrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
+
+        vkCmdPipelineBarrier(uploadEngine.graphicsCommandBuffer(), VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT, 0, 0, nullptr, 0, nullptr, 1, &barrier);
 
-        vkDestroyBuffer(device, stagingBuffer, nullptr);
-        vkFreeMemory(device, stagingBufferMemory, nullptr);
+        std::cout << "texture: " << texture.path << ", " << mipLevels << " mip levels, " << stagingSize / 1024 << " KiB" << std::endl;
 
-        generateMipmaps(textureImage, VK_FORMAT_R8G8B8A8_SRGB, texWidth, texHeight, mipLevels);
+        return true;
     }
 
-    void generateMipmaps(VkImage image, VkFormat imageFormat, int32_t texWidth, int32_t texHeight, uint32_t mipLevels) {
+    void generateMipmaps(VkCommandBuffer commandBuffer, VkImage image, VkFormat imageFormat, int32_t texWidth, int32_t texHeight, uint32_t mipLevels) {
         // Check if image format supports linear blitting
         VkFormatProperties formatProperties;
         vkGetPhysicalDeviceFormatProperties(physicalDevice, imageFormat, &formatProperties);
@@ -886,8 +4211,6 @@ private:
             throw std::runtime_error("texture image format does not support linear blitting!");
         }
 
-        VkCommandBuffer commandBuffer = beginSingleTimeCommands();
-
         VkImageMemoryBarrier barrier{};
         barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
         barrier.image = image;
@@ -960,8 +4283,6 @@ private:
             0, nullptr,
             0, nullptr,
             1, &barrier);
-
-        endSingleTimeCommands(commandBuffer);
     }
 
     VkSampleCountFlagBits getMaxUsableSampleCount() {
@@ -980,7 +4301,7 @@ private:
     }
 
     void createTextureImageView() {
-        textureImageView = createImageView(textureImage, VK_FORMAT_R8G8B8A8_SRGB, VK_IMAGE_ASPECT_COLOR_BIT, mipLevels);
+        textureImageView = createImageView(textureImage, textureFormat, VK_IMAGE_ASPECT_COLOR_BIT, mipLevels);
     }
 
     void createTextureSampler() {
@@ -1030,7 +4351,7 @@ private:
         return imageView;
     }
 
-    void createImage(uint32_t width, uint32_t height, uint32_t mipLevels, VkSampleCountFlagBits numSamples, VkFormat format, VkImageTiling tiling, VkImageUsageFlags usage, VkMemoryPropertyFlags properties, VkImage& image, VkDeviceMemory& imageMemory) {
+    void createImage(uint32_t width, uint32_t height, uint32_t mipLevels, VkSampleCountFlagBits numSamples, VkFormat format, VkImageTiling tiling, VkImageUsageFlags usage, VkMemoryPropertyFlags properties, VkImage& image, Allocation& imageAllocation) {
         VkImageCreateInfo imageInfo{};
         imageInfo.sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO;
         imageInfo.imageType = VK_IMAGE_TYPE_2D;
@@ -1053,396 +4374,863 @@ private:
         VkMemoryRequirements memRequirements;
         vkGetImageMemoryRequirements(device, image, &memRequirements);
 
-        VkMemoryAllocateInfo allocInfo{};
-        allocInfo.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
-        allocInfo.allocationSize = memRequirements.size;
-        allocInfo.memoryTypeIndex = findMemoryType(memRequirements.memoryTypeBits, properties);
+        // Lazily allocated memory is only a preference, desktop GPUs generally don't have it. It is committed
+        // per VkDeviceMemory, so those images get their own to let vkGetDeviceMemoryCommitment report them
+        if ((properties & VK_MEMORY_PROPERTY_LAZILY_ALLOCATED_BIT) && !hasMemoryType(memRequirements.memoryTypeBits, properties)) {
+            properties &= ~VK_MEMORY_PROPERTY_LAZILY_ALLOCATED_BIT;
+        }
+        bool lazilyAllocated = (properties & VK_MEMORY_PROPERTY_LAZILY_ALLOCATED_BIT) != 0;
 
-        if (vkAllocateMemory(device, &allocInfo, nullptr, &imageMemory) != VK_SUCCESS) {
-            throw std::runtime_error("failed to allocate image memory!");
+        imageAllocation = allocator.allocate(memRequirements, findMemoryType(memRequirements.memoryTypeBits, properties), tiling == VK_IMAGE_TILING_LINEAR, lazilyAllocated);
+
+        vkBindImageMemory(device, image, imageAllocation.memory, imageAllocation.offset);
+    }
+
+    void loadModel() {
+        auto startTime = std::chrono::high_resolution_clock::now();
+
+        MappedFile sourceFile;
+        if (!sourceFile.open(MODEL_PATH)) {
+            throw std::runtime_error("failed to open model file!");
+        }
+        uint64_t sourceHash = hashBytes(sourceFile.data(), sourceFile.size());
+        sourceFile.close();
+
+        bool cacheHit = loadMeshCache(sourceHash);
+        if (!cacheHit) {
+            loadObjModel();
+            optimizeMesh();
+
+            vertexData = vertices.data();
+            vertexCount = static_cast<uint32_t>(vertices.size());
+            indexData = indices.data();
+            indexCount = static_cast<uint32_t>(indices.size());
+
+            saveMeshCache(sourceHash);
+        }
+
+        meshBoundsMin = glm::vec3(std::numeric_limits<float>::max());
+        meshBoundsMax = glm::vec3(std::numeric_limits<float>::lowest());
+        for (uint32_t i = 0; i < vertexCount; i++) {
+            meshBoundsMin = glm::min(meshBoundsMin, vertexData[i].pos);
+            meshBoundsMax = glm::max(meshBoundsMax, vertexData[i].pos);
         }
 
-        vkBindImageMemory(device, image, imageMemory, 0);
+        auto duration = std::chrono::duration<float, std::chrono::milliseconds::period>(std::chrono::high_resolution_clock::now() - startTime).count();
+        std::cout << "model loaded in " << duration << " ms (" << (cacheHit ? "warm" : "cold") << " mesh cache): "
+                  << vertexCount << " vertices, " << indexCount << " indices, ACMR " << meshStats[0].acmr << " -> " << meshStats[1].acmr
+                  << ", ATVR " << meshStats[0].atvr << " -> " << meshStats[1].atvr << std::endl;
     }
 
-    void transitionImageLayout(VkImage image, VkFormat format, VkImageLayout oldLayout, VkImageLayout newLayout, uint32_t mipLevels) {
-        VkCommandBuffer commandBuffer = beginSingleTimeCommands();
+    // Reorders the triangles for the post-transform vertex cache and optionally for overdraw,
+    // then the vertices for fetch locality. Only runs on a cold start, the result is cached.
+    void optimizeMesh() {
+        auto startTime = std::chrono::high_resolution_clock::now();
 
-        VkImageMemoryBarrier barrier{};
-        barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
-        barrier.oldLayout = oldLayout;
-        barrier.newLayout = newLayout;
-        barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
-        barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
-        barrier.image = image;
-        barrier.subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
-        barrier.subresourceRange.baseMipLevel = 0;
-        barrier.subresourceRange.levelCount = mipLevels;
-        barrier.subresourceRange.baseArrayLayer = 0;
-        barrier.subresourceRange.layerCount = 1;
+        meshStats[0] = analyzeVertexCache(indices, vertices.size());
 
-        VkPipelineStageFlags sourceStage;
-        VkPipelineStageFlags destinationStage;
+        std::vector<uint32_t> clusterStarts;
+        indices = optimizeVertexCache(indices, vertices.size(), clusterStarts);
 
-        if (oldLayout == VK_IMAGE_LAYOUT_UNDEFINED && newLayout == VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL) {
-            barrier.srcAccessMask = 0;
-            barrier.dstAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+        if (OPTIMIZE_MESH_OVERDRAW) {
+            indices = optimizeOverdraw(indices, clusterStarts, [&](uint32_t index) { return vertices[index].pos; });
+        }
 
-            sourceStage = VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT;
-            destinationStage = VK_PIPELINE_STAGE_TRANSFER_BIT;
-        } else if (oldLayout == VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL && newLayout == VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL) {
-            barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
-            barrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
+        optimizeVertexFetch(vertices, indices);
+
+        meshStats[1] = analyzeVertexCache(indices, vertices.size());
+
+        auto duration = std::chrono::duration<float, std::chrono::milliseconds::period>(std::chrono::high_resolution_clock::now() - startTime).count();
+        std::cout << "mesh optimized in " << duration << " ms (" << clusterStarts.size() << " clusters)" << std::endl;
+    }
+
+    void loadObjModel() {
+        uint32_t threadCount = options.loadThreads != 0 ? options.loadThreads : std::max(1u, std::thread::hardware_concurrency());
+
+        loadObjParallel(MODEL_PATH, threadCount, vertices, indices);
+    }
+
+    bool loadMeshCache(uint64_t sourceHash) {
+        if (!meshCacheFile.open(MESH_CACHE_PATH)) {
+            return false;
+        }
+
+        MeshCacheHeader header{};
+        if (meshCacheFile.size() < sizeof(header)) {
+            std::cerr << "mesh cache: ignoring truncated file" << std::endl;
+            meshCacheFile.close();
+            return false;
+        }
+        memcpy(&header, meshCacheFile.data(), sizeof(header));
+
+        if (header.magic != MESH_CACHE_MAGIC || header.version != MESH_CACHE_VERSION
+            || header.vertexStride != sizeof(Vertex) || header.indexStride != sizeof(uint32_t)) {
+            std::cerr << "mesh cache: ignoring file written by a different version" << std::endl;
+            meshCacheFile.close();
+            return false;
+        }
+
+        if (header.optimizeOverdraw != (OPTIMIZE_MESH_OVERDRAW ? 1u : 0u) || header.vertexCacheSize != VERTEX_CACHE_SIZE) {
+            std::cerr << "mesh cache: optimization settings have changed, rebuilding" << std::endl;
+            meshCacheFile.close();
+            return false;
+        }
+
+        if (header.sourceHash != sourceHash) {
+            std::cerr << "mesh cache: model has changed, rebuilding" << std::endl;
+            meshCacheFile.close();
+            return false;
+        }
+
+        uint64_t vertexBytes = uint64_t(header.vertexCount) * header.vertexStride;
+        uint64_t indexBytes = uint64_t(header.indexCount) * header.indexStride;
+        bool validLayout = header.vertexOffset >= sizeof(header) && header.vertexOffset % 16 == 0 && header.indexOffset % 16 == 0
+            && header.vertexOffset + vertexBytes <= header.indexOffset && header.indexOffset + indexBytes == meshCacheFile.size();
+
+        if (!validLayout || hashBytes(meshCacheFile.data() + sizeof(header), meshCacheFile.size() - sizeof(header)) != header.payloadHash) {
+            std::cerr << "mesh cache: ignoring corrupt file" << std::endl;
+            meshCacheFile.close();
+            return false;
+        }
+
+        // The mapping stays open so the staging buffers are filled straight from the page cache
+        vertexData = reinterpret_cast<const Vertex*>(meshCacheFile.data() + header.vertexOffset);
+        vertexCount = header.vertexCount;
+        indexData = reinterpret_cast<const uint32_t*>(meshCacheFile.data() + header.indexOffset);
+        indexCount = header.indexCount;
+
+        meshStats[0] = {header.acmrBefore, header.atvrBefore};
+        meshStats[1] = {header.acmrAfter, header.atvrAfter};
+
+        return true;
+    }
 
-            sourceStage = VK_PIPELINE_STAGE_TRANSFER_BIT;
-            destinationStage = VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT;
+    void saveMeshCache(uint64_t sourceHash) {
+        MeshCacheHeader header{};
+        header.magic = MESH_CACHE_MAGIC;
+        header.version = MESH_CACHE_VERSION;
+        header.sourceHash = sourceHash;
+        header.vertexStride = sizeof(Vertex);
+        header.indexStride = sizeof(uint32_t);
+        header.vertexCount = vertexCount;
+        header.indexCount = indexCount;
+        header.optimizeOverdraw = OPTIMIZE_MESH_OVERDRAW ? 1 : 0;
+        header.vertexCacheSize = VERTEX_CACHE_SIZE;
+        header.acmrBefore = meshStats[0].acmr;
+        header.acmrAfter = meshStats[1].acmr;
+        header.atvrBefore = meshStats[0].atvr;
+        header.atvrAfter = meshStats[1].atvr;
+
+        size_t vertexBytes = sizeof(Vertex) * vertexCount;
+        size_t indexBytes = sizeof(uint32_t) * indexCount;
+        header.vertexOffset = (sizeof(header) + 15) / 16 * 16;
+        header.indexOffset = (header.vertexOffset + vertexBytes + 15) / 16 * 16;
+
+        std::vector<char> payload(header.indexOffset + indexBytes - sizeof(header), 0);
+        memcpy(payload.data() + header.vertexOffset - sizeof(header), vertexData, vertexBytes);
+        memcpy(payload.data() + header.indexOffset - sizeof(header), indexData, indexBytes);
+        header.payloadHash = hashBytes(payload.data(), payload.size());
+
+        // Same write-then-rename scheme as savePipelineCache
+        std::string tempPath = MESH_CACHE_PATH + ".tmp";
+        {
+            std::ofstream file(tempPath, std::ios::binary | std::ios::trunc);
+            file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+            file.write(payload.data(), payload.size());
+
+            if (!file) {
+                std::cerr << "mesh cache: failed to write " << tempPath << std::endl;
+                return;
+            }
+        }
+
+        std::error_code error;
+        std::filesystem::rename(tempPath, MESH_CACHE_PATH, error);
+        if (error) {
+            std::cerr << "mesh cache: failed to replace " << MESH_CACHE_PATH << ": " << error.message() << std::endl;
+            std::filesystem::remove(tempPath, error);
+        }
+    }
+
+    void createVertexBuffer() {
+        VkDeviceSize bufferSize = (options.packedVertices ? sizeof(PackedVertex) : sizeof(Vertex)) * vertexCount;
+
+        StagingRegion staging = allocateStaging(bufferSize);
+
+        // The mesh cache keeps full precision vertices, so they are packed while filling the staging buffer
+        if (options.packedVertices) {
+            auto packedVertices = static_cast<PackedVertex*>(staging.mapped);
+            for (uint32_t i = 0; i < vertexCount; i++) {
+                packedVertices[i] = PackedVertex::pack(vertexData[i], meshBoundsMin, meshBoundsMax - meshBoundsMin);
+            }
         } else {
-            throw std::invalid_argument("unsupported layout transition!");
+            memcpy(staging.mapped, vertexData, (size_t) bufferSize);
         }
 
-        vkCmdPipelineBarrier(
-            commandBuffer,
-            sourceStage, destinationStage,
-            0,
-            0, nullptr,
-            0, nullptr,
-            1, &barrier
-        );
+        std::cout << "vertex buffer: " << bufferSize / 1024 << " KiB (" << (options.packedVertices ? "packed" : "full precision") << " vertices)" << std::endl;
+
+        createBuffer(bufferSize, VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_VERTEX_BUFFER_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, vertexBuffer, vertexBufferAllocation);
 
-        endSingleTimeCommands(commandBuffer);
+        uploadEngine.copyBuffer(staging, vertexBuffer, bufferSize, VK_PIPELINE_STAGE_VERTEX_INPUT_BIT, VK_ACCESS_VERTEX_ATTRIBUTE_READ_BIT);
     }
 
-    void copyBufferToImage(VkBuffer buffer, VkImage image, uint32_t width, uint32_t height) {
-        VkCommandBuffer commandBuffer = beginSingleTimeCommands();
+    void createIndexBuffer() {
+        // 16 bit indices halve the index memory and bandwidth, at the cost of one draw per submesh
+        std::vector<uint16_t> indices16;
+        const void* uploadData = indexData;
+        VkDeviceSize bufferSize = sizeof(uint32_t) * indexCount;
+
+        if (buildSubmeshes16(indexData, indexCount, indices16, submeshes)) {
+            indexType = VK_INDEX_TYPE_UINT16;
+            uploadData = indices16.data();
+            bufferSize = sizeof(uint16_t) * indexCount;
+        } else {
+            indexType = VK_INDEX_TYPE_UINT32;
+            submeshes = {{0, indexCount, 0}};
+        }
+
+        std::cout << "index buffer: " << bufferSize / 1024 << " KiB (" << (indexType == VK_INDEX_TYPE_UINT16 ? 16 : 32) << " bit indices, "
+                  << submeshes.size() << " submeshes)" << std::endl;
 
-        VkBufferImageCopy region{};
-        region.bufferOffset = 0;
-        region.bufferRowLength = 0;
-        region.bufferImageHeight = 0;
-        region.imageSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
-        region.imageSubresource.mipLevel = 0;
-        region.imageSubresource.baseArrayLayer = 0;
-        region.imageSubresource.layerCount = 1;
-        region.imageOffset = {0, 0, 0};
-        region.imageExtent = {
-            width,
-            height,
-            1
-        };
+        StagingRegion staging = allocateStaging(bufferSize);
 
-        vkCmdCopyBufferToImage(commandBuffer, buffer, image, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, 1, &region);
+        memcpy(staging.mapped, uploadData, (size_t) bufferSize);
 
-        endSingleTimeCommands(commandBuffer);
+        createBuffer(bufferSize, VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_INDEX_BUFFER_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, indexBuffer, indexBufferAllocation);
+
+        uploadEngine.copyBuffer(staging, indexBuffer, bufferSize, VK_PIPELINE_STAGE_VERTEX_INPUT_BIT, VK_ACCESS_INDEX_READ_BIT);
+
+        // The vertex and index copies go out together in a single submission
+        uploadEngine.flush();
     }
 
-    void loadModel() {
-        tinyobj::attrib_t attrib;
-        std::vector<tinyobj::shape_t> shapes;
-        std::vector<tinyobj::material_t> materials;
-        std::string err;
+    void createUniformBuffers() {
+        VkPhysicalDeviceProperties properties;
+        vkGetPhysicalDeviceProperties(physicalDevice, &properties);
+
+        // Dynamic offsets have to be multiples of minUniformBufferOffsetAlignment
+        VkDeviceSize alignment = properties.limits.minUniformBufferOffsetAlignment;
+        uniformBufferStride = (sizeof(UniformBufferObject) + alignment - 1) / alignment * alignment;
+
+        createBuffer(uniformBufferStride * MAX_FRAMES_IN_FLIGHT, VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, uniformBuffer, uniformBufferAllocation);
+    }
+
+    void createDescriptorAllocator() {
+        // Descriptors reserved per set, scaled by the number of sets in each pool. The sampler
+        // covers the texture table, which is allocated from here unless it is bindless.
+        descriptorAllocator.init(device, MAX_FRAMES_IN_FLIGHT, {
+            {VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC, 1},
+            {VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, 1},
+            {VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 3}
+        });
+
+        descriptorSets.resize(MAX_FRAMES_IN_FLIGHT);
+    }
+
+    void createTextureTable() {
+        if (options.bindless) {
+            // Update after bind sets need a pool created for them
+            VkDescriptorPoolSize poolSize{};
+            poolSize.type = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+            poolSize.descriptorCount = textureTableCapacity;
+
+            VkDescriptorPoolCreateInfo poolInfo{};
+            poolInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
+            poolInfo.flags = VK_DESCRIPTOR_POOL_CREATE_UPDATE_AFTER_BIND_BIT_EXT;
+            poolInfo.poolSizeCount = 1;
+            poolInfo.pPoolSizes = &poolSize;
+            poolInfo.maxSets = 1;
+
+            if (vkCreateDescriptorPool(device, &poolInfo, nullptr, &textureTablePool) != VK_SUCCESS) {
+                throw std::runtime_error("failed to create texture table pool!");
+            }
+
+            VkDescriptorSetAllocateInfo allocInfo{};
+            allocInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
+            allocInfo.descriptorPool = textureTablePool;
+            allocInfo.descriptorSetCount = 1;
+            allocInfo.pSetLayouts = &textureTableLayout;
+
+            if (vkAllocateDescriptorSets(device, &allocInfo, &textureTableSet) != VK_SUCCESS) {
+                throw std::runtime_error("failed to allocate texture table!");
+            }
+        } else {
+            textureTableSet = descriptorAllocator.allocate(textureTableLayout);
+        }
+
+        materialIndex = addTexture(textureImageView, textureSampler);
 
-        if (!tinyobj::LoadObj(&attrib, &shapes, &materials, &err, MODEL_PATH.c_str())) {
-            throw std::runtime_error(err);
+        std::cout << "texture table: " << textureTableSize << " of " << textureTableCapacity << " entries used" << (options.bindless ? " (bindless)" : "") << std::endl;
+    }
+
+    // Returns the material index that selects the texture in the fragment shader. With --bindless
+    // this can be called at any time, even while frames that use the table are in flight, because
+    // the new entry is one no pending command buffer reads.
+    uint32_t addTexture(VkImageView imageView, VkSampler sampler) {
+        if (textureTableSize == textureTableCapacity) {
+            throw std::runtime_error("texture table is full!");
         }
 
-        std::unordered_map<Vertex, uint32_t> uniqueVertices{};
+        VkDescriptorImageInfo imageInfo{};
+        imageInfo.imageLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+        imageInfo.imageView = imageView;
+        imageInfo.sampler = sampler;
 
-        for (const auto& shape : shapes) {
-            for (const auto& index : shape.mesh.indices) {
-                Vertex vertex{};
+        VkWriteDescriptorSet descriptorWrite{};
+        descriptorWrite.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+        descriptorWrite.dstSet = textureTableSet;
+        descriptorWrite.dstBinding = 0;
+        descriptorWrite.dstArrayElement = textureTableSize;
+        descriptorWrite.descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+        descriptorWrite.descriptorCount = 1;
+        descriptorWrite.pImageInfo = &imageInfo;
 
-                vertex.pos = {
-                    attrib.vertices[3 * index.vertex_index + 0],
-                    attrib.vertices[3 * index.vertex_index + 1],
-                    attrib.vertices[3 * index.vertex_index + 2]
-                };
+        vkUpdateDescriptorSets(device, 1, &descriptorWrite, 0, nullptr);
 
-                vertex.texCoord = {
-                    attrib.texcoords[2 * index.texcoord_index + 0],
-                    1.0f - attrib.texcoords[2 * index.texcoord_index + 1]
-                };
+        return textureTableSize++;
+    }
 
-                vertex.color = {1.0f, 1.0f, 1.0f};
+    // Only call after the frame's fence has signaled, the previous set is freed along with its pools
+    void createFrameDescriptorSet(uint32_t frame) {
+        descriptorAllocator.resetFrame(frame);
 
-                if (uniqueVertices.count(vertex) == 0) {
-                    uniqueVertices[vertex] = static_cast<uint32_t>(vertices.size());
-                    vertices.push_back(vertex);
-                }
+        DescriptorWrites writes;
+        writes.buffer(0, VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC, uniformBuffer, 0, sizeof(UniformBufferObject))
+              .buffer(2, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, instanceBuffer, 0, VK_WHOLE_SIZE)
+              .buffer(3, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, visibleInstanceBuffers[frame], 0, VK_WHOLE_SIZE)
+              .buffer(4, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, indirectDrawBuffers[frame], 0, VK_WHOLE_SIZE);
+
+        descriptorSets[frame] = descriptorAllocator.allocateTransient(frame, descriptorSetLayout);
+        writes.update(device, descriptorSets[frame]);
+    }
 
-                indices.push_back(uniqueVertices[vertex]);
+    // Staging memory normally comes from the upload engine's ring. Uploads larger than
+    // the whole ring get a buffer of their own, which is freed along with the batch.
+    StagingRegion allocateStaging(VkDeviceSize size) {
+        std::optional<StagingRegion> region = uploadEngine.allocateStaging(size);
+        if (region.has_value()) {
+            return region.value();
+        }
+
+        StagingRegion staging{};
+        Allocation stagingAllocation;
+        createBuffer(size, VK_BUFFER_USAGE_TRANSFER_SRC_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, staging.buffer, stagingAllocation);
+        uploadEngine.releaseAfterUpload(staging.buffer, stagingAllocation);
+
+        staging.mapped = stagingAllocation.mapped;
+        return staging;
+    }
+
+    void createBuffer(VkDeviceSize size, VkBufferUsageFlags usage, VkMemoryPropertyFlags properties, VkBuffer& buffer, Allocation& bufferAllocation) {
+        VkBufferCreateInfo bufferInfo{};
+        bufferInfo.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
+        bufferInfo.size = size;
+        bufferInfo.usage = usage;
+        bufferInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+
+        if (vkCreateBuffer(device, &bufferInfo, nullptr, &buffer) != VK_SUCCESS) {
+            throw std::runtime_error("failed to create buffer!");
+        }
+
+        VkMemoryRequirements memRequirements;
+        vkGetBufferMemoryRequirements(device, buffer, &memRequirements);
+
+        bufferAllocation = allocator.allocate(memRequirements, findMemoryType(memRequirements.memoryTypeBits, properties), true);
+
+        vkBindBufferMemory(device, buffer, bufferAllocation.memory, bufferAllocation.offset);
+    }
+
+    bool hasMemoryType(uint32_t typeFilter, VkMemoryPropertyFlags properties) {
+        VkPhysicalDeviceMemoryProperties memProperties;
+        vkGetPhysicalDeviceMemoryProperties(physicalDevice, &memProperties);
+
+        for (uint32_t i = 0; i < memProperties.memoryTypeCount; i++) {
+            if ((typeFilter & (1 << i)) && (memProperties.memoryTypes[i].propertyFlags & properties) == properties) {
+                return true;
             }
         }
+
+        return false;
     }
 
-    void createVertexBuffer() {
-        VkDeviceSize bufferSize = sizeof(vertices[0]) * vertices.size();
+    uint32_t findMemoryType(uint32_t typeFilter, VkMemoryPropertyFlags properties) {
+        VkPhysicalDeviceMemoryProperties memProperties;
+        vkGetPhysicalDeviceMemoryProperties(physicalDevice, &memProperties);
+
+        for (uint32_t i = 0; i < memProperties.memoryTypeCount; i++) {
+            if ((typeFilter & (1 << i)) && (memProperties.memoryTypes[i].propertyFlags & properties) == properties) {
+                return i;
+            }
+        }
+
+        throw std::runtime_error("failed to find suitable memory type!");
+    }
+
+    void createCommandBuffers() {
+        commandBuffers.resize(MAX_FRAMES_IN_FLIGHT);
+
+        VkCommandBufferAllocateInfo allocInfo{};
+        allocInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+        allocInfo.commandPool = commandPool;
+        allocInfo.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
+        allocInfo.commandBufferCount = (uint32_t) commandBuffers.size();
+
+        if (vkAllocateCommandBuffers(device, &allocInfo, commandBuffers.data()) != VK_SUCCESS) {
+            throw std::runtime_error("failed to allocate command buffers!");
+        }
+    }
+
+    void recordCommandBuffer(VkCommandBuffer commandBuffer, uint32_t imageIndex) {
+        VkCommandBufferBeginInfo beginInfo{};
+        beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+
+        if (vkBeginCommandBuffer(commandBuffer, &beginInfo) != VK_SUCCESS) {
+            throw std::runtime_error("failed to begin recording command buffer!");
+        }
+
+        if (options.gpuDriven) {
+            recordCulling(commandBuffer, currentFrame);
+        }
 
-        VkBuffer stagingBuffer;
-        VkDeviceMemory stagingBufferMemory;
-        createBuffer(bufferSize, VK_BUFFER_USAGE_TRANSFER_SRC_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, stagingBuffer, stagingBufferMemory);
+        bool executesSecondaries = !options.gpuDriven && recordingWorkers.size() > 0;
+        gpuProfiler.beginScope(commandBuffer, currentFrame, PROFILER_SCOPE_RENDER_PASS, executesSecondaries);
 
-        void* data;
-        vkMapMemory(device, stagingBufferMemory, 0, bufferSize, 0, &data);
-            memcpy(data, vertices.data(), (size_t) bufferSize);
-        vkUnmapMemory(device, stagingBufferMemory);
+        if (options.gpuDriven) {
+            beginSceneRendering(commandBuffer, imageIndex, VK_SUBPASS_CONTENTS_INLINE);
 
-        createBuffer(bufferSize, VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_VERTEX_BUFFER_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, vertexBuffer, vertexBufferMemory);
+                recordIndirectDraw(commandBuffer, currentFrame);
 
-        copyBuffer(stagingBuffer, vertexBuffer, bufferSize);
+            endSceneRendering(commandBuffer, imageIndex);
+        } else if (recordingWorkers.size() == 0) {
+            beginSceneRendering(commandBuffer, imageIndex, VK_SUBPASS_CONTENTS_INLINE);
 
-        vkDestroyBuffer(device, stagingBuffer, nullptr);
-        vkFreeMemory(device, stagingBufferMemory, nullptr);
-    }
+                recordSceneDraws(commandBuffer, currentFrame, 0, static_cast<uint32_t>(instanceTransforms.size()));
 
-    void createIndexBuffer() {
-        VkDeviceSize bufferSize = sizeof(indices[0]) * indices.size();
+            endSceneRendering(commandBuffer, imageIndex);
+        } else {
+            std::vector<VkCommandBuffer> secondaryCommandBuffers = recordSecondaryCommandBuffers(imageIndex);
 
-        VkBuffer stagingBuffer;
-        VkDeviceMemory stagingBufferMemory;
-        createBuffer(bufferSize, VK_BUFFER_USAGE_TRANSFER_SRC_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, stagingBuffer, stagingBufferMemory);
+            beginSceneRendering(commandBuffer, imageIndex, VK_SUBPASS_CONTENTS_SECONDARY_COMMAND_BUFFERS);
 
-        void* data;
-        vkMapMemory(device, stagingBufferMemory, 0, bufferSize, 0, &data);
-            memcpy(data, indices.data(), (size_t) bufferSize);
-        vkUnmapMemory(device, stagingBufferMemory);
+                vkCmdExecuteCommands(commandBuffer, static_cast<uint32_t>(secondaryCommandBuffers.size()), secondaryCommandBuffers.data());
 
-        createBuffer(bufferSize, VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_INDEX_BUFFER_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, indexBuffer, indexBufferMemory);
+            endSceneRendering(commandBuffer, imageIndex);
+        }
 
-        copyBuffer(stagingBuffer, indexBuffer, bufferSize);
+        gpuProfiler.endScope(commandBuffer, currentFrame, PROFILER_SCOPE_RENDER_PASS);
 
-        vkDestroyBuffer(device, stagingBuffer, nullptr);
-        vkFreeMemory(device, stagingBufferMemory, nullptr);
+        if (vkEndCommandBuffer(commandBuffer) != VK_SUCCESS) {
+            throw std::runtime_error("failed to record command buffer!");
+        }
     }
 
-    void createUniformBuffers() {
-        VkDeviceSize bufferSize = sizeof(UniformBufferObject);
-
-        uniformBuffers.resize(MAX_FRAMES_IN_FLIGHT);
-        uniformBuffersMemory.resize(MAX_FRAMES_IN_FLIGHT);
-        uniformBuffersMapped.resize(MAX_FRAMES_IN_FLIGHT);
+    void beginSceneRendering(VkCommandBuffer commandBuffer, uint32_t imageIndex, VkSubpassContents contents) {
+        std::array<VkClearValue, 2> clearValues{};
+        clearValues[0].color = {{0.0f, 0.0f, 0.0f, 1.0f}};
+        clearValues[1].depthStencil = {1.0f, 0};
 
-        for (size_t i = 0; i < MAX_FRAMES_IN_FLIGHT; i++) {
-            createBuffer(bufferSize, VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, uniformBuffers[i], uniformBuffersMemory[i]);
+        if (!options.dynamicRendering) {
+            VkRenderPassBeginInfo renderPassInfo{};
+            renderPassInfo.sType = VK_STRUCTURE_TYPE_RENDER_PASS_BEGIN_INFO;
+            renderPassInfo.renderPass = renderPass;
+            renderPassInfo.framebuffer = swapChainFramebuffers[imageIndex];
+            renderPassInfo.renderArea.offset = {0, 0};
+            renderPassInfo.renderArea.extent = swapChainExtent;
+            renderPassInfo.clearValueCount = static_cast<uint32_t>(clearValues.size());
+            renderPassInfo.pClearValues = clearValues.data();
+
+            vkCmdBeginRenderPass(commandBuffer, &renderPassInfo, contents);
+            return;
+        }
 
-            vkMapMemory(device, uniformBuffersMemory[i], 0, bufferSize, 0, &uniformBuffersMapped[i]);
+        // The layout transitions the render pass used to do through its attachment descriptions. Every
+        // attachment is fully overwritten, so the old contents are discarded with an undefined old layout
+        VkImageAspectFlags depthAspect = VK_IMAGE_ASPECT_DEPTH_BIT;
+        if (hasStencilComponent(findDepthFormat())) {
+            depthAspect |= VK_IMAGE_ASPECT_STENCIL_BIT;
         }
-    }
 
-    void createDescriptorPool() {
-        std::array<VkDescriptorPoolSize, 2> poolSizes{};
-        poolSizes[0].type = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
-        poolSizes[0].descriptorCount = static_cast<uint32_t>(MAX_FRAMES_IN_FLIGHT);
-        poolSizes[1].type = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
-        poolSizes[1].descriptorCount = static_cast<uint32_t>(MAX_FRAMES_IN_FLIGHT);
+        std::array<VkImageMemoryBarrier2KHR, 3> barriers{};
+        for (auto& barrier : barriers) {
+            barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER_2_KHR;
+            barrier.srcStageMask = VK_PIPELINE_STAGE_2_COLOR_ATTACHMENT_OUTPUT_BIT_KHR;
+            barrier.srcAccessMask = VK_ACCESS_2_COLOR_ATTACHMENT_WRITE_BIT_KHR;
+            barrier.dstStageMask = VK_PIPELINE_STAGE_2_COLOR_ATTACHMENT_OUTPUT_BIT_KHR;
+            barrier.dstAccessMask = VK_ACCESS_2_COLOR_ATTACHMENT_WRITE_BIT_KHR;
+            barrier.oldLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+            barrier.newLayout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL;
+            barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+            barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+            barrier.subresourceRange = {VK_IMAGE_ASPECT_COLOR_BIT, 0, 1, 0, 1};
+        }
 
-        VkDescriptorPoolCreateInfo poolInfo{};
-        poolInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
-        poolInfo.poolSizeCount = static_cast<uint32_t>(poolSizes.size());
-        poolInfo.pPoolSizes = poolSizes.data();
-        poolInfo.maxSets = static_cast<uint32_t>(MAX_FRAMES_IN_FLIGHT);
+        // The swap chain image is only written after the acquire semaphore, which waits at color attachment output
+        barriers[0].srcAccessMask = VK_ACCESS_2_NONE_KHR;
+        barriers[0].image = swapChainImages[imageIndex];
+
+        barriers[1].image = colorImage;
+
+        barriers[2].srcStageMask = VK_PIPELINE_STAGE_2_EARLY_FRAGMENT_TESTS_BIT_KHR | VK_PIPELINE_STAGE_2_LATE_FRAGMENT_TESTS_BIT_KHR;
+        barriers[2].srcAccessMask = VK_ACCESS_2_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT_KHR;
+        barriers[2].dstStageMask = VK_PIPELINE_STAGE_2_EARLY_FRAGMENT_TESTS_BIT_KHR | VK_PIPELINE_STAGE_2_LATE_FRAGMENT_TESTS_BIT_KHR;
+        barriers[2].dstAccessMask = VK_ACCESS_2_DEPTH_STENCIL_ATTACHMENT_READ_BIT_KHR | VK_ACCESS_2_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT_KHR;
+        barriers[2].newLayout = VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL;
+        barriers[2].image = depthImage;
+        barriers[2].subresourceRange.aspectMask = depthAspect;
+
+        VkDependencyInfoKHR dependencyInfo{};
+        dependencyInfo.sType = VK_STRUCTURE_TYPE_DEPENDENCY_INFO_KHR;
+        dependencyInfo.imageMemoryBarrierCount = static_cast<uint32_t>(barriers.size());
+        dependencyInfo.pImageMemoryBarriers = barriers.data();
+
+        cmdPipelineBarrier2(commandBuffer, &dependencyInfo);
+
+        // The multisampled color is resolved into the swap chain image and never needs to be stored
+        VkRenderingAttachmentInfoKHR colorAttachment{};
+        colorAttachment.sType = VK_STRUCTURE_TYPE_RENDERING_ATTACHMENT_INFO_KHR;
+        colorAttachment.imageView = colorImageView;
+        colorAttachment.imageLayout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL;
+        colorAttachment.resolveMode = VK_RESOLVE_MODE_AVERAGE_BIT_KHR;
+        colorAttachment.resolveImageView = swapChainImageViews[imageIndex];
+        colorAttachment.resolveImageLayout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL;
+        colorAttachment.loadOp = VK_ATTACHMENT_LOAD_OP_CLEAR;
+        colorAttachment.storeOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
+        colorAttachment.clearValue = clearValues[0];
 
-        if (vkCreateDescriptorPool(device, &poolInfo, nullptr, &descriptorPool) != VK_SUCCESS) {
-            throw std::runtime_error("failed to create descriptor pool!");
+        VkRenderingAttachmentInfoKHR depthAttachment{};
+        depthAttachment.sType = VK_STRUCTURE_TYPE_RENDERING_ATTACHMENT_INFO_KHR;
+        depthAttachment.imageView = depthImageView;
+        depthAttachment.imageLayout = VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL;
+        depthAttachment.loadOp = VK_ATTACHMENT_LOAD_OP_CLEAR;
+        depthAttachment.storeOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
+        depthAttachment.clearValue = clearValues[1];
+
+        VkRenderingInfoKHR renderingInfo{};
+        renderingInfo.sType = VK_STRUCTURE_TYPE_RENDERING_INFO_KHR;
+        renderingInfo.renderArea.offset = {0, 0};
+        renderingInfo.renderArea.extent = swapChainExtent;
+        renderingInfo.layerCount = 1;
+        renderingInfo.colorAttachmentCount = 1;
+        renderingInfo.pColorAttachments = &colorAttachment;
+        renderingInfo.pDepthAttachment = &depthAttachment;
+        if (contents == VK_SUBPASS_CONTENTS_SECONDARY_COMMAND_BUFFERS) {
+            renderingInfo.flags = VK_RENDERING_CONTENTS_SECONDARY_COMMAND_BUFFERS_BIT_KHR;
         }
-    }
 
-    void createDescriptorSets() {
-        std::vector<VkDescriptorSetLayout> layouts(MAX_FRAMES_IN_FLIGHT, descriptorSetLayout);
-        VkDescriptorSetAllocateInfo allocInfo{};
-        allocInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
-        allocInfo.descriptorPool = descriptorPool;
-        allocInfo.descriptorSetCount = static_cast<uint32_t>(MAX_FRAMES_IN_FLIGHT);
-        allocInfo.pSetLayouts = layouts.data();
+        cmdBeginRendering(commandBuffer, &renderingInfo);
+    }
 
-        descriptorSets.resize(MAX_FRAMES_IN_FLIGHT);
-        if (vkAllocateDescriptorSets(device, &allocInfo, descriptorSets.data()) != VK_SUCCESS) {
-            throw std::runtime_error("failed to allocate descriptor sets!");
+    void endSceneRendering(VkCommandBuffer commandBuffer, uint32_t imageIndex) {
+        if (!options.dynamicRendering) {
+            vkCmdEndRenderPass(commandBuffer);
+            return;
         }
 
-        for (size_t i = 0; i < MAX_FRAMES_IN_FLIGHT; i++) {
-            VkDescriptorBufferInfo bufferInfo{};
-            bufferInfo.buffer = uniformBuffers[i];
-            bufferInfo.offset = 0;
-            bufferInfo.range = sizeof(UniformBufferObject);
+        cmdEndRendering(commandBuffer);
+
+        // Presentation is ordered by the render finished semaphore, so only the layout needs to change here
+        VkImageMemoryBarrier2KHR barrier{};
+        barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER_2_KHR;
+        barrier.srcStageMask = VK_PIPELINE_STAGE_2_COLOR_ATTACHMENT_OUTPUT_BIT_KHR;
+        barrier.srcAccessMask = VK_ACCESS_2_COLOR_ATTACHMENT_WRITE_BIT_KHR;
+        barrier.dstStageMask = VK_PIPELINE_STAGE_2_BOTTOM_OF_PIPE_BIT_KHR;
+        barrier.dstAccessMask = VK_ACCESS_2_NONE_KHR;
+        barrier.oldLayout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL;
+        barrier.newLayout = options.headless ? VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL : VK_IMAGE_LAYOUT_PRESENT_SRC_KHR;
+        barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+        barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+        barrier.image = swapChainImages[imageIndex];
+        barrier.subresourceRange = {VK_IMAGE_ASPECT_COLOR_BIT, 0, 1, 0, 1};
 
-            VkDescriptorImageInfo imageInfo{};
-            imageInfo.imageLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
-            imageInfo.imageView = textureImageView;
-            imageInfo.sampler = textureSampler;
+        VkDependencyInfoKHR dependencyInfo{};
+        dependencyInfo.sType = VK_STRUCTURE_TYPE_DEPENDENCY_INFO_KHR;
+        dependencyInfo.imageMemoryBarrierCount = 1;
+        dependencyInfo.pImageMemoryBarriers = &barrier;
 
-            std::array<VkWriteDescriptorSet, 2> descriptorWrites{};
+        cmdPipelineBarrier2(commandBuffer, &dependencyInfo);
+    }
 
-            descriptorWrites[0].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
-            descriptorWrites[0].dstSet = descriptorSets[i];
-            descriptorWrites[0].dstBinding = 0;
-            descriptorWrites[0].dstArrayElement = 0;
-            descriptorWrites[0].descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
-            descriptorWrites[0].descriptorCount = 1;
-            descriptorWrites[0].pBufferInfo = &bufferInfo;
+    // Splits the instances into one contiguous range per worker. Each worker records its range into a
+    // secondary command buffer from its own pool for this frame, so no pool is ever shared between threads
+    std::vector<VkCommandBuffer> recordSecondaryCommandBuffers(uint32_t imageIndex) {
+        uint32_t threadCount = recordingWorkers.size();
+        uint32_t instanceCount = static_cast<uint32_t>(instanceTransforms.size());
+        uint32_t instancesPerThread = (instanceCount + threadCount - 1) / threadCount;
+        uint32_t frame = currentFrame;
+
+        VkCommandBufferInheritanceInfo inheritanceInfo{};
+        inheritanceInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_INHERITANCE_INFO;
+        inheritanceInfo.renderPass = renderPass;
+        inheritanceInfo.subpass = 0;
+        inheritanceInfo.pipelineStatistics = gpuProfiler.getInheritedPipelineStatistics();
+
+        // Without a render pass the secondaries inherit the attachment formats instead
+        VkCommandBufferInheritanceRenderingInfoKHR inheritanceRenderingInfo{};
+        inheritanceRenderingInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_INHERITANCE_RENDERING_INFO_KHR;
+        inheritanceRenderingInfo.colorAttachmentCount = 1;
+        inheritanceRenderingInfo.pColorAttachmentFormats = &colorAttachmentFormat;
+        inheritanceRenderingInfo.depthAttachmentFormat = findDepthFormat();
+        inheritanceRenderingInfo.rasterizationSamples = msaaSamples;
+
+        if (options.dynamicRendering) {
+            inheritanceInfo.pNext = &inheritanceRenderingInfo;
+        } else {
+            inheritanceInfo.framebuffer = swapChainFramebuffers[imageIndex];
+        }
 
-            descriptorWrites[1].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
-            descriptorWrites[1].dstSet = descriptorSets[i];
-            descriptorWrites[1].dstBinding = 1;
-            descriptorWrites[1].dstArrayElement = 0;
-            descriptorWrites[1].descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
-            descriptorWrites[1].descriptorCount = 1;
-            descriptorWrites[1].pImageInfo = &imageInfo;
+        recordingWorkers.run([&](uint32_t threadIndex) {
+            VkCommandBuffer commandBuffer = threadCommandBuffers[threadIndex][frame];
 
-            vkUpdateDescriptorSets(device, static_cast<uint32_t>(descriptorWrites.size()), descriptorWrites.data(), 0, nullptr);
-        }
-    }
+            vkResetCommandPool(device, threadCommandPools[threadIndex][frame], 0);
 
-    void createBuffer(VkDeviceSize size, VkBufferUsageFlags usage, VkMemoryPropertyFlags properties, VkBuffer& buffer, VkDeviceMemory& bufferMemory) {
-        VkBufferCreateInfo bufferInfo{};
-        bufferInfo.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
-        bufferInfo.size = size;
-        bufferInfo.usage = usage;
-        bufferInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+            VkCommandBufferBeginInfo beginInfo{};
+            beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+            beginInfo.flags = VK_COMMAND_BUFFER_USAGE_RENDER_PASS_CONTINUE_BIT | VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+            beginInfo.pInheritanceInfo = &inheritanceInfo;
 
-        if (vkCreateBuffer(device, &bufferInfo, nullptr, &buffer) != VK_SUCCESS) {
-            throw std::runtime_error("failed to create buffer!");
-        }
+            if (vkBeginCommandBuffer(commandBuffer, &beginInfo) != VK_SUCCESS) {
+                throw std::runtime_error("failed to begin recording secondary command buffer!");
+            }
 
-        VkMemoryRequirements memRequirements;
-        vkGetBufferMemoryRequirements(device, buffer, &memRequirements);
+            uint32_t firstInstance = std::min(threadIndex * instancesPerThread, instanceCount);
+            uint32_t lastInstance = std::min(firstInstance + instancesPerThread, instanceCount);
+            recordSceneDraws(commandBuffer, frame, firstInstance, lastInstance - firstInstance);
 
-        VkMemoryAllocateInfo allocInfo{};
-        allocInfo.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
-        allocInfo.allocationSize = memRequirements.size;
-        allocInfo.memoryTypeIndex = findMemoryType(memRequirements.memoryTypeBits, properties);
+            if (vkEndCommandBuffer(commandBuffer) != VK_SUCCESS) {
+                throw std::runtime_error("failed to record secondary command buffer!");
+            }
+        });
 
-        if (vkAllocateMemory(device, &allocInfo, nullptr, &bufferMemory) != VK_SUCCESS) {
-            throw std::runtime_error("failed to allocate buffer memory!");
+        std::vector<VkCommandBuffer> secondaryCommandBuffers;
+        for (uint32_t i = 0; i < threadCount; i++) {
+            secondaryCommandBuffers.push_back(threadCommandBuffers[i][frame]);
         }
 
-        vkBindBufferMemory(device, buffer, bufferMemory, 0);
+        return secondaryCommandBuffers;
     }
 
-    VkCommandBuffer beginSingleTimeCommands() {
-        VkCommandBufferAllocateInfo allocInfo{};
-        allocInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
-        allocInfo.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
-        allocInfo.commandPool = commandPool;
-        allocInfo.commandBufferCount = 1;
+    void recordSceneDraws(VkCommandBuffer commandBuffer, uint32_t frame, uint32_t firstInstance, uint32_t instanceCount) {
+        bindSceneState(commandBuffer, frame);
 
-        VkCommandBuffer commandBuffer;
-        vkAllocateCommandBuffers(device, &allocInfo, &commandBuffer);
+        // One draw per instance on purpose, so that recording cost scales with the scene size
+        for (uint32_t i = firstInstance; i < firstInstance + instanceCount; i++) {
+            InstancePushConstants constants{};
+            constants.model = instanceTransforms[i];
+            constants.materialIndex = instanceMaterials[i];
+            vkCmdPushConstants(commandBuffer, pipelineLayout, VK_SHADER_STAGE_VERTEX_BIT, 0, sizeof(constants), &constants);
 
-        VkCommandBufferBeginInfo beginInfo{};
-        beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
-        beginInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+            for (const auto& submesh : submeshes) {
+                vkCmdDrawIndexed(commandBuffer, submesh.indexCount, 1, submesh.firstIndex, submesh.vertexOffset, 0);
+            }
+        }
+    }
 
-        vkBeginCommandBuffer(commandBuffer, &beginInfo);
+    // Tests every instance against the view frustum and appends the visible ones to this frame's
+    // visible instance list, whose length becomes the instance count of the indirect draw
+    void recordCulling(VkCommandBuffer commandBuffer, uint32_t frame) {
+        gpuProfiler.beginScope(commandBuffer, frame, PROFILER_SCOPE_CULLING);
+
+        // The culling shader only fills in the draw and instance counts
+        uint32_t drawCount = 0;
+        std::vector<VkDrawIndexedIndirectCommand> drawCommands(submeshes.size());
+        for (size_t i = 0; i < submeshes.size(); i++) {
+            drawCommands[i].indexCount = submeshes[i].indexCount;
+            drawCommands[i].instanceCount = 0;
+            drawCommands[i].firstIndex = submeshes[i].firstIndex;
+            drawCommands[i].vertexOffset = submeshes[i].vertexOffset;
+            drawCommands[i].firstInstance = 0;
+        }
 
-        return commandBuffer;
-    }
+        vkCmdUpdateBuffer(commandBuffer, indirectDrawBuffers[frame], INDIRECT_DRAW_COUNT_OFFSET, sizeof(drawCount), &drawCount);
+        vkCmdUpdateBuffer(commandBuffer, indirectDrawBuffers[frame], INDIRECT_DRAW_COMMANDS_OFFSET, sizeof(VkDrawIndexedIndirectCommand) * drawCommands.size(), drawCommands.data());
 
-    void endSingleTimeCommands(VkCommandBuffer commandBuffer) {
-        vkEndCommandBuffer(commandBuffer);
+        VkMemoryBarrier resetBarrier{};
+        resetBarrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+        resetBarrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+        resetBarrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT;
 
-        VkSubmitInfo submitInfo{};
-        submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
-        submitInfo.commandBufferCount = 1;
-        submitInfo.pCommandBuffers = &commandBuffer;
+        vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, 0, 1, &resetBarrier, 0, nullptr, 0, nullptr);
+
+        vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, cullPipeline);
+        uint32_t uniformOffset = static_cast<uint32_t>(uniformBufferStride * frame);
+        vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, cullPipelineLayout, 0, 1, &descriptorSets[frame], 1, &uniformOffset);
+
+        CullPushConstants constants{};
+        constants.boundingSphere = meshBoundingSphere;
+        constants.instanceCount = static_cast<uint32_t>(instanceTransforms.size());
+        constants.submeshCount = static_cast<uint32_t>(submeshes.size());
+        vkCmdPushConstants(commandBuffer, cullPipelineLayout, VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(constants), &constants);
+
+        vkCmdDispatch(commandBuffer, (constants.instanceCount + CULL_WORKGROUP_SIZE - 1) / CULL_WORKGROUP_SIZE, 1, 1);
 
-        vkQueueSubmit(graphicsQueue, 1, &submitInfo, VK_NULL_HANDLE);
-        vkQueueWaitIdle(graphicsQueue);
+        VkMemoryBarrier cullBarrier{};
+        cullBarrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+        cullBarrier.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
+        cullBarrier.dstAccessMask = VK_ACCESS_INDIRECT_COMMAND_READ_BIT | VK_ACCESS_SHADER_READ_BIT;
 
-        vkFreeCommandBuffers(device, commandPool, 1, &commandBuffer);
+        vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_PIPELINE_STAGE_DRAW_INDIRECT_BIT | VK_PIPELINE_STAGE_VERTEX_SHADER_BIT, 0, 1, &cullBarrier, 0, nullptr, 0, nullptr);
+
+        gpuProfiler.endScope(commandBuffer, frame, PROFILER_SCOPE_CULLING);
     }
 
-    void copyBuffer(VkBuffer srcBuffer, VkBuffer dstBuffer, VkDeviceSize size) {
-        VkCommandBuffer commandBuffer = beginSingleTimeCommands();
+    // The recording cost is the same for any number of instances
+    void recordIndirectDraw(VkCommandBuffer commandBuffer, uint32_t frame) {
+        bindSceneState(commandBuffer, frame);
 
-        VkBufferCopy copyRegion{};
-        copyRegion.size = size;
-        vkCmdCopyBuffer(commandBuffer, srcBuffer, dstBuffer, 1, &copyRegion);
+        cmdDrawIndexedIndirectCount(commandBuffer, indirectDrawBuffers[frame], INDIRECT_DRAW_COMMANDS_OFFSET,
+            indirectDrawBuffers[frame], INDIRECT_DRAW_COUNT_OFFSET, static_cast<uint32_t>(submeshes.size()), sizeof(VkDrawIndexedIndirectCommand));
+    }
 
-        endSingleTimeCommands(commandBuffer);
+    void bindSceneState(VkCommandBuffer commandBuffer, uint32_t frame) {
+        vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, graphicsPipeline);
+
+        VkViewport viewport{};
+        viewport.x = 0.0f;
+        viewport.y = 0.0f;
+        viewport.width = (float) swapChainExtent.width;
+        viewport.height = (float) swapChainExtent.height;
+        viewport.minDepth = 0.0f;
+        viewport.maxDepth = 1.0f;
+        vkCmdSetViewport(commandBuffer, 0, 1, &viewport);
+
+        VkRect2D scissor{};
+        scissor.offset = {0, 0};
+        scissor.extent = swapChainExtent;
+        vkCmdSetScissor(commandBuffer, 0, 1, &scissor);
+
+        VkBuffer vertexBuffers[] = {vertexBuffer};
+        VkDeviceSize offsets[] = {0};
+        vkCmdBindVertexBuffers(commandBuffer, 0, 1, vertexBuffers, offsets);
+
+        vkCmdBindIndexBuffer(commandBuffer, indexBuffer, 0, indexType);
+
+        // Per-instance transforms and materials come from push constants or the instance buffer, so this stays the only descriptor set bind however many objects are drawn
+        std::array<VkDescriptorSet, 2> sets = {descriptorSets[frame], textureTableSet};
+        uint32_t uniformOffset = static_cast<uint32_t>(uniformBufferStride * frame);
+        vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, pipelineLayout, 0, static_cast<uint32_t>(sets.size()), sets.data(), 1, &uniformOffset);
     }
 
-    uint32_t findMemoryType(uint32_t typeFilter, VkMemoryPropertyFlags properties) {
-        VkPhysicalDeviceMemoryProperties memProperties;
-        vkGetPhysicalDeviceMemoryProperties(physicalDevice, &memProperties);
+    // Lays the instances out on a square grid around the origin. A single instance
+    // sits at the origin, which gives the original scene. There is only the one texture,
+    // so every instance gets its material.
+    void createSceneInstances() {
+        uint32_t gridSize = static_cast<uint32_t>(std::ceil(std::sqrt(static_cast<double>(options.instanceCount))));
+        const float spacing = 2.0f;
+
+        instanceTransforms.resize(options.instanceCount);
+        instanceMaterials.assign(options.instanceCount, materialIndex);
+        for (uint32_t i = 0; i < options.instanceCount; i++) {
+            float x = (static_cast<float>(i % gridSize) - (gridSize - 1) / 2.0f) * spacing;
+            float y = (static_cast<float>(i / gridSize) - (gridSize - 1) / 2.0f) * spacing;
+            instanceTransforms[i] = glm::translate(glm::mat4(1.0f), glm::vec3(x, y, 0.0f));
+        }
 
-        for (uint32_t i = 0; i < memProperties.memoryTypeCount; i++) {
-            if ((typeFilter & (1 << i)) && (memProperties.memoryTypes[i].propertyFlags & properties) == properties) {
-                return i;
-            }
+        sceneScale = static_cast<float>(gridSize);
+    }
+
+    // Bounding sphere around the center of the mesh's bounding box. Not the tightest fit,
+    // but cheap and good enough for frustum culling
+    void computeMeshBoundingSphere() {
+        glm::vec3 center = (meshBoundsMin + meshBoundsMax) * 0.5f;
+        float radius = 0.0f;
+        for (uint32_t i = 0; i < vertexCount; i++) {
+            radius = std::max(radius, glm::distance(center, vertexData[i].pos));
         }
 
-        throw std::runtime_error("failed to find suitable memory type!");
+        meshBoundingSphere = glm::vec4(center, radius);
     }
 
-    void createCommandBuffers() {
-        commandBuffers.resize(MAX_FRAMES_IN_FLIGHT);
+    void createInstanceBuffers() {
+        computeMeshBoundingSphere();
 
-        VkCommandBufferAllocateInfo allocInfo{};
-        allocInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
-        allocInfo.commandPool = commandPool;
-        allocInfo.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
-        allocInfo.commandBufferCount = (uint32_t) commandBuffers.size();
+        if (options.gpuDriven && submeshes.size() > 1) {
+            VkPhysicalDeviceFeatures supportedFeatures;
+            vkGetPhysicalDeviceFeatures(physicalDevice, &supportedFeatures);
 
-        if (vkAllocateCommandBuffers(device, &allocInfo, commandBuffers.data()) != VK_SUCCESS) {
-            throw std::runtime_error("failed to allocate command buffers!");
+            if (!supportedFeatures.multiDrawIndirect) {
+                throw std::runtime_error("gpu driven drawing of a mesh with several submeshes requires multiDrawIndirect!");
+            }
         }
-    }
 
-    void recordCommandBuffer(VkCommandBuffer commandBuffer, uint32_t imageIndex) {
-        VkCommandBufferBeginInfo beginInfo{};
-        beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+        VkDeviceSize bufferSize = sizeof(InstanceData) * instanceTransforms.size();
 
-        if (vkBeginCommandBuffer(commandBuffer, &beginInfo) != VK_SUCCESS) {
-            throw std::runtime_error("failed to begin recording command buffer!");
+        StagingRegion staging = allocateStaging(bufferSize);
+
+        auto instances = static_cast<InstanceData*>(staging.mapped);
+        for (size_t i = 0; i < instanceTransforms.size(); i++) {
+            instances[i] = InstanceData{instanceTransforms[i], instanceMaterials[i]};
         }
 
-        VkRenderPassBeginInfo renderPassInfo{};
-        renderPassInfo.sType = VK_STRUCTURE_TYPE_RENDER_PASS_BEGIN_INFO;
-        renderPassInfo.renderPass = renderPass;
-        renderPassInfo.framebuffer = swapChainFramebuffers[imageIndex];
-        renderPassInfo.renderArea.offset = {0, 0};
-        renderPassInfo.renderArea.extent = swapChainExtent;
+        createBuffer(bufferSize, VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_STORAGE_BUFFER_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, instanceBuffer, instanceBufferAllocation);
 
-        std::array<VkClearValue, 2> clearValues{};
-        clearValues[0].color = {{0.0f, 0.0f, 0.0f, 1.0f}};
-        clearValues[1].depthStencil = {1.0f, 0};
+        uploadEngine.copyBuffer(staging, instanceBuffer, bufferSize, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT | VK_PIPELINE_STAGE_VERTEX_SHADER_BIT, VK_ACCESS_SHADER_READ_BIT);
+        uploadEngine.flush();
 
-        renderPassInfo.clearValueCount = static_cast<uint32_t>(clearValues.size());
-        renderPassInfo.pClearValues = clearValues.data();
+        visibleInstanceBuffers.resize(MAX_FRAMES_IN_FLIGHT);
+        visibleInstanceBuffersAllocation.resize(MAX_FRAMES_IN_FLIGHT);
+        indirectDrawBuffers.resize(MAX_FRAMES_IN_FLIGHT);
+        indirectDrawBuffersAllocation.resize(MAX_FRAMES_IN_FLIGHT);
 
-        vkCmdBeginRenderPass(commandBuffer, &renderPassInfo, VK_SUBPASS_CONTENTS_INLINE);
+        for (size_t i = 0; i < MAX_FRAMES_IN_FLIGHT; i++) {
+            createBuffer(sizeof(uint32_t) * instanceTransforms.size(), VK_BUFFER_USAGE_STORAGE_BUFFER_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, visibleInstanceBuffers[i], visibleInstanceBuffersAllocation[i]);
+            createBuffer(INDIRECT_DRAW_COMMANDS_OFFSET + sizeof(VkDrawIndexedIndirectCommand) * submeshes.size(), VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, indirectDrawBuffers[i], indirectDrawBuffersAllocation[i]);
+        }
+    }
 
-            vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, graphicsPipeline);
+    void createRecordingThreads() {
+        // A single indirect draw leaves nothing to spread across threads
+        if (options.recordingThreads == 0 || options.gpuDriven) {
+            return;
+        }
 
-            VkViewport viewport{};
-            viewport.x = 0.0f;
-            viewport.y = 0.0f;
-            viewport.width = (float) swapChainExtent.width;
-            viewport.height = (float) swapChainExtent.height;
-            viewport.minDepth = 0.0f;
-            viewport.maxDepth = 1.0f;
-            vkCmdSetViewport(commandBuffer, 0, 1, &viewport);
+        QueueFamilyIndices queueFamilyIndices = findQueueFamilies(physicalDevice);
 
-            VkRect2D scissor{};
-            scissor.offset = {0, 0};
-            scissor.extent = swapChainExtent;
-            vkCmdSetScissor(commandBuffer, 0, 1, &scissor);
+        threadCommandPools.resize(options.recordingThreads);
+        threadCommandBuffers.resize(options.recordingThreads);
 
-            VkBuffer vertexBuffers[] = {vertexBuffer};
-            VkDeviceSize offsets[] = {0};
-            vkCmdBindVertexBuffers(commandBuffer, 0, 1, vertexBuffers, offsets);
+        for (uint32_t i = 0; i < options.recordingThreads; i++) {
+            for (size_t frame = 0; frame < MAX_FRAMES_IN_FLIGHT; frame++) {
+                VkCommandPoolCreateInfo poolInfo{};
+                poolInfo.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
+                poolInfo.flags = VK_COMMAND_POOL_CREATE_TRANSIENT_BIT;
+                poolInfo.queueFamilyIndex = queueFamilyIndices.graphicsFamily.value();
 
-            vkCmdBindIndexBuffer(commandBuffer, indexBuffer, 0, VK_INDEX_TYPE_UINT32);
+                if (vkCreateCommandPool(device, &poolInfo, nullptr, &threadCommandPools[i][frame]) != VK_SUCCESS) {
+                    throw std::runtime_error("failed to create recording thread command pool!");
+                }
 
-            vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, pipelineLayout, 0, 1, &descriptorSets[currentFrame], 0, nullptr);
+                VkCommandBufferAllocateInfo allocInfo{};
+                allocInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+                allocInfo.commandPool = threadCommandPools[i][frame];
+                allocInfo.level = VK_COMMAND_BUFFER_LEVEL_SECONDARY;
+                allocInfo.commandBufferCount = 1;
 
-            vkCmdDrawIndexed(commandBuffer, static_cast<uint32_t>(indices.size()), 1, 0, 0, 0);
+                if (vkAllocateCommandBuffers(device, &allocInfo, &threadCommandBuffers[i][frame]) != VK_SUCCESS) {
+                    throw std::runtime_error("failed to allocate secondary command buffers!");
+                }
+            }
+        }
 
-        vkCmdEndRenderPass(commandBuffer);
+        recordingWorkers.start(options.recordingThreads);
+    }
 
-        if (vkEndCommandBuffer(commandBuffer) != VK_SUCCESS) {
-            throw std::runtime_error("failed to record command buffer!");
+    void printRecordingStats(double intervalSeconds) {
+        auto now = std::chrono::steady_clock::now();
+        if (recordingTimes.empty() || std::chrono::duration<double>(now - lastRecordingReport).count() < intervalSeconds) {
+            return;
         }
+        lastRecordingReport = now;
+
+        std::cout << "cpu recording (" << instanceTransforms.size() << " instances, "
+                  << (options.gpuDriven ? std::string("gpu driven") : recordingWorkers.size() == 0 ? std::string("inline") : std::to_string(recordingWorkers.size()) + " threads") << "): "
+                  << recordingTimes.min() << " ms min, " << recordingTimes.avg() << " ms avg, "
+                  << recordingTimes.percentile(0.99) << " ms p99" << std::endl;
+    }
+
+    void createGpuProfiler() {
+        QueueFamilyIndices queueFamilyIndices = findQueueFamilies(physicalDevice);
+
+        gpuProfiler.init(physicalDevice, device, queueFamilyIndices.graphicsFamily.value(), MAX_FRAMES_IN_FLIGHT, {"render pass", "culling"});
     }
 
     void createSyncObjects() {
@@ -1474,39 +5262,60 @@ private:
 
         UniformBufferObject ubo{};
         ubo.model = glm::rotate(glm::mat4(1.0f), time * glm::radians(90.0f), glm::vec3(0.0f, 0.0f, 1.0f));
-        ubo.view = glm::lookAt(glm::vec3(2.0f, 2.0f, 2.0f), glm::vec3(0.0f, 0.0f, 0.0f), glm::vec3(0.0f, 0.0f, 1.0f));
-        ubo.proj = glm::perspective(glm::radians(45.0f), swapChainExtent.width / (float) swapChainExtent.height, 0.1f, 10.0f);
+        // Back the camera off far enough to see the whole instance grid
+        ubo.view = glm::lookAt(glm::vec3(2.0f, 2.0f, 2.0f) * sceneScale, glm::vec3(0.0f, 0.0f, 0.0f), glm::vec3(0.0f, 0.0f, 1.0f));
+        ubo.proj = glm::perspective(glm::radians(45.0f), swapChainExtent.width / (float) swapChainExtent.height, 0.1f, 10.0f * sceneScale);
         ubo.proj[1][1] *= -1;
 
-        memcpy(uniformBuffersMapped[currentImage], &ubo, sizeof(ubo));
+        if (options.packedVertices) {
+            ubo.positionOffset = glm::vec4(meshBoundsMin, 0.0f);
+            ubo.positionScale = glm::vec4(meshBoundsMax - meshBoundsMin, 0.0f);
+        } else {
+            ubo.positionOffset = glm::vec4(0.0f);
+            ubo.positionScale = glm::vec4(1.0f);
+        }
+
+        memcpy(static_cast<char*>(uniformBufferAllocation.mapped) + uniformBufferStride * currentImage, &ubo, sizeof(ubo));
     }
 
     void drawFrame() {
         vkWaitForFences(device, 1, &inFlightFences[currentFrame], VK_TRUE, UINT64_MAX);
 
-        uint32_t imageIndex;
-        VkResult result = vkAcquireNextImageKHR(device, swapChain, UINT64_MAX, imageAvailableSemaphores[currentFrame], VK_NULL_HANDLE, &imageIndex);
+        uploadEngine.collect();
 
-        if (result == VK_ERROR_OUT_OF_DATE_KHR) {
-            recreateSwapChain();
-            return;
-        } else if (result != VK_SUCCESS && result != VK_SUBOPTIMAL_KHR) {
-            throw std::runtime_error("failed to acquire swap chain image!");
+        uint32_t imageIndex = currentFrame;
+        if (!options.headless) {
+            VkResult result = vkAcquireNextImageKHR(device, swapChain, UINT64_MAX, imageAvailableSemaphores[currentFrame], VK_NULL_HANDLE, &imageIndex);
+
+            if (result == VK_ERROR_OUT_OF_DATE_KHR) {
+                recreateSwapChain();
+                return;
+            } else if (result != VK_SUCCESS && result != VK_SUBOPTIMAL_KHR) {
+                throw std::runtime_error("failed to acquire swap chain image!");
+            }
         }
 
         updateUniformBuffer(currentFrame);
+        createFrameDescriptorSet(currentFrame);
 
         vkResetFences(device, 1, &inFlightFences[currentFrame]);
 
+        auto recordingStart = std::chrono::high_resolution_clock::now();
+
         vkResetCommandBuffer(commandBuffers[currentFrame], /*VkCommandBufferResetFlagBits*/ 0);
         recordCommandBuffer(commandBuffers[currentFrame], imageIndex);
 
+        recordingTimes.add(std::chrono::duration<double, std::chrono::milliseconds::period>(std::chrono::high_resolution_clock::now() - recordingStart).count());
+
         VkSubmitInfo submitInfo{};
         submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
 
+        // Nothing is acquired or presented in headless mode, so there are no semaphores to wait on or signal
+        uint32_t semaphoreCount = options.headless ? 0 : 1;
+
         VkSemaphore waitSemaphores[] = {imageAvailableSemaphores[currentFrame]};
         VkPipelineStageFlags waitStages[] = {VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT};
-        submitInfo.waitSemaphoreCount = 1;
+        submitInfo.waitSemaphoreCount = semaphoreCount;
         submitInfo.pWaitSemaphores = waitSemaphores;
         submitInfo.pWaitDstStageMask = waitStages;
 
@@ -1514,13 +5323,18 @@ private:
         submitInfo.pCommandBuffers = &commandBuffers[currentFrame];
 
         VkSemaphore signalSemaphores[] = {renderFinishedSemaphores[currentFrame]};
-        submitInfo.signalSemaphoreCount = 1;
+        submitInfo.signalSemaphoreCount = semaphoreCount;
         submitInfo.pSignalSemaphores = signalSemaphores;
 
         if (vkQueueSubmit(graphicsQueue, 1, &submitInfo, inFlightFences[currentFrame]) != VK_SUCCESS) {
             throw std::runtime_error("failed to submit draw command buffer!");
         }
 
+        if (options.headless) {
+            currentFrame = (currentFrame + 1) % MAX_FRAMES_IN_FLIGHT;
+            return;
+        }
+
         VkPresentInfoKHR presentInfo{};
         presentInfo.sType = VK_STRUCTURE_TYPE_PRESENT_INFO_KHR;
 
@@ -1533,7 +5347,7 @@ private:
 
         presentInfo.pImageIndices = &imageIndex;
 
-        result = vkQueuePresentKHR(presentQueue, &presentInfo);
+        VkResult result = vkQueuePresentKHR(presentQueue, &presentInfo);
 
         if (result == VK_ERROR_OUT_OF_DATE_KHR || result == VK_SUBOPTIMAL_KHR || framebufferResized) {
             framebufferResized = false;
@@ -1545,7 +5359,19 @@ private:
         currentFrame = (currentFrame + 1) % MAX_FRAMES_IN_FLIGHT;
     }
 
-    VkShaderModule createShaderModule(const std::vector<char>& code) {
+    void printPipelineCreationTime(const char* name, std::chrono::high_resolution_clock::time_point start) {
+        auto end = std::chrono::high_resolution_clock::now();
+        float milliseconds = std::chrono::duration<float, std::chrono::milliseconds::period>(end - start).count();
+
+        std::cout << name << " pipeline created in " << milliseconds << " ms (" << (pipelineCacheWarm ? "warm" : "cold") << " pipeline cache)" << std::endl;
+    }
+
+    VkShaderModule createShaderModule(const MappedFile& code) {
+        // The mapping starts on a page boundary, so the SPIR-V words can be passed to the driver in place
+        if (code.size() % sizeof(uint32_t) != 0 || reinterpret_cast<uintptr_t>(code.data()) % alignof(uint32_t) != 0) {
+            throw std::runtime_error("failed to create shader module!");
+        }
+
         VkShaderModuleCreateInfo createInfo{};
         createInfo.sType = VK_STRUCTURE_TYPE_SHADER_MODULE_CREATE_INFO;
         createInfo.codeSize = code.size();
@@ -1559,6 +5385,15 @@ private:
         return shaderModule;
     }
 
+    // The format createSwapChain will pick, or the one the headless stand-in images use
+    VkFormat chooseColorAttachmentFormat() {
+        if (options.headless) {
+            return VK_FORMAT_B8G8R8A8_SRGB;
+        }
+
+        return chooseSwapSurfaceFormat(querySwapChainSupport(physicalDevice).formats).format;
+    }
+
     VkSurfaceFormatKHR chooseSwapSurfaceFormat(const std::vector<VkSurfaceFormatKHR>& availableFormats) {
         for (const auto& availableFormat : availableFormats) {
             if (availableFormat.format == VK_FORMAT_B8G8R8A8_SRGB && availableFormat.colorSpace == VK_COLOR_SPACE_SRGB_NONLINEAR_KHR) {
@@ -1627,8 +5462,8 @@ private:
 
         bool extensionsSupported = checkDeviceExtensionSupport(device);
 
-        bool swapChainAdequate = false;
-        if (extensionsSupported) {
+        bool swapChainAdequate = options.headless;
+        if (extensionsSupported && !options.headless) {
             SwapChainSupportDetails swapChainSupport = querySwapChainSupport(device);
             swapChainAdequate = !swapChainSupport.formats.empty() && !swapChainSupport.presentModes.empty();
         }
@@ -1636,7 +5471,77 @@ private:
         VkPhysicalDeviceFeatures supportedFeatures;
         vkGetPhysicalDeviceFeatures(device, &supportedFeatures);
 
-        return indices.isComplete() && extensionsSupported && swapChainAdequate  && supportedFeatures.samplerAnisotropy;
+        // The bindless fragment shader indexes the texture table with the material index
+        bool texturesIndexable = true;
+        if (extensionsSupported && options.bindless) {
+            VkPhysicalDeviceDescriptorIndexingFeaturesEXT indexingFeatures = queryDescriptorIndexingFeatures(device);
+            texturesIndexable = supportedFeatures.shaderSampledImageArrayDynamicIndexing && indexingFeatures.descriptorBindingPartiallyBound && indexingFeatures.descriptorBindingSampledImageUpdateAfterBind
+                && indexingFeatures.descriptorBindingUpdateUnusedWhilePending && indexingFeatures.shaderSampledImageArrayNonUniformIndexing;
+        }
+
+        bool renderingSupported = true;
+        if (extensionsSupported && options.dynamicRendering) {
+            renderingSupported = supportsDynamicRendering(device);
+        }
+
+        return indices.isComplete() && extensionsSupported && swapChainAdequate  && supportedFeatures.samplerAnisotropy && texturesIndexable && renderingSupported;
+    }
+
+    bool supportsDynamicRendering(VkPhysicalDevice device) {
+        auto getFeatures2 = (PFN_vkGetPhysicalDeviceFeatures2KHR) vkGetInstanceProcAddr(instance, "vkGetPhysicalDeviceFeatures2KHR");
+        if (getFeatures2 == nullptr) {
+            throw std::runtime_error("failed to load vkGetPhysicalDeviceFeatures2KHR!");
+        }
+
+        VkPhysicalDeviceSynchronization2FeaturesKHR synchronization2Features{};
+        synchronization2Features.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_SYNCHRONIZATION_2_FEATURES_KHR;
+
+        VkPhysicalDeviceDynamicRenderingFeaturesKHR dynamicRenderingFeatures{};
+        dynamicRenderingFeatures.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_DYNAMIC_RENDERING_FEATURES_KHR;
+        dynamicRenderingFeatures.pNext = &synchronization2Features;
+
+        VkPhysicalDeviceFeatures2KHR features{};
+        features.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_FEATURES_2_KHR;
+        features.pNext = &dynamicRenderingFeatures;
+        getFeatures2(device, &features);
+
+        return dynamicRenderingFeatures.dynamicRendering && synchronization2Features.synchronization2;
+    }
+
+    VkPhysicalDeviceDescriptorIndexingFeaturesEXT queryDescriptorIndexingFeatures(VkPhysicalDevice device) {
+        auto getFeatures2 = (PFN_vkGetPhysicalDeviceFeatures2KHR) vkGetInstanceProcAddr(instance, "vkGetPhysicalDeviceFeatures2KHR");
+        if (getFeatures2 == nullptr) {
+            throw std::runtime_error("failed to load vkGetPhysicalDeviceFeatures2KHR!");
+        }
+
+        VkPhysicalDeviceDescriptorIndexingFeaturesEXT indexingFeatures{};
+        indexingFeatures.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_DESCRIPTOR_INDEXING_FEATURES_EXT;
+
+        VkPhysicalDeviceFeatures2KHR features{};
+        features.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_FEATURES_2_KHR;
+        features.pNext = &indexingFeatures;
+        getFeatures2(device, &features);
+
+        indexingFeatures.pNext = nullptr;
+        return indexingFeatures;
+    }
+
+    VkPhysicalDeviceDescriptorIndexingPropertiesEXT queryDescriptorIndexingProperties(VkPhysicalDevice device) {
+        auto getProperties2 = (PFN_vkGetPhysicalDeviceProperties2KHR) vkGetInstanceProcAddr(instance, "vkGetPhysicalDeviceProperties2KHR");
+        if (getProperties2 == nullptr) {
+            throw std::runtime_error("failed to load vkGetPhysicalDeviceProperties2KHR!");
+        }
+
+        VkPhysicalDeviceDescriptorIndexingPropertiesEXT indexingProperties{};
+        indexingProperties.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_DESCRIPTOR_INDEXING_PROPERTIES_EXT;
+
+        VkPhysicalDeviceProperties2KHR properties{};
+        properties.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_PROPERTIES_2_KHR;
+        properties.pNext = &indexingProperties;
+        getProperties2(device, &properties);
+
+        indexingProperties.pNext = nullptr;
+        return indexingProperties;
     }
 
     bool checkDeviceExtensionSupport(VkPhysicalDevice device) {
@@ -1646,7 +5551,8 @@ private:
         std::vector<VkExtensionProperties> availableExtensions(extensionCount);
         vkEnumerateDeviceExtensionProperties(device, nullptr, &extensionCount, availableExtensions.data());
 
-        std::set<std::string> requiredExtensions(deviceExtensions.begin(), deviceExtensions.end());
+        auto extensions = getRequiredDeviceExtensions();
+        std::set<std::string> requiredExtensions(extensions.begin(), extensions.end());
 
         for (const auto& extension : availableExtensions) {
             requiredExtensions.erase(extension.extensionName);
@@ -1666,19 +5572,29 @@ private:
 
         int i = 0;
         for (const auto& queueFamily : queueFamilies) {
-            if (queueFamily.queueFlags & VK_QUEUE_GRAPHICS_BIT) {
-                indices.graphicsFamily = i;
-            }
+            if (!indices.isComplete()) {
+                if (queueFamily.queueFlags & VK_QUEUE_GRAPHICS_BIT) {
+                    indices.graphicsFamily = i;
+                }
 
-            VkBool32 presentSupport = false;
-            vkGetPhysicalDeviceSurfaceSupportKHR(device, i, surface, &presentSupport);
+                VkBool32 presentSupport = false;
+                if (options.headless) {
+                    // Nothing is presented, the graphics family stands in for the present family
+                    presentSupport = (queueFamily.queueFlags & VK_QUEUE_GRAPHICS_BIT) != 0;
+                } else {
+                    vkGetPhysicalDeviceSurfaceSupportKHR(device, i, surface, &presentSupport);
+                }
 
-            if (presentSupport) {
-                indices.presentFamily = i;
+                if (presentSupport) {
+                    indices.presentFamily = i;
+                }
             }
 
-            if (indices.isComplete()) {
-                break;
+            // Prefer a family that can only do transfers, it usually maps to the DMA engines
+            if ((queueFamily.queueFlags & VK_QUEUE_TRANSFER_BIT) && !(queueFamily.queueFlags & (VK_QUEUE_GRAPHICS_BIT | VK_QUEUE_COMPUTE_BIT))) {
+                if (!indices.transferFamily.has_value()) {
+                    indices.transferFamily = i;
+                }
             }
 
             i++;
@@ -1688,16 +5604,55 @@ private:
     }
 
     std::vector<const char*> getRequiredExtensions() {
-        uint32_t glfwExtensionCount = 0;
-        const char** glfwExtensions;
-        glfwExtensions = glfwGetRequiredInstanceExtensions(&glfwExtensionCount);
+        std::vector<const char*> extensions;
 
-        std::vector<const char*> extensions(glfwExtensions, glfwExtensions + glfwExtensionCount);
+        if (!options.headless) {
+            uint32_t glfwExtensionCount = 0;
+            const char** glfwExtensions;
+            glfwExtensions = glfwGetRequiredInstanceExtensions(&glfwExtensionCount);
+
+            extensions.assign(glfwExtensions, glfwExtensions + glfwExtensionCount);
+        }
 
         if (enableValidationLayers) {
             extensions.push_back(VK_EXT_DEBUG_UTILS_EXTENSION_NAME);
         }
 
+        // Needed to query descriptor indexing and dynamic rendering support on a Vulkan 1.0 instance
+        if (options.bindless || options.dynamicRendering) {
+            extensions.push_back(VK_KHR_GET_PHYSICAL_DEVICE_PROPERTIES_2_EXTENSION_NAME);
+        }
+
+        return extensions;
+    }
+
+    std::vector<const char*> getRequiredDeviceExtensions() {
+        std::vector<const char*> extensions;
+
+        // Headless mode renders into plain images and has no use for a swap chain
+        if (!options.headless) {
+            extensions = deviceExtensions;
+        }
+
+        if (options.gpuDriven) {
+            extensions.push_back(VK_KHR_DRAW_INDIRECT_COUNT_EXTENSION_NAME);
+        }
+
+        if (options.bindless) {
+            extensions.push_back(VK_EXT_DESCRIPTOR_INDEXING_EXTENSION_NAME);
+            extensions.push_back(VK_KHR_MAINTENANCE_3_EXTENSION_NAME);
+        }
+
+        // Dynamic rendering depends on depth_stencil_resolve, which pulls in create_renderpass2 and its dependencies
+        if (options.dynamicRendering) {
+            extensions.push_back(VK_KHR_DYNAMIC_RENDERING_EXTENSION_NAME);
+            extensions.push_back(VK_KHR_SYNCHRONIZATION_2_EXTENSION_NAME);
+            extensions.push_back(VK_KHR_DEPTH_STENCIL_RESOLVE_EXTENSION_NAME);
+            extensions.push_back(VK_KHR_CREATE_RENDERPASS_2_EXTENSION_NAME);
+            extensions.push_back(VK_KHR_MULTIVIEW_EXTENSION_NAME);
+            extensions.push_back(VK_KHR_MAINTENANCE_2_EXTENSION_NAME);
+        }
+
         return extensions;
     }
 
@@ -1726,22 +5681,14 @@ private:
         return true;
     }
 
-    static std::vector<char> readFile(const std::string& filename) {
-        std::ifstream file(filename, std::ios::ate | std::ios::binary);
+    static MappedFile readFile(const std::string& filename) {
+        MappedFile file;
 
-        if (!file.is_open()) {
+        if (!file.open(filename)) {
             throw std::runtime_error("failed to open file!");
         }
 
-        size_t fileSize = (size_t) file.tellg();
-        std::vector<char> buffer(fileSize);
-
-        file.seekg(0);
-        file.read(buffer.data(), fileSize);
-
-        file.close();
-
-        return buffer;
+        return file;
     }
 
     static VKAPI_ATTR VkBool32 VKAPI_CALL debugCallback(VkDebugUtilsMessageSeverityFlagBitsEXT messageSeverity, VkDebugUtilsMessageTypeFlagsEXT messageType, const VkDebugUtilsMessengerCallbackDataEXT* pCallbackData, void* pUserData) {
@@ -1751,11 +5698,167 @@ private:
     }
 };
 
-int main() {
+// The deduplication the tutorial's loadModel does, kept as the reference buildObjVertices and
+// loadObjParallel must match exactly. Faces without texture coordinates get (0, 0).
+void buildObjVerticesWithMap(const tinyobj::attrib_t& attrib, const std::vector<tinyobj::shape_t>& shapes, std::vector<Vertex>& vertices, std::vector<uint32_t>& indices) {
+    std::unordered_map<Vertex, uint32_t> uniqueVertices{};
+
+    for (const auto& shape : shapes) {
+        for (const auto& index : shape.mesh.indices) {
+            Vertex vertex{};
+            vertex.pos = {attrib.vertices[3 * index.vertex_index + 0], attrib.vertices[3 * index.vertex_index + 1], attrib.vertices[3 * index.vertex_index + 2]};
+            if (index.texcoord_index >= 0) {
+                vertex.texCoord = {attrib.texcoords[2 * index.texcoord_index + 0], 1.0f - attrib.texcoords[2 * index.texcoord_index + 1]};
+            }
+            vertex.color = {1.0f, 1.0f, 1.0f};
+
+            if (uniqueVertices.count(vertex) == 0) {
+                uniqueVertices[vertex] = static_cast<uint32_t>(vertices.size());
+                vertices.push_back(vertex);
+            }
+
+            indices.push_back(uniqueVertices[vertex]);
+        }
+    }
+}
+
+// Deduplicates a synthetic OBJ mesh with the original std::unordered_map<Vertex> approach and
+// with buildObjVertices. The mesh is a flat, axis aligned grid, the worst case for the XOR based
+// std::hash<Vertex>, indexed the way OBJ files are. Like many exporters write them, every texture
+// coordinate is stored twice, and the two triangles of a quad reference different copies.
+void runDedupBenchmark(uint32_t triangleCount) {
+    uint32_t gridSize = std::max(1u, static_cast<uint32_t>(std::ceil(std::sqrt(triangleCount / 2.0))));
+    uint32_t rowLength = gridSize + 1;
+
+    tinyobj::attrib_t attrib;
+    for (uint32_t y = 0; y < rowLength; y++) {
+        for (uint32_t x = 0; x < rowLength; x++) {
+            attrib.vertices.insert(attrib.vertices.end(), {static_cast<float>(x), static_cast<float>(y), 0.0f});
+            attrib.texcoords.insert(attrib.texcoords.end(), {static_cast<float>(x) / gridSize, static_cast<float>(y) / gridSize});
+        }
+    }
+    std::vector<float> texcoordCopy = attrib.texcoords;
+    attrib.texcoords.insert(attrib.texcoords.end(), texcoordCopy.begin(), texcoordCopy.end());
+    int copyOffset = static_cast<int>(rowLength * rowLength);
+
+    std::vector<tinyobj::shape_t> shapes(1);
+    auto& objIndices = shapes[0].mesh.indices;
+    objIndices.reserve(size_t(gridSize) * gridSize * 6);
+    for (uint32_t y = 0; y < gridSize; y++) {
+        for (uint32_t x = 0; x < gridSize; x++) {
+            int corner = static_cast<int>(y * rowLength + x);
+            int quadCorners[] = {0, 1, static_cast<int>(rowLength) + 1, 0, static_cast<int>(rowLength) + 1, static_cast<int>(rowLength)};
+            for (int i = 0; i < 6; i++) {
+                int offset = quadCorners[i];
+                objIndices.push_back({corner + offset, -1, corner + offset + (i < 3 ? 0 : copyOffset)});
+            }
+        }
+    }
+
+    auto start = std::chrono::high_resolution_clock::now();
+
+    std::vector<Vertex> hashedVertices;
+    std::vector<uint32_t> hashedIndices;
+    buildObjVerticesWithMap(attrib, shapes, hashedVertices, hashedIndices);
+
+    auto middle = std::chrono::high_resolution_clock::now();
+
+    std::vector<Vertex> tableVertices;
+    std::vector<uint32_t> tableIndices;
+    buildObjVertices(attrib, shapes, tableVertices, tableIndices);
+
+    auto end = std::chrono::high_resolution_clock::now();
+
+    if (hashedVertices != tableVertices || hashedIndices != tableIndices) {
+        throw std::runtime_error("vertex deduplication results differ!");
+    }
+
+    double hashedMilliseconds = std::chrono::duration<double, std::chrono::milliseconds::period>(middle - start).count();
+    double tableMilliseconds = std::chrono::duration<double, std::chrono::milliseconds::period>(end - middle).count();
+
+    std::cout << "dedup benchmark (" << objIndices.size() / 3 << " triangles, " << tableVertices.size() << " vertices): unordered_map "
+              << hashedMilliseconds << " ms, index table " << tableMilliseconds << " ms (" << hashedMilliseconds / tableMilliseconds << "x)" << std::endl;
+}
+
+// Loads a model with tinyobj and buildObjVertices, then with loadObjParallel on 1 to N threads,
+// checking that every run gives the same vertices and indices as the original std::unordered_map<Vertex>
+// deduplication of the tinyobj data
+void runObjBenchmark(const std::string& path) {
+    using Milliseconds = std::chrono::duration<double, std::chrono::milliseconds::period>;
+
+    auto start = std::chrono::high_resolution_clock::now();
+
+    tinyobj::attrib_t attrib;
+    std::vector<tinyobj::shape_t> shapes;
+    std::vector<tinyobj::material_t> materials;
+    std::string err;
+
+    if (!tinyobj::LoadObj(&attrib, &shapes, &materials, &err, path.c_str())) {
+        throw std::runtime_error(err);
+    }
+
+    std::vector<Vertex> referenceVertices;
+    std::vector<uint32_t> referenceIndices;
+    buildObjVertices(attrib, shapes, referenceVertices, referenceIndices);
+
+    double referenceMilliseconds = Milliseconds(std::chrono::high_resolution_clock::now() - start).count();
+
+    std::vector<Vertex> baselineVertices;
+    std::vector<uint32_t> baselineIndices;
+    buildObjVerticesWithMap(attrib, shapes, baselineVertices, baselineIndices);
+
+    if (referenceVertices != baselineVertices || referenceIndices != baselineIndices) {
+        throw std::runtime_error("buildObjVertices differs from std::unordered_map<Vertex> deduplication!");
+    }
+
+    std::cout << "obj benchmark (" << path << ", " << referenceIndices.size() / 3 << " triangles, " << referenceVertices.size() << " vertices): tinyobj "
+              << referenceMilliseconds << " ms" << std::endl;
+
+    uint32_t maxThreads = std::max(1u, std::thread::hardware_concurrency());
+    double singleThreadMilliseconds = 0.0;
+
+    for (uint32_t threadCount = 1; ; threadCount = std::min(threadCount * 2, maxThreads)) {
+        std::vector<Vertex> vertices;
+        std::vector<uint32_t> indices;
+
+        start = std::chrono::high_resolution_clock::now();
+        loadObjParallel(path, threadCount, vertices, indices);
+        double milliseconds = Milliseconds(std::chrono::high_resolution_clock::now() - start).count();
+
+        if (vertices != referenceVertices || indices != referenceIndices) {
+            throw std::runtime_error("parallel OBJ loading differs from tinyobj with " + std::to_string(threadCount) + " threads!");
+        }
+
+        if (threadCount == 1) {
+            singleThreadMilliseconds = milliseconds;
+        }
+
+        std::cout << "  " << threadCount << " threads: " << milliseconds << " ms (" << singleThreadMilliseconds / milliseconds << "x over 1 thread, "
+                  << referenceMilliseconds / milliseconds << "x over tinyobj)" << std::endl;
+
+        if (threadCount == maxThreads) {
+            break;
+        }
+    }
+}
+
+int main(int argc, char** argv) {
     HelloTriangleApplication app;
 
     try {
-        app.run();
+        AppOptions options = parseArguments(argc, argv);
+
+        if (options.dedupBenchmarkTriangles > 0) {
+            runDedupBenchmark(options.dedupBenchmarkTriangles);
+            return EXIT_SUCCESS;
+        }
+
+        if (!options.objBenchmarkPath.empty()) {
+            runObjBenchmark(options.objBenchmarkPath);
+            return EXIT_SUCCESS;
+        }
+
+        app.run(options);
     } catch (const std::exception& e) {
         std::cerr << e.what() << std::endl;
         return EXIT_FAILURE;
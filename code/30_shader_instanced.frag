@@ -0,0 +1,27 @@
+#version 450
+
+#ifdef BINDLESS
+#extension GL_EXT_nonuniform_qualifier : require
+#endif
+
+// One entry unless the app runs with --bindless, which makes this a table of every loaded texture
+layout(constant_id = 1) const uint TEXTURE_COUNT = 1;
+
+layout(set = 1, binding = 0) uniform sampler2D textures[TEXTURE_COUNT];
+
+layout(location = 0) in vec3 fragColor;
+layout(location = 1) in vec2 fragTexCoord;
+// Instances of one indirect draw can use different materials, so the index may differ between
+// invocations and has to be marked nonuniform. Only the BINDLESS build reads it, the default
+// table has nothing else to pick from.
+layout(location = 2) flat in uint fragMaterialIndex;
+
+layout(location = 0) out vec4 outColor;
+
+void main() {
+#ifdef BINDLESS
+    outColor = texture(textures[nonuniformEXT(fragMaterialIndex)], fragTexCoord);
+#else
+    outColor = texture(textures[0], fragTexCoord);
+#endif
+}
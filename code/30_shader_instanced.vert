@@ -0,0 +1,53 @@
+#version 450
+
+layout(constant_id = 0) const bool GPU_DRIVEN = false;
+
+layout(binding = 0) uniform UniformBufferObject {
+    mat4 model;
+    mat4 view;
+    mat4 proj;
+    vec4 positionOffset;
+    vec4 positionScale;
+} ubo;
+
+// Matches InstanceData
+struct Instance {
+    mat4 transform;
+    uint materialIndex;
+};
+
+layout(std430, binding = 2) readonly buffer Instances {
+    Instance instances[];
+};
+
+layout(std430, binding = 3) readonly buffer VisibleInstances {
+    uint visibleInstances[];
+};
+
+layout(push_constant) uniform InstanceConstants {
+    mat4 model;
+    uint materialIndex;
+} instance;
+
+// Either full precision or normalized to the mesh bounding box, see positionOffset and positionScale.
+// The vertex color is always white, so packed vertices don't store it and it isn't read here
+layout(location = 0) in vec3 inPosition;
+layout(location = 2) in vec2 inTexCoord;
+
+layout(location = 0) out vec3 fragColor;
+layout(location = 1) out vec2 fragTexCoord;
+layout(location = 2) flat out uint fragMaterialIndex;
+
+void main() {
+    // In gpu driven mode every instance of the indirect draw is one entry of the visible instance list
+    // and brings its own material, so a single draw can cover instances with different textures
+    uint instanceIndex = GPU_DRIVEN ? visibleInstances[gl_InstanceIndex] : 0;
+    mat4 instanceModel = GPU_DRIVEN ? instances[instanceIndex].transform : instance.model;
+
+    vec3 position = ubo.positionOffset.xyz + inPosition * ubo.positionScale.xyz;
+
+    gl_Position = ubo.proj * ubo.view * instanceModel * ubo.model * vec4(position, 1.0);
+    fragColor = vec3(1.0);
+    fragTexCoord = inTexCoord;
+    fragMaterialIndex = GPU_DRIVEN ? instances[instanceIndex].materialIndex : instance.materialIndex;
+}
@@ -7,9 +7,11 @@
 #define GLM_FORCE_RADIANS
 #include <glm/glm.hpp>
 #include <glm/gtc/matrix_transform.hpp>
+#include <glm/gtc/packing.hpp>
 
 #include <iostream>
 #include <fstream>
+#include <filesystem>
 #include <stdexcept>
 #include <algorithm>
 #include <chrono>
@@ -23,12 +25,38 @@
 #include <set>
 #include <random>
 
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
 const uint32_t WIDTH = 800;
 const uint32_t HEIGHT = 600;
 
-const uint32_t PARTICLE_COUNT = 8192;
+// Can be changed at runtime with --particles
+const uint32_t DEFAULT_PARTICLE_COUNT = 8192;
+// Must match local_size_x in the compute shader
+const uint32_t PARTICLE_WORKGROUP_SIZE = 256;
+// Initial particle data is generated and uploaded in chunks of this many particles
+const uint32_t PARTICLE_UPLOAD_CHUNK_SIZE = 1 << 20;
+
+const std::string PIPELINE_CACHE_PATH = "pipeline_cache.bin";
 
-const int MAX_FRAMES_IN_FLIGHT = 2;
+// Frames in flight can be chosen at runtime with --frames-in-flight, up to this limit
+const uint32_t DEFAULT_FRAMES_IN_FLIGHT = 2;
+const uint32_t MAX_FRAMES_IN_FLIGHT = 4;
+
+const uint32_t DEFAULT_BENCHMARK_FRAMES = 1000;
+// Headless runs advance the simulation by a fixed step so every run computes the same frames
+const float HEADLESS_FRAME_TIME = 1000.0f / 60.0f;
+// and start from the same particles
+const unsigned HEADLESS_RANDOM_SEED = 1;
 
 const std::vector<const char*> validationLayers = {
     "VK_LAYER_KHRONOS_validation"
@@ -60,9 +88,223 @@ void DestroyDebugUtilsMessengerEXT(VkInstance instance, VkDebugUtilsMessengerEXT
     }
 }
 
+uint64_t hashBytes(const void* data, size_t size, uint64_t hash = 14695981039346656037ull) {
+    // FNV-1a
+    const unsigned char* bytes = static_cast<const unsigned char*>(data);
+    for (size_t i = 0; i < size; i++) {
+        hash ^= bytes[i];
+        hash *= 1099511628211ull;
+    }
+    return hash;
+}
+
+// Written in front of the driver's pipeline cache data so truncated or corrupted files are detected
+struct PipelineCacheFileHeader {
+    uint32_t magic;
+    uint32_t dataSize;
+    uint64_t dataHash;
+};
+
+const uint32_t PIPELINE_CACHE_MAGIC = 0x43505456; // "VTPC"
+
+// Read-only memory mapping of a whole file, unmapped when the object is destroyed
+class MappedFile {
+public:
+    MappedFile() = default;
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+
+    MappedFile(MappedFile&& other) noexcept {
+        *this = std::move(other);
+    }
+
+    MappedFile& operator=(MappedFile&& other) noexcept {
+        if (this != &other) {
+            close();
+            std::swap(mappedData, other.mappedData);
+            std::swap(mappedSize, other.mappedSize);
+#ifdef _WIN32
+            std::swap(fileHandle, other.fileHandle);
+            std::swap(mappingHandle, other.mappingHandle);
+#endif
+        }
+        return *this;
+    }
+
+    ~MappedFile() {
+        close();
+    }
+
+    bool open(const std::string& path) {
+        close();
+
+#ifdef _WIN32
+        fileHandle = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+        if (fileHandle == INVALID_HANDLE_VALUE) {
+            return false;
+        }
+
+        LARGE_INTEGER fileSize;
+        if (!GetFileSizeEx(fileHandle, &fileSize) || fileSize.QuadPart == 0) {
+            close();
+            return false;
+        }
+
+        mappingHandle = CreateFileMappingA(fileHandle, nullptr, PAGE_READONLY, 0, 0, nullptr);
+        if (mappingHandle == nullptr) {
+            close();
+            return false;
+        }
+
+        mappedData = MapViewOfFile(mappingHandle, FILE_MAP_READ, 0, 0, 0);
+        if (mappedData == nullptr) {
+            close();
+            return false;
+        }
+
+        mappedSize = static_cast<size_t>(fileSize.QuadPart);
+#else
+        int fd = ::open(path.c_str(), O_RDONLY);
+        if (fd < 0) {
+            return false;
+        }
+
+        struct stat fileInfo;
+        if (fstat(fd, &fileInfo) != 0 || fileInfo.st_size == 0) {
+            ::close(fd);
+            return false;
+        }
+
+        void* data = mmap(nullptr, static_cast<size_t>(fileInfo.st_size), PROT_READ, MAP_PRIVATE, fd, 0);
+        ::close(fd);
+
+        if (data == MAP_FAILED) {
+            return false;
+        }
+
+        mappedData = data;
+        mappedSize = static_cast<size_t>(fileInfo.st_size);
+#endif
+
+        return true;
+    }
+
+    void close() {
+#ifdef _WIN32
+        if (mappedData != nullptr) {
+            UnmapViewOfFile(mappedData);
+        }
+        if (mappingHandle != nullptr) {
+            CloseHandle(mappingHandle);
+        }
+        if (fileHandle != INVALID_HANDLE_VALUE) {
+            CloseHandle(fileHandle);
+        }
+        mappingHandle = nullptr;
+        fileHandle = INVALID_HANDLE_VALUE;
+#else
+        if (mappedData != nullptr) {
+            munmap(mappedData, mappedSize);
+        }
+#endif
+
+        mappedData = nullptr;
+        mappedSize = 0;
+    }
+
+    const char* data() const {
+        return static_cast<const char*>(mappedData);
+    }
+
+    size_t size() const {
+        return mappedSize;
+    }
+
+private:
+    void* mappedData = nullptr;
+    size_t mappedSize = 0;
+
+#ifdef _WIN32
+    HANDLE fileHandle = INVALID_HANDLE_VALUE;
+    HANDLE mappingHandle = nullptr;
+#endif
+};
+
+struct AppOptions {
+    bool headless = false;
+    uint32_t benchmarkFrames = DEFAULT_BENCHMARK_FRAMES;
+    uint32_t framesInFlight = DEFAULT_FRAMES_IN_FLIGHT;
+    bool asyncCompute = false;
+    uint32_t particleCount = DEFAULT_PARTICLE_COUNT;
+    bool profile = false; // print the gpu times and simulation throughput every second, always done by the benchmark
+};
+
+// Option values are plain decimal counts, anything else is reported along with the usage line
+uint32_t parseCountArgument(const std::string& option, const std::string& value, const std::string& usage) {
+    size_t length = 0;
+    unsigned long count = 0;
+
+    try {
+        if (!value.empty() && value[0] >= '0' && value[0] <= '9') {
+            count = std::stoul(value, &length);
+        }
+    } catch (const std::out_of_range&) {
+        length = 0;
+    }
+
+    if (length == 0 || length != value.size() || count > std::numeric_limits<uint32_t>::max()) {
+        throw std::runtime_error(option + " expects a count, got " + value + "\n" + usage);
+    }
+
+    return static_cast<uint32_t>(count);
+}
+
+AppOptions parseArguments(int argc, char** argv) {
+    AppOptions options;
+    const std::string usage = std::string("usage: ") + argv[0] + " [--headless] [--frames N] [--frames-in-flight N] [--async-compute] [--particles N] [--profile]";
+    bool framesGiven = false;
+
+    for (int i = 1; i < argc; i++) {
+        std::string argument = argv[i];
+
+        if (argument == "--headless") {
+            options.headless = true;
+        } else if (argument == "--frames" && i + 1 < argc) {
+            options.benchmarkFrames = parseCountArgument(argument, argv[++i], usage);
+            framesGiven = true;
+        } else if (argument == "--frames-in-flight" && i + 1 < argc) {
+            options.framesInFlight = parseCountArgument(argument, argv[++i], usage);
+        } else if (argument == "--async-compute") {
+            options.asyncCompute = true;
+        } else if (argument == "--particles" && i + 1 < argc) {
+            options.particleCount = parseCountArgument(argument, argv[++i], usage);
+        } else if (argument == "--profile") {
+            options.profile = true;
+        } else {
+            throw std::runtime_error("unknown argument: " + argument + "\n" + usage);
+        }
+    }
+
+    if (framesGiven && !options.headless) {
+        throw std::runtime_error("--frames only applies to --headless runs\n" + usage);
+    }
+
+    if (options.particleCount == 0) {
+        throw std::runtime_error("--particles must be at least 1");
+    }
+
+    if (options.framesInFlight < 1 || options.framesInFlight > MAX_FRAMES_IN_FLIGHT) {
+        throw std::runtime_error("--frames-in-flight must be between 1 and " + std::to_string(MAX_FRAMES_IN_FLIGHT));
+    }
+
+    return options;
+}
+
 struct QueueFamilyIndices {
     std::optional<uint32_t> graphicsAndComputeFamily;
     std::optional<uint32_t> presentFamily;
+    // A compute family without graphics support, usually backed by separate hardware queues
+    std::optional<uint32_t> asyncComputeFamily;
 
     bool isComplete() {
         return graphicsAndComputeFamily.has_value() && presentFamily.has_value();
@@ -79,18 +321,31 @@ struct UniformBufferObject {
     float deltaTime = 1.0f;
 };
 
+struct ComputePushConstants {
+    uint32_t particleCount;
+};
+
+// Particles are stored as separate streams rather than an array of structs, so every pass
+// only touches what it needs: the simulation reads positions and velocities and writes
+// positions, drawing reads positions and colors. Colors never change and are packed to
+// 8 bits per channel.
 struct Particle {
-    glm::vec2 position;
-    glm::vec2 velocity;
-    glm::vec4 color;
+    using Position = glm::vec2;
+    using Velocity = glm::vec2;
+    using Color = uint32_t; // VK_FORMAT_R8G8B8A8_UNORM
 
-    static VkVertexInputBindingDescription getBindingDescription() {
-        VkVertexInputBindingDescription bindingDescription{};
-        bindingDescription.binding = 0;
-        bindingDescription.stride = sizeof(Particle);
-        bindingDescription.inputRate = VK_VERTEX_INPUT_RATE_VERTEX;
+    static std::array<VkVertexInputBindingDescription, 2> getBindingDescriptions() {
+        std::array<VkVertexInputBindingDescription, 2> bindingDescriptions{};
 
-        return bindingDescription;
+        bindingDescriptions[0].binding = 0;
+        bindingDescriptions[0].stride = sizeof(Position);
+        bindingDescriptions[0].inputRate = VK_VERTEX_INPUT_RATE_VERTEX;
+
+        bindingDescriptions[1].binding = 1;
+        bindingDescriptions[1].stride = sizeof(Color);
+        bindingDescriptions[1].inputRate = VK_VERTEX_INPUT_RATE_VERTEX;
+
+        return bindingDescriptions;
     }
 
     static std::array<VkVertexInputAttributeDescription, 2> getAttributeDescriptions() {
@@ -99,20 +354,492 @@ struct Particle {
         attributeDescriptions[0].binding = 0;
         attributeDescriptions[0].location = 0;
         attributeDescriptions[0].format = VK_FORMAT_R32G32_SFLOAT;
-        attributeDescriptions[0].offset = offsetof(Particle, position);
+        attributeDescriptions[0].offset = 0;
 
-        attributeDescriptions[1].binding = 0;
+        attributeDescriptions[1].binding = 1;
         attributeDescriptions[1].location = 1;
-        attributeDescriptions[1].format = VK_FORMAT_R32G32B32A32_SFLOAT;
-        attributeDescriptions[1].offset = offsetof(Particle, color);
+        attributeDescriptions[1].format = VK_FORMAT_R8G8B8A8_UNORM;
+        attributeDescriptions[1].offset = 0;
 
         return attributeDescriptions;
     }
 };
 
+// Fixed size window of the most recent samples
+class RollingStats {
+public:
+    static const size_t WINDOW_SIZE = 256;
+
+    void add(double sample) {
+        if (samples.size() < WINDOW_SIZE) {
+            samples.push_back(sample);
+        } else {
+            samples[next] = sample;
+        }
+        next = (next + 1) % WINDOW_SIZE;
+    }
+
+    bool empty() const {
+        return samples.empty();
+    }
+
+    double min() const {
+        return *std::min_element(samples.begin(), samples.end());
+    }
+
+    double avg() const {
+        double sum = 0.0;
+        for (double sample : samples) {
+            sum += sample;
+        }
+        return sum / samples.size();
+    }
+
+    double percentile(double p) const {
+        std::vector<double> sorted = samples;
+        size_t rank = static_cast<size_t>(std::ceil(p * sorted.size())) - 1;
+        std::nth_element(sorted.begin(), sorted.begin() + rank, sorted.end());
+        return sorted[rank];
+    }
+
+private:
+    std::vector<double> samples;
+    size_t next = 0;
+};
+
+const VkQueryPipelineStatisticFlags PROFILER_PIPELINE_STATISTICS =
+    VK_QUERY_PIPELINE_STATISTIC_INPUT_ASSEMBLY_VERTICES_BIT |
+    VK_QUERY_PIPELINE_STATISTIC_INPUT_ASSEMBLY_PRIMITIVES_BIT |
+    VK_QUERY_PIPELINE_STATISTIC_VERTEX_SHADER_INVOCATIONS_BIT |
+    VK_QUERY_PIPELINE_STATISTIC_CLIPPING_PRIMITIVES_BIT |
+    VK_QUERY_PIPELINE_STATISTIC_FRAGMENT_SHADER_INVOCATIONS_BIT |
+    VK_QUERY_PIPELINE_STATISTIC_COMPUTE_SHADER_INVOCATIONS_BIT;
+
+const size_t PROFILER_STATISTIC_COUNT = 6;
+
+// In the order the results are written, which follows the bit order above
+const std::array<const char*, PROFILER_STATISTIC_COUNT> PROFILER_STATISTIC_NAMES = {
+    "vertices", "primitives", "vertex invocations", "clipped primitives", "fragment invocations", "compute invocations"
+};
+
+struct GpuProfilerScopeInfo {
+    std::string name;
+    uint32_t queueFamily; // family of the queue the scope's command buffers are submitted to
+};
+
+// Measures the GPU time and pipeline statistics of named scopes in command buffers.
+// Each frame in flight has its own query pools. The results of a scope are read back
+// right before the scope is recorded again for the same frame, at which point the
+// frame has been waited on, so vkGetQueryPoolResults never has to block.
+class GpuProfiler {
+public:
+    void init(VkPhysicalDevice physicalDevice, VkDevice device, uint32_t framesInFlight, const std::vector<GpuProfilerScopeInfo>& scopeInfos) {
+        this->device = device;
+
+        VkPhysicalDeviceProperties properties;
+        vkGetPhysicalDeviceProperties(physicalDevice, &properties);
+        timestampPeriod = properties.limits.timestampPeriod;
+
+        uint32_t queueFamilyCount = 0;
+        vkGetPhysicalDeviceQueueFamilyProperties(physicalDevice, &queueFamilyCount, nullptr);
+        std::vector<VkQueueFamilyProperties> queueFamilies(queueFamilyCount);
+        vkGetPhysicalDeviceQueueFamilyProperties(physicalDevice, &queueFamilyCount, queueFamilies.data());
+
+        VkPhysicalDeviceFeatures supportedFeatures;
+        vkGetPhysicalDeviceFeatures(physicalDevice, &supportedFeatures);
+        statisticsSupported = supportedFeatures.pipelineStatisticsQuery;
+
+        for (const auto& info : scopeInfos) {
+            const VkQueueFamilyProperties& family = queueFamilies[info.queueFamily];
+
+            Scope scope{info.name};
+            scope.timestampMask = family.timestampValidBits >= 64 ? ~0ull : (1ull << family.timestampValidBits) - 1;
+            scope.timestampsEnabled = family.timestampValidBits > 0;
+            // The statistics include graphics counters, which compute-only queues can't query
+            scope.statisticsEnabled = statisticsSupported && (family.queueFlags & VK_QUEUE_GRAPHICS_BIT);
+
+            if (!scope.timestampsEnabled) {
+                std::cerr << "gpu profiler: timestamps are not supported on the queue family of " << info.name << std::endl;
+            }
+
+            timestampsSupported = timestampsSupported || scope.timestampsEnabled;
+            scopes.push_back(scope);
+        }
+
+        uint32_t scopeCount = static_cast<uint32_t>(scopes.size());
+
+        frames.resize(framesInFlight);
+        for (auto& frame : frames) {
+            frame.pending.resize(scopeCount, false);
+            frame.intervals.resize(scopeCount);
+
+            VkQueryPoolCreateInfo poolInfo{};
+            poolInfo.sType = VK_STRUCTURE_TYPE_QUERY_POOL_CREATE_INFO;
+
+            if (timestampsSupported) {
+                poolInfo.queryType = VK_QUERY_TYPE_TIMESTAMP;
+                poolInfo.queryCount = scopeCount * 2;
+
+                if (vkCreateQueryPool(device, &poolInfo, nullptr, &frame.timestampPool) != VK_SUCCESS) {
+                    throw std::runtime_error("failed to create timestamp query pool!");
+                }
+            }
+
+            if (statisticsSupported) {
+                poolInfo.queryType = VK_QUERY_TYPE_PIPELINE_STATISTICS;
+                poolInfo.queryCount = scopeCount;
+                poolInfo.pipelineStatistics = PROFILER_PIPELINE_STATISTICS;
+
+                if (vkCreateQueryPool(device, &poolInfo, nullptr, &frame.statisticsPool) != VK_SUCCESS) {
+                    throw std::runtime_error("failed to create pipeline statistics query pool!");
+                }
+            }
+        }
+
+        lastReportTime = std::chrono::steady_clock::now();
+    }
+
+    void destroy() {
+        for (auto& frame : frames) {
+            if (frame.timestampPool != VK_NULL_HANDLE) {
+                vkDestroyQueryPool(device, frame.timestampPool, nullptr);
+            }
+            if (frame.statisticsPool != VK_NULL_HANDLE) {
+                vkDestroyQueryPool(device, frame.statisticsPool, nullptr);
+            }
+        }
+        frames.clear();
+    }
+
+    // Reports how long two scopes of the same frame ran at the same time, e.g. work on two
+    // different queues. Only meaningful if the queues share a timestamp clock, which the
+    // spec doesn't promise but desktop implementations provide.
+    void trackOverlap(uint32_t scopeA, uint32_t scopeB) {
+        overlaps.push_back(Overlap{scopeA, scopeB});
+    }
+
+    // Must be recorded outside of a render pass
+    void beginScope(VkCommandBuffer commandBuffer, uint32_t frameIndex, uint32_t scope) {
+        FrameQueries& frame = frames[frameIndex];
+
+        if (frame.pending[scope]) {
+            collect(frame, scope);
+        }
+
+        if (scopes[scope].timestampsEnabled) {
+            vkCmdResetQueryPool(commandBuffer, frame.timestampPool, scope * 2, 2);
+            vkCmdWriteTimestamp(commandBuffer, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, frame.timestampPool, scope * 2);
+        }
+
+        if (scopes[scope].statisticsEnabled) {
+            vkCmdResetQueryPool(commandBuffer, frame.statisticsPool, scope, 1);
+            vkCmdBeginQuery(commandBuffer, frame.statisticsPool, scope, 0);
+        }
+    }
+
+    void endScope(VkCommandBuffer commandBuffer, uint32_t frameIndex, uint32_t scope) {
+        FrameQueries& frame = frames[frameIndex];
+
+        if (scopes[scope].statisticsEnabled) {
+            vkCmdEndQuery(commandBuffer, frame.statisticsPool, scope);
+        }
+
+        if (scopes[scope].timestampsEnabled) {
+            vkCmdWriteTimestamp(commandBuffer, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, frame.timestampPool, scope * 2 + 1);
+        }
+
+        frame.pending[scope] = true;
+    }
+
+    const RollingStats& getGpuTime(uint32_t scope) const {
+        return scopes[scope].gpuTime;
+    }
+
+    // Returns whether a report was printed
+    bool printReport(double intervalSeconds) {
+        auto now = std::chrono::steady_clock::now();
+        if (std::chrono::duration<double>(now - lastReportTime).count() < intervalSeconds) {
+            return false;
+        }
+        lastReportTime = now;
+
+        for (const auto& scope : scopes) {
+            if (scope.gpuTime.empty() && !scope.hasStatistics) {
+                continue;
+            }
+
+            std::cout << "gpu " << scope.name << ":";
+            if (!scope.gpuTime.empty()) {
+                std::cout << " " << scope.gpuTime.min() << " ms min, " << scope.gpuTime.avg() << " ms avg, "
+                          << scope.gpuTime.percentile(0.99) << " ms p99";
+            }
+            for (size_t i = 0; i < PROFILER_STATISTIC_COUNT; i++) {
+                if (scope.statistics[i] != 0) {
+                    std::cout << ", " << scope.statistics[i] << " " << PROFILER_STATISTIC_NAMES[i];
+                }
+            }
+            std::cout << std::endl;
+        }
+
+        for (const auto& overlap : overlaps) {
+            if (overlap.time.empty()) {
+                continue;
+            }
+
+            const Scope& a = scopes[overlap.scopeA];
+            const Scope& b = scopes[overlap.scopeB];
+            double shorterScope = std::min(a.gpuTime.avg(), b.gpuTime.avg());
+
+            std::cout << "gpu overlap of " << a.name << " and " << b.name << ": " << overlap.time.avg() << " ms avg";
+            if (shorterScope > 0.0) {
+                std::cout << " (" << 100.0 * overlap.time.avg() / shorterScope << "% of the shorter scope)";
+            }
+            std::cout << std::endl;
+        }
+
+        return true;
+    }
+
+private:
+    struct Scope {
+        std::string name;
+        RollingStats gpuTime;
+        std::array<uint64_t, PROFILER_STATISTIC_COUNT> statistics{};
+        bool hasStatistics = false;
+        bool timestampsEnabled = false;
+        bool statisticsEnabled = false;
+        uint64_t timestampMask = ~0ull;
+    };
+
+    // Raw timestamps of the last collected results, kept until an overlap has used them
+    struct Interval {
+        uint64_t begin = 0;
+        uint64_t end = 0;
+        bool valid = false;
+    };
+
+    struct FrameQueries {
+        VkQueryPool timestampPool = VK_NULL_HANDLE;
+        VkQueryPool statisticsPool = VK_NULL_HANDLE;
+        std::vector<bool> pending;
+        std::vector<Interval> intervals;
+    };
+
+    struct Overlap {
+        uint32_t scopeA;
+        uint32_t scopeB;
+        RollingStats time;
+    };
+
+    VkDevice device = VK_NULL_HANDLE;
+    bool timestampsSupported = false;
+    bool statisticsSupported = false;
+    float timestampPeriod = 1.0f;
+
+    std::vector<Scope> scopes;
+    std::vector<FrameQueries> frames;
+    std::vector<Overlap> overlaps;
+    std::chrono::steady_clock::time_point lastReportTime;
+
+    void collect(FrameQueries& frame, uint32_t scope) {
+        frame.pending[scope] = false;
+
+        // Each result is followed by its availability value. Without VK_QUERY_RESULT_WAIT_BIT
+        // unavailable results are skipped instead of stalling
+        if (scopes[scope].timestampsEnabled) {
+            std::array<uint64_t, 4> timestamps{};
+            vkGetQueryPoolResults(device, frame.timestampPool, scope * 2, 2, sizeof(timestamps), timestamps.data(), sizeof(uint64_t) * 2,
+                VK_QUERY_RESULT_64_BIT | VK_QUERY_RESULT_WITH_AVAILABILITY_BIT);
+
+            frame.intervals[scope].valid = false;
+
+            if (timestamps[1] != 0 && timestamps[3] != 0) {
+                uint64_t ticks = (timestamps[2] - timestamps[0]) & scopes[scope].timestampMask;
+                scopes[scope].gpuTime.add(ticks * timestampPeriod / 1000000.0);
+
+                frame.intervals[scope] = {timestamps[0], timestamps[0] + ticks, true};
+                collectOverlaps(frame, scope);
+            }
+        }
+
+        if (scopes[scope].statisticsEnabled) {
+            std::array<uint64_t, PROFILER_STATISTIC_COUNT + 1> statistics{};
+            vkGetQueryPoolResults(device, frame.statisticsPool, scope, 1, sizeof(statistics), statistics.data(), sizeof(statistics),
+                VK_QUERY_RESULT_64_BIT | VK_QUERY_RESULT_WITH_AVAILABILITY_BIT);
+
+            if (statistics.back() != 0) {
+                std::copy(statistics.begin(), statistics.end() - 1, scopes[scope].statistics.begin());
+                scopes[scope].hasStatistics = true;
+            }
+        }
+    }
+
+    void collectOverlaps(FrameQueries& frame, uint32_t scope) {
+        for (auto& overlap : overlaps) {
+            if (overlap.scopeA != scope && overlap.scopeB != scope) {
+                continue;
+            }
+
+            Interval& a = frame.intervals[overlap.scopeA];
+            Interval& b = frame.intervals[overlap.scopeB];
+            if (!a.valid || !b.valid) {
+                continue;
+            }
+
+            uint64_t begin = std::max(a.begin, b.begin);
+            uint64_t end = std::min(a.end, b.end);
+            overlap.time.add(end > begin ? (end - begin) * timestampPeriod / 1000000.0 : 0.0);
+
+            a.valid = false;
+            b.valid = false;
+        }
+    }
+};
+
+enum SchedulerQueue : uint32_t {
+    SCHEDULER_QUEUE_COMPUTE,
+    SCHEDULER_QUEUE_GRAPHICS,
+    SCHEDULER_QUEUE_COUNT
+};
+
+struct SemaphoreWait {
+    VkSemaphore semaphore;
+    uint64_t value; // ignored for binary semaphores
+    VkPipelineStageFlags stage;
+};
+
+// Paces the CPU against the GPU with one timeline semaphore per queue. The submission of
+// frame N to a queue signals value N on that queue's timeline, so every dependency between
+// frames and queues is a wait for a counter value instead of a fence or binary semaphore.
+class FrameScheduler {
+public:
+    void init(VkDevice device, uint32_t framesInFlight) {
+        this->device = device;
+        this->framesInFlight = framesInFlight;
+
+        VkSemaphoreTypeCreateInfo typeInfo{};
+        typeInfo.sType = VK_STRUCTURE_TYPE_SEMAPHORE_TYPE_CREATE_INFO;
+        typeInfo.semaphoreType = VK_SEMAPHORE_TYPE_TIMELINE;
+        typeInfo.initialValue = 0;
+
+        VkSemaphoreCreateInfo semaphoreInfo{};
+        semaphoreInfo.sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO;
+        semaphoreInfo.pNext = &typeInfo;
+
+        for (auto& timeline : timelines) {
+            if (vkCreateSemaphore(device, &semaphoreInfo, nullptr, &timeline) != VK_SUCCESS) {
+                throw std::runtime_error("failed to create timeline semaphore!");
+            }
+        }
+    }
+
+    void destroy() {
+        for (auto timeline : timelines) {
+            vkDestroySemaphore(device, timeline, nullptr);
+        }
+    }
+
+    // Starts the next frame, blocking until every queue has finished the frame that last
+    // used the same slot, so its command buffers and per-frame buffers can be reused
+    void beginFrame() {
+        frameNumber++;
+
+        if (frameNumber > framesInFlight) {
+            waitForFrame(frameNumber - framesInFlight);
+        }
+    }
+
+    uint64_t currentFrameNumber() const {
+        return frameNumber;
+    }
+
+    uint32_t frameIndex() const {
+        return static_cast<uint32_t>(frameNumber % framesInFlight);
+    }
+
+    uint32_t getFramesInFlight() const {
+        return framesInFlight;
+    }
+
+    VkSemaphore timeline(SchedulerQueue queue) const {
+        return timelines[queue];
+    }
+
+    // Wait for the given queue to finish a frame; frames before the first one are always complete
+    SemaphoreWait waitFor(SchedulerQueue queue, uint64_t frame, VkPipelineStageFlags stage) const {
+        return {timelines[queue], frame, stage};
+    }
+
+    void waitForFrame(uint64_t frame) const {
+        std::array<uint64_t, SCHEDULER_QUEUE_COUNT> values;
+        values.fill(frame);
+
+        VkSemaphoreWaitInfo waitInfo{};
+        waitInfo.sType = VK_STRUCTURE_TYPE_SEMAPHORE_WAIT_INFO;
+        waitInfo.semaphoreCount = static_cast<uint32_t>(timelines.size());
+        waitInfo.pSemaphores = timelines.data();
+        waitInfo.pValues = values.data();
+
+        if (vkWaitSemaphores(device, &waitInfo, UINT64_MAX) != VK_SUCCESS) {
+            throw std::runtime_error("failed to wait for timeline semaphores!");
+        }
+    }
+
+    // Submits the current frame's work for a queue, signalling its timeline with the frame
+    // number and optionally a binary semaphore (e.g. for presentation)
+    void submit(VkQueue queue, SchedulerQueue schedulerQueue, VkCommandBuffer commandBuffer, const std::vector<SemaphoreWait>& waits, VkSemaphore signalSemaphore = VK_NULL_HANDLE) const {
+        std::vector<VkSemaphore> waitSemaphores;
+        std::vector<uint64_t> waitValues;
+        std::vector<VkPipelineStageFlags> waitStages;
+        for (const SemaphoreWait& wait : waits) {
+            waitSemaphores.push_back(wait.semaphore);
+            waitValues.push_back(wait.value);
+            waitStages.push_back(wait.stage);
+        }
+
+        VkSemaphore signalSemaphores[] = {timelines[schedulerQueue], signalSemaphore};
+        uint64_t signalValues[] = {frameNumber, 0};
+
+        VkTimelineSemaphoreSubmitInfo timelineInfo{};
+        timelineInfo.sType = VK_STRUCTURE_TYPE_TIMELINE_SEMAPHORE_SUBMIT_INFO;
+        timelineInfo.waitSemaphoreValueCount = static_cast<uint32_t>(waitValues.size());
+        timelineInfo.pWaitSemaphoreValues = waitValues.data();
+        timelineInfo.signalSemaphoreValueCount = signalSemaphore != VK_NULL_HANDLE ? 2 : 1;
+        timelineInfo.pSignalSemaphoreValues = signalValues;
+
+        VkSubmitInfo submitInfo{};
+        submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+        submitInfo.pNext = &timelineInfo;
+        submitInfo.waitSemaphoreCount = static_cast<uint32_t>(waitSemaphores.size());
+        submitInfo.pWaitSemaphores = waitSemaphores.data();
+        submitInfo.pWaitDstStageMask = waitStages.data();
+        submitInfo.commandBufferCount = 1;
+        submitInfo.pCommandBuffers = &commandBuffer;
+        submitInfo.signalSemaphoreCount = timelineInfo.signalSemaphoreValueCount;
+        submitInfo.pSignalSemaphores = signalSemaphores;
+
+        if (vkQueueSubmit(queue, 1, &submitInfo, VK_NULL_HANDLE) != VK_SUCCESS) {
+            throw std::runtime_error("failed to submit command buffer!");
+        }
+    }
+
+private:
+    VkDevice device;
+    uint32_t framesInFlight;
+    std::array<VkSemaphore, SCHEDULER_QUEUE_COUNT> timelines{};
+    uint64_t frameNumber = 0;
+};
+
+enum ProfilerScope : uint32_t {
+    PROFILER_SCOPE_COMPUTE,
+    PROFILER_SCOPE_RENDER_PASS
+};
+
 class ComputeShaderApplication {
 public:
-    void run() {
+    void run(const AppOptions& options) {
+        this->options = options;
+
         initWindow();
         initVulkan();
         mainLoop();
@@ -120,11 +847,13 @@ public:
     }
 
 private:
-    GLFWwindow* window;
+    AppOptions options;
+
+    GLFWwindow* window = nullptr;
 
     VkInstance instance;
     VkDebugUtilsMessengerEXT debugMessenger;
-    VkSurfaceKHR surface;
+    VkSurfaceKHR surface = VK_NULL_HANDLE;
 
     VkPhysicalDevice physicalDevice = VK_NULL_HANDLE;
     VkDevice device;
@@ -133,13 +862,21 @@ private:
     VkQueue computeQueue;
     VkQueue presentQueue;
 
+    uint32_t graphicsQueueFamily;
+    uint32_t computeQueueFamily;
+    bool asyncCompute = false;
+
     VkSwapchainKHR swapChain;
     std::vector<VkImage> swapChainImages;
+    std::vector<VkDeviceMemory> offscreenImagesMemory;
     VkFormat swapChainImageFormat;
     VkExtent2D swapChainExtent;
     std::vector<VkImageView> swapChainImageViews;
     std::vector<VkFramebuffer> swapChainFramebuffers;
 
+    VkPipelineCache pipelineCache;
+    bool pipelineCacheWarm = false;
+
     VkRenderPass renderPass;
     VkPipelineLayout pipelineLayout;
     VkPipeline graphicsPipeline;
@@ -149,9 +886,21 @@ private:
     VkPipeline computePipeline;
 
     VkCommandPool commandPool;
-
-    std::vector<VkBuffer> shaderStorageBuffers;
-    std::vector<VkDeviceMemory> shaderStorageBuffersMemory;
+    VkCommandPool computeCommandPool;
+
+    // In async compute mode the simulation runs one frame ahead of rendering, which needs
+    // two more particle buffers than frames in flight. Uniform buffers and compute descriptor
+    // sets are per particle buffer as well.
+    uint32_t particleBufferCount;
+    uint32_t maxComputeWorkGroupCountX;
+    std::vector<VkBuffer> particlePositionBuffers;
+    std::vector<VkDeviceMemory> particlePositionBuffersMemory;
+    // Only used by the simulation, which updates it in place
+    VkBuffer particleVelocityBuffer;
+    VkDeviceMemory particleVelocityBufferMemory;
+    // Only read by drawing, shared by both queue families in async compute mode
+    VkBuffer particleColorBuffer;
+    VkDeviceMemory particleColorBufferMemory;
 
     std::vector<VkBuffer> uniformBuffers;
     std::vector<VkDeviceMemory> uniformBuffersMemory;
@@ -163,13 +912,14 @@ private:
     std::vector<VkCommandBuffer> commandBuffers;
     std::vector<VkCommandBuffer> computeCommandBuffers;
 
+    // Binary semaphores are still needed for the swap chain, everything else goes through the scheduler
     std::vector<VkSemaphore> imageAvailableSemaphores;
     std::vector<VkSemaphore> renderFinishedSemaphores;
-    std::vector<VkSemaphore> computeFinishedSemaphores;
-    std::vector<VkFence> inFlightFences;
-    std::vector<VkFence> computeInFlightFences;
+    FrameScheduler frameScheduler;
     uint32_t currentFrame = 0;
 
+    GpuProfiler gpuProfiler;
+
     float lastFrameTime = 0.0f;
 
     bool framebufferResized = false;
@@ -177,6 +927,11 @@ private:
     double lastTime = 0.0f;
 
     void initWindow() {
+        if (options.headless) {
+            lastFrameTime = HEADLESS_FRAME_TIME;
+            return;
+        }
+
         glfwInit();
 
         glfwWindowHint(GLFW_CLIENT_API, GLFW_NO_API);
@@ -199,6 +954,7 @@ private:
         createSurface();
         pickPhysicalDevice();
         createLogicalDevice();
+        createPipelineCache();
         createSwapChain();
         createImageViews();
         createRenderPass();
@@ -213,13 +969,22 @@ private:
         createComputeDescriptorSets();
         createCommandBuffers();
         createComputeCommandBuffers();
+        createGpuProfiler();
         createSyncObjects();
     }
 
     void mainLoop() {
+        if (options.headless) {
+            runBenchmark();
+            return;
+        }
+
         while (!glfwWindowShouldClose(window)) {
             glfwPollEvents();
             drawFrame();
+            if (options.profile && gpuProfiler.printReport(1.0)) {
+                printSimulationThroughput();
+            }
             // We want to animate the particle system using the last frames time to get smooth, frame-rate independent animation
             double currentTime = glfwGetTime();
             lastFrameTime = (currentTime - lastTime) * 1000.0;
@@ -229,6 +994,61 @@ private:
         vkDeviceWaitIdle(device);
     }
 
+    void runBenchmark() {
+        std::vector<double> frameTimes;
+        frameTimes.reserve(options.benchmarkFrames);
+
+        auto benchmarkStart = std::chrono::high_resolution_clock::now();
+        auto frameStart = benchmarkStart;
+
+        for (uint32_t i = 0; i < options.benchmarkFrames; i++) {
+            drawFrame();
+            if (gpuProfiler.printReport(1.0)) {
+                printSimulationThroughput();
+            }
+
+            auto frameEnd = std::chrono::high_resolution_clock::now();
+            frameTimes.push_back(std::chrono::duration<double, std::chrono::milliseconds::period>(frameEnd - frameStart).count());
+            frameStart = frameEnd;
+        }
+
+        vkDeviceWaitIdle(device);
+
+        double totalSeconds = std::chrono::duration<double>(std::chrono::high_resolution_clock::now() - benchmarkStart).count();
+        printFrameTimeStats(frameTimes, totalSeconds);
+        gpuProfiler.printReport(0.0);
+        printSimulationThroughput();
+    }
+
+    void printSimulationThroughput() {
+        const RollingStats& computeTime = gpuProfiler.getGpuTime(PROFILER_SCOPE_COMPUTE);
+        if (computeTime.empty() || computeTime.avg() <= 0.0) {
+            return;
+        }
+
+        std::cout << "simulation: " << options.particleCount << " particles, " << options.particleCount / computeTime.avg() << " particles/ms" << std::endl;
+    }
+
+    void printFrameTimeStats(std::vector<double> frameTimes, double totalSeconds) {
+        if (frameTimes.empty()) {
+            return;
+        }
+
+        std::sort(frameTimes.begin(), frameTimes.end());
+
+        double sum = 0.0;
+        for (double frameTime : frameTimes) {
+            sum += frameTime;
+        }
+
+        size_t p99Rank = static_cast<size_t>(std::ceil(0.99 * frameTimes.size())) - 1;
+
+        std::cout << "benchmark: " << frameTimes.size() << " frames in " << totalSeconds << " s with " << options.framesInFlight << " frames in flight ("
+                  << frameTimes.size() / totalSeconds << " fps), frame time " << frameTimes.front() << " ms min, "
+                  << sum / frameTimes.size() << " ms avg, " << frameTimes[p99Rank] << " ms p99, "
+                  << frameTimes.back() << " ms max" << std::endl;
+    }
+
     void cleanupSwapChain() {
         for (auto framebuffer : swapChainFramebuffers) {
             vkDestroyFramebuffer(device, framebuffer, nullptr);
@@ -238,12 +1058,22 @@ private:
             vkDestroyImageView(device, imageView, nullptr);
         }
 
-        vkDestroySwapchainKHR(device, swapChain, nullptr);
+        if (options.headless) {
+            for (size_t i = 0; i < swapChainImages.size(); i++) {
+                vkDestroyImage(device, swapChainImages[i], nullptr);
+                vkFreeMemory(device, offscreenImagesMemory[i], nullptr);
+            }
+        } else {
+            vkDestroySwapchainKHR(device, swapChain, nullptr);
+        }
     }
 
     void cleanup() {
         cleanupSwapChain();
 
+        savePipelineCache();
+        vkDestroyPipelineCache(device, pipelineCache, nullptr);
+
         vkDestroyPipeline(device, graphicsPipeline, nullptr);
         vkDestroyPipelineLayout(device, pipelineLayout, nullptr);
 
@@ -252,7 +1082,7 @@ private:
 
         vkDestroyRenderPass(device, renderPass, nullptr);
 
-        for (size_t i = 0; i < MAX_FRAMES_IN_FLIGHT; i++) {
+        for (size_t i = 0; i < particleBufferCount; i++) {
             vkDestroyBuffer(device, uniformBuffers[i], nullptr);
             vkFreeMemory(device, uniformBuffersMemory[i], nullptr);
         }
@@ -261,20 +1091,28 @@ private:
       
         vkDestroyDescriptorSetLayout(device, computeDescriptorSetLayout, nullptr);
 
-        for (size_t i = 0; i < MAX_FRAMES_IN_FLIGHT; i++) {
-            vkDestroyBuffer(device, shaderStorageBuffers[i], nullptr);
-            vkFreeMemory(device, shaderStorageBuffersMemory[i], nullptr);
+        for (size_t i = 0; i < particleBufferCount; i++) {
+            vkDestroyBuffer(device, particlePositionBuffers[i], nullptr);
+            vkFreeMemory(device, particlePositionBuffersMemory[i], nullptr);
         }
 
-        for (size_t i = 0; i < MAX_FRAMES_IN_FLIGHT; i++) {
+        vkDestroyBuffer(device, particleVelocityBuffer, nullptr);
+        vkFreeMemory(device, particleVelocityBufferMemory, nullptr);
+
+        vkDestroyBuffer(device, particleColorBuffer, nullptr);
+        vkFreeMemory(device, particleColorBufferMemory, nullptr);
+
+        for (size_t i = 0; i < options.framesInFlight; i++) {
             vkDestroySemaphore(device, renderFinishedSemaphores[i], nullptr);
             vkDestroySemaphore(device, imageAvailableSemaphores[i], nullptr);
-            vkDestroySemaphore(device, computeFinishedSemaphores[i], nullptr);
-            vkDestroyFence(device, inFlightFences[i], nullptr);
-            vkDestroyFence(device, computeInFlightFences[i], nullptr);
         }
 
+        frameScheduler.destroy();
+
         vkDestroyCommandPool(device, commandPool, nullptr);
+        vkDestroyCommandPool(device, computeCommandPool, nullptr);
+
+        gpuProfiler.destroy();
 
         vkDestroyDevice(device, nullptr);
 
@@ -282,12 +1120,16 @@ private:
             DestroyDebugUtilsMessengerEXT(instance, debugMessenger, nullptr);
         }
 
-        vkDestroySurfaceKHR(instance, surface, nullptr);
+        if (!options.headless) {
+            vkDestroySurfaceKHR(instance, surface, nullptr);
+        }
         vkDestroyInstance(instance, nullptr);
 
-        glfwDestroyWindow(window);
+        if (!options.headless) {
+            glfwDestroyWindow(window);
 
-        glfwTerminate();
+            glfwTerminate();
+        }
     }
 
     void recreateSwapChain() {
@@ -318,7 +1160,7 @@ private:
         appInfo.applicationVersion = VK_MAKE_VERSION(1, 0, 0);
         appInfo.pEngineName = "No Engine";
         appInfo.engineVersion = VK_MAKE_VERSION(1, 0, 0);
-        appInfo.apiVersion = VK_API_VERSION_1_0;
+        appInfo.apiVersion = VK_API_VERSION_1_2;
 
         VkInstanceCreateInfo createInfo{};
         createInfo.sType = VK_STRUCTURE_TYPE_INSTANCE_CREATE_INFO;
@@ -366,6 +1208,10 @@ private:
     }
 
     void createSurface() {
+        if (options.headless) {
+            return;
+        }
+
         if (glfwCreateWindowSurface(instance, window, nullptr, &surface) != VK_SUCCESS) {
             throw std::runtime_error("failed to create window surface!");
         }
@@ -397,8 +1243,22 @@ private:
     void createLogicalDevice() {
         QueueFamilyIndices indices = findQueueFamilies(physicalDevice);
 
+        graphicsQueueFamily = indices.graphicsAndComputeFamily.value();
+        computeQueueFamily = graphicsQueueFamily;
+
+        if (options.asyncCompute) {
+            if (indices.asyncComputeFamily.has_value()) {
+                computeQueueFamily = indices.asyncComputeFamily.value();
+                asyncCompute = true;
+            } else {
+                std::cerr << "no dedicated compute queue family, running compute on the graphics queue" << std::endl;
+            }
+        }
+
+        particleBufferCount = options.framesInFlight + (asyncCompute ? 2 : 0);
+
         std::vector<VkDeviceQueueCreateInfo> queueCreateInfos;
-        std::set<uint32_t> uniqueQueueFamilies = {indices.graphicsAndComputeFamily.value(), indices.presentFamily.value()};
+        std::set<uint32_t> uniqueQueueFamilies = {graphicsQueueFamily, computeQueueFamily, indices.presentFamily.value()};
 
         float queuePriority = 1.0f;
         for (uint32_t queueFamily : uniqueQueueFamilies) {
@@ -410,18 +1270,28 @@ private:
             queueCreateInfos.push_back(queueCreateInfo);
         }
 
+        VkPhysicalDeviceFeatures supportedFeatures;
+        vkGetPhysicalDeviceFeatures(physicalDevice, &supportedFeatures);
+
         VkPhysicalDeviceFeatures deviceFeatures{};
+        deviceFeatures.pipelineStatisticsQuery = supportedFeatures.pipelineStatisticsQuery;
+
+        VkPhysicalDeviceVulkan12Features vulkan12Features{};
+        vulkan12Features.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_VULKAN_1_2_FEATURES;
+        vulkan12Features.timelineSemaphore = VK_TRUE;
 
         VkDeviceCreateInfo createInfo{};
         createInfo.sType = VK_STRUCTURE_TYPE_DEVICE_CREATE_INFO;
+        createInfo.pNext = &vulkan12Features;
 
         createInfo.queueCreateInfoCount = static_cast<uint32_t>(queueCreateInfos.size());
         createInfo.pQueueCreateInfos = queueCreateInfos.data();
 
         createInfo.pEnabledFeatures = &deviceFeatures;
 
-        createInfo.enabledExtensionCount = static_cast<uint32_t>(deviceExtensions.size());
-        createInfo.ppEnabledExtensionNames = deviceExtensions.data();
+        auto extensions = getRequiredDeviceExtensions();
+        createInfo.enabledExtensionCount = static_cast<uint32_t>(extensions.size());
+        createInfo.ppEnabledExtensionNames = extensions.data();
 
         if (enableValidationLayers) {
             createInfo.enabledLayerCount = static_cast<uint32_t>(validationLayers.size());
@@ -434,12 +1304,129 @@ private:
             throw std::runtime_error("failed to create logical device!");
         }
 
-        vkGetDeviceQueue(device, indices.graphicsAndComputeFamily.value(), 0, &graphicsQueue);
-        vkGetDeviceQueue(device, indices.graphicsAndComputeFamily.value(), 0, &computeQueue);
+        vkGetDeviceQueue(device, graphicsQueueFamily, 0, &graphicsQueue);
+        vkGetDeviceQueue(device, computeQueueFamily, 0, &computeQueue);
         vkGetDeviceQueue(device, indices.presentFamily.value(), 0, &presentQueue);
     }
 
+    void createPipelineCache() {
+        std::vector<char> cacheData = loadPipelineCacheData();
+        pipelineCacheWarm = !cacheData.empty();
+
+        VkPipelineCacheCreateInfo cacheInfo{};
+        cacheInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_CACHE_CREATE_INFO;
+        cacheInfo.initialDataSize = cacheData.size();
+        cacheInfo.pInitialData = cacheData.empty() ? nullptr : cacheData.data();
+
+        if (vkCreatePipelineCache(device, &cacheInfo, nullptr, &pipelineCache) != VK_SUCCESS) {
+            throw std::runtime_error("failed to create pipeline cache!");
+        }
+    }
+
+    std::vector<char> loadPipelineCacheData() {
+        std::ifstream file(PIPELINE_CACHE_PATH, std::ios::ate | std::ios::binary);
+
+        if (!file.is_open()) {
+            return {};
+        }
+
+        size_t fileSize = (size_t) file.tellg();
+        PipelineCacheFileHeader fileHeader{};
+        if (fileSize < sizeof(fileHeader)) {
+            std::cerr << "pipeline cache: ignoring truncated file" << std::endl;
+            return {};
+        }
+
+        file.seekg(0);
+        file.read(reinterpret_cast<char*>(&fileHeader), sizeof(fileHeader));
+
+        if (fileHeader.magic != PIPELINE_CACHE_MAGIC || fileHeader.dataSize != fileSize - sizeof(fileHeader)) {
+            std::cerr << "pipeline cache: ignoring corrupt file" << std::endl;
+            return {};
+        }
+
+        std::vector<char> data(fileHeader.dataSize);
+        file.read(data.data(), data.size());
+
+        if (!file || hashBytes(data.data(), data.size()) != fileHeader.dataHash) {
+            std::cerr << "pipeline cache: ignoring corrupt file" << std::endl;
+            return {};
+        }
+
+        if (!isPipelineCacheCompatible(data)) {
+            std::cerr << "pipeline cache: ignoring cache created by a different device or driver" << std::endl;
+            return {};
+        }
+
+        return data;
+    }
+
+    bool isPipelineCacheCompatible(const std::vector<char>& data) {
+        VkPipelineCacheHeaderVersionOne cacheHeader{};
+        if (data.size() < sizeof(cacheHeader)) {
+            return false;
+        }
+        memcpy(&cacheHeader, data.data(), sizeof(cacheHeader));
+
+        VkPhysicalDeviceProperties properties;
+        vkGetPhysicalDeviceProperties(physicalDevice, &properties);
+
+        return cacheHeader.headerSize >= sizeof(cacheHeader) &&
+               cacheHeader.headerVersion == VK_PIPELINE_CACHE_HEADER_VERSION_ONE &&
+               cacheHeader.vendorID == properties.vendorID &&
+               cacheHeader.deviceID == properties.deviceID &&
+               memcmp(cacheHeader.pipelineCacheUUID, properties.pipelineCacheUUID, VK_UUID_SIZE) == 0;
+    }
+
+    void savePipelineCache() {
+        size_t dataSize = 0;
+        if (vkGetPipelineCacheData(device, pipelineCache, &dataSize, nullptr) != VK_SUCCESS || dataSize == 0) {
+            return;
+        }
+
+        std::vector<char> data(dataSize);
+        if (vkGetPipelineCacheData(device, pipelineCache, &dataSize, data.data()) != VK_SUCCESS) {
+            return;
+        }
+
+        PipelineCacheFileHeader fileHeader{};
+        fileHeader.magic = PIPELINE_CACHE_MAGIC;
+        fileHeader.dataSize = static_cast<uint32_t>(dataSize);
+        fileHeader.dataHash = hashBytes(data.data(), dataSize);
+
+        // Write to a temporary file first and rename it over the old cache, so that
+        // a crash halfway through never leaves a partially written cache behind
+        std::string tempPath = PIPELINE_CACHE_PATH + ".tmp";
+        {
+            std::ofstream file(tempPath, std::ios::binary | std::ios::trunc);
+            if (!file.is_open()) {
+                std::cerr << "pipeline cache: failed to write " << tempPath << std::endl;
+                return;
+            }
+
+            file.write(reinterpret_cast<const char*>(&fileHeader), sizeof(fileHeader));
+            file.write(data.data(), dataSize);
+
+            if (!file) {
+                std::cerr << "pipeline cache: failed to write " << tempPath << std::endl;
+                return;
+            }
+        }
+
+        std::error_code error;
+        std::filesystem::rename(tempPath, PIPELINE_CACHE_PATH, error);
+        if (error) {
+            std::cerr << "pipeline cache: failed to replace " << PIPELINE_CACHE_PATH << ": " << error.message() << std::endl;
+            std::filesystem::remove(tempPath, error);
+        }
+    }
+
     void createSwapChain() {
+        if (options.headless) {
+            createOffscreenImages();
+            return;
+        }
+
         SwapChainSupportDetails swapChainSupport = querySwapChainSupport(physicalDevice);
 
         VkSurfaceFormatKHR surfaceFormat = chooseSwapSurfaceFormat(swapChainSupport.formats);
@@ -490,6 +1477,50 @@ private:
         swapChainExtent = extent;
     }
 
+    // Stand-ins for the swap chain images in headless mode, one per frame in flight
+    void createOffscreenImages() {
+        swapChainImageFormat = VK_FORMAT_B8G8R8A8_SRGB;
+        swapChainExtent = {WIDTH, HEIGHT};
+
+        swapChainImages.resize(options.framesInFlight);
+        offscreenImagesMemory.resize(options.framesInFlight);
+
+        for (size_t i = 0; i < options.framesInFlight; i++) {
+            VkImageCreateInfo imageInfo{};
+            imageInfo.sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO;
+            imageInfo.imageType = VK_IMAGE_TYPE_2D;
+            imageInfo.extent.width = WIDTH;
+            imageInfo.extent.height = HEIGHT;
+            imageInfo.extent.depth = 1;
+            imageInfo.mipLevels = 1;
+            imageInfo.arrayLayers = 1;
+            imageInfo.format = swapChainImageFormat;
+            imageInfo.tiling = VK_IMAGE_TILING_OPTIMAL;
+            imageInfo.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+            imageInfo.usage = VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT | VK_IMAGE_USAGE_TRANSFER_SRC_BIT;
+            imageInfo.samples = VK_SAMPLE_COUNT_1_BIT;
+            imageInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+
+            if (vkCreateImage(device, &imageInfo, nullptr, &swapChainImages[i]) != VK_SUCCESS) {
+                throw std::runtime_error("failed to create offscreen image!");
+            }
+
+            VkMemoryRequirements memRequirements;
+            vkGetImageMemoryRequirements(device, swapChainImages[i], &memRequirements);
+
+            VkMemoryAllocateInfo allocInfo{};
+            allocInfo.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
+            allocInfo.allocationSize = memRequirements.size;
+            allocInfo.memoryTypeIndex = findMemoryType(memRequirements.memoryTypeBits, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
+
+            if (vkAllocateMemory(device, &allocInfo, nullptr, &offscreenImagesMemory[i]) != VK_SUCCESS) {
+                throw std::runtime_error("failed to allocate offscreen image memory!");
+            }
+
+            vkBindImageMemory(device, swapChainImages[i], offscreenImagesMemory[i], 0);
+        }
+    }
+
     void createImageViews() {
         swapChainImageViews.resize(swapChainImages.size());
 
@@ -524,7 +1555,7 @@ private:
         colorAttachment.stencilLoadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE;
         colorAttachment.stencilStoreOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
         colorAttachment.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
-        colorAttachment.finalLayout = VK_IMAGE_LAYOUT_PRESENT_SRC_KHR;
+        colorAttachment.finalLayout = options.headless ? VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL : VK_IMAGE_LAYOUT_PRESENT_SRC_KHR;
 
         VkAttachmentReference colorAttachmentRef{};
         colorAttachmentRef.attachment = 0;
@@ -558,7 +1589,7 @@ private:
     }
 
     void createComputeDescriptorSetLayout() {
-        std::array<VkDescriptorSetLayoutBinding, 3> layoutBindings{};
+        std::array<VkDescriptorSetLayoutBinding, 4> layoutBindings{};
         layoutBindings[0].binding = 0;
         layoutBindings[0].descriptorCount = 1;
         layoutBindings[0].descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
@@ -577,9 +1608,15 @@ private:
         layoutBindings[2].pImmutableSamplers = nullptr;
         layoutBindings[2].stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
 
+        layoutBindings[3].binding = 3;
+        layoutBindings[3].descriptorCount = 1;
+        layoutBindings[3].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+        layoutBindings[3].pImmutableSamplers = nullptr;
+        layoutBindings[3].stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+
         VkDescriptorSetLayoutCreateInfo layoutInfo{};
         layoutInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
-        layoutInfo.bindingCount = 3;
+        layoutInfo.bindingCount = static_cast<uint32_t>(layoutBindings.size());
         layoutInfo.pBindings = layoutBindings.data();
 
         if (vkCreateDescriptorSetLayout(device, &layoutInfo, nullptr, &computeDescriptorSetLayout) != VK_SUCCESS) {
@@ -612,12 +1649,12 @@ private:
         VkPipelineVertexInputStateCreateInfo vertexInputInfo{};
         vertexInputInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_VERTEX_INPUT_STATE_CREATE_INFO;
 
-        auto bindingDescription = Particle::getBindingDescription();
+        auto bindingDescriptions = Particle::getBindingDescriptions();
         auto attributeDescriptions = Particle::getAttributeDescriptions();
 
-        vertexInputInfo.vertexBindingDescriptionCount = 1;
+        vertexInputInfo.vertexBindingDescriptionCount = static_cast<uint32_t>(bindingDescriptions.size());
         vertexInputInfo.vertexAttributeDescriptionCount = static_cast<uint32_t>(attributeDescriptions.size());
-        vertexInputInfo.pVertexBindingDescriptions = &bindingDescription;
+        vertexInputInfo.pVertexBindingDescriptions = bindingDescriptions.data();
         vertexInputInfo.pVertexAttributeDescriptions = attributeDescriptions.data();
 
         VkPipelineInputAssemblyStateCreateInfo inputAssembly{};
@@ -700,10 +1737,14 @@ private:
         pipelineInfo.subpass = 0;
         pipelineInfo.basePipelineHandle = VK_NULL_HANDLE;
 
-        if (vkCreateGraphicsPipelines(device, VK_NULL_HANDLE, 1, &pipelineInfo, nullptr, &graphicsPipeline) != VK_SUCCESS) {
+        auto pipelineStart = std::chrono::high_resolution_clock::now();
+
+        if (vkCreateGraphicsPipelines(device, pipelineCache, 1, &pipelineInfo, nullptr, &graphicsPipeline) != VK_SUCCESS) {
             throw std::runtime_error("failed to create graphics pipeline!");
         }
 
+        printPipelineCreationTime("graphics", pipelineStart);
+
         vkDestroyShaderModule(device, fragShaderModule, nullptr);
         vkDestroyShaderModule(device, vertShaderModule, nullptr);
     }
@@ -719,10 +1760,17 @@ private:
         computeShaderStageInfo.module = computeShaderModule;
         computeShaderStageInfo.pName = "main";
 
+        VkPushConstantRange pushConstantRange{};
+        pushConstantRange.stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+        pushConstantRange.offset = 0;
+        pushConstantRange.size = sizeof(ComputePushConstants);
+
         VkPipelineLayoutCreateInfo pipelineLayoutInfo{};
         pipelineLayoutInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
         pipelineLayoutInfo.setLayoutCount = 1;
         pipelineLayoutInfo.pSetLayouts = &computeDescriptorSetLayout;
+        pipelineLayoutInfo.pushConstantRangeCount = 1;
+        pipelineLayoutInfo.pPushConstantRanges = &pushConstantRange;
 
         if (vkCreatePipelineLayout(device, &pipelineLayoutInfo, nullptr, &computePipelineLayout) != VK_SUCCESS) {
             throw std::runtime_error("failed to create compute pipeline layout!");
@@ -733,10 +1781,14 @@ private:
         pipelineInfo.layout = computePipelineLayout;
         pipelineInfo.stage = computeShaderStageInfo;
 
-        if (vkCreateComputePipelines(device, VK_NULL_HANDLE, 1, &pipelineInfo, nullptr, &computePipeline) != VK_SUCCESS) {
+        auto pipelineStart = std::chrono::high_resolution_clock::now();
+
+        if (vkCreateComputePipelines(device, pipelineCache, 1, &pipelineInfo, nullptr, &computePipeline) != VK_SUCCESS) {
             throw std::runtime_error("failed to create compute pipeline!");
         }
 
+        printPipelineCreationTime("compute", pipelineStart);
+
         vkDestroyShaderModule(device, computeShaderModule, nullptr);
     }
 
@@ -764,70 +1816,125 @@ private:
     }
 
     void createCommandPool() {
-        QueueFamilyIndices queueFamilyIndices = findQueueFamilies(physicalDevice);
-
         VkCommandPoolCreateInfo poolInfo{};
         poolInfo.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
         poolInfo.flags = VK_COMMAND_POOL_CREATE_RESET_COMMAND_BUFFER_BIT;
-        poolInfo.queueFamilyIndex = queueFamilyIndices.graphicsAndComputeFamily.value();
+        poolInfo.queueFamilyIndex = graphicsQueueFamily;
 
         if (vkCreateCommandPool(device, &poolInfo, nullptr, &commandPool) != VK_SUCCESS) {
             throw std::runtime_error("failed to create graphics command pool!");
         }
+
+        poolInfo.queueFamilyIndex = computeQueueFamily;
+
+        if (vkCreateCommandPool(device, &poolInfo, nullptr, &computeCommandPool) != VK_SUCCESS) {
+            throw std::runtime_error("failed to create compute command pool!");
+        }
     }
 
     void createShaderStorageBuffers() {
+        VkPhysicalDeviceProperties properties;
+        vkGetPhysicalDeviceProperties(physicalDevice, &properties);
+        maxComputeWorkGroupCountX = properties.limits.maxComputeWorkGroupCount[0];
 
-        // Initialize particles
-        std::default_random_engine rndEngine((unsigned)time(nullptr));
-        std::uniform_real_distribution<float> rndDist(0.0f, 1.0f);
+        VkDeviceSize count = options.particleCount;
+        VkDeviceSize positionsSize = sizeof(Particle::Position) * count;
+        VkDeviceSize velocitiesSize = sizeof(Particle::Velocity) * count;
+        VkDeviceSize colorsSize = sizeof(Particle::Color) * count;
 
-        // Initial particle positions on a circle
-        std::vector<Particle> particles(PARTICLE_COUNT);
-        for (auto& particle : particles) {
-            float r = 0.25f * sqrt(rndDist(rndEngine));
-            float theta = rndDist(rndEngine) * 2.0f * 3.14159265358979323846f;
-            float x = r * cos(theta) * HEIGHT / WIDTH;
-            float y = r * sin(theta);
-            particle.position = glm::vec2(x, y);
-            particle.velocity = glm::normalize(glm::vec2(x,y)) * 0.00025f;
-            particle.color = glm::vec4(rndDist(rndEngine), rndDist(rndEngine), rndDist(rndEngine), 1.0f);
+        if (std::max(positionsSize, velocitiesSize) > properties.limits.maxStorageBufferRange) {
+            throw std::runtime_error("particle count exceeds the maximum storage buffer range of " + std::to_string(properties.limits.maxStorageBufferRange / sizeof(Particle::Position)) + " particles!");
         }
 
-        VkDeviceSize bufferSize = sizeof(Particle) * PARTICLE_COUNT;
+        particlePositionBuffers.resize(particleBufferCount);
+        particlePositionBuffersMemory.resize(particleBufferCount);
+
+        for (size_t i = 0; i < particleBufferCount; i++) {
+            createBuffer(positionsSize, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_VERTEX_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, particlePositionBuffers[i], particlePositionBuffersMemory[i]);
+        }
+
+        createBuffer(velocitiesSize, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, particleVelocityBuffer, particleVelocityBufferMemory);
+        createBuffer(colorsSize, VK_BUFFER_USAGE_VERTEX_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, particleColorBuffer, particleColorBufferMemory, true);
+
+        // Create a staging buffer used to upload data to the gpu. With millions of particles
+        // the data is generated and uploaded a chunk at a time to bound the host memory used.
+        uint32_t chunkSize = std::min(options.particleCount, PARTICLE_UPLOAD_CHUNK_SIZE);
+        VkDeviceSize stagingSize = (sizeof(Particle::Position) + sizeof(Particle::Velocity) + sizeof(Particle::Color)) * static_cast<VkDeviceSize>(chunkSize);
 
-        // Create a staging buffer used to upload data to the gpu
         VkBuffer stagingBuffer;
         VkDeviceMemory stagingBufferMemory;
-        createBuffer(bufferSize, VK_BUFFER_USAGE_TRANSFER_SRC_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, stagingBuffer, stagingBufferMemory);
+        createBuffer(stagingSize, VK_BUFFER_USAGE_TRANSFER_SRC_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, stagingBuffer, stagingBufferMemory);
 
         void* data;
-        vkMapMemory(device, stagingBufferMemory, 0, bufferSize, 0, &data);
-        memcpy(data, particles.data(), (size_t)bufferSize);
-        vkUnmapMemory(device, stagingBufferMemory);
+        vkMapMemory(device, stagingBufferMemory, 0, stagingSize, 0, &data);
+
+        // The staging buffer holds a chunk of each stream, one after another
+        auto positions = static_cast<Particle::Position*>(data);
+        auto velocities = reinterpret_cast<Particle::Velocity*>(positions + chunkSize);
+        auto colors = reinterpret_cast<Particle::Color*>(velocities + chunkSize);
 
-        shaderStorageBuffers.resize(MAX_FRAMES_IN_FLIGHT);
-        shaderStorageBuffersMemory.resize(MAX_FRAMES_IN_FLIGHT);
+        // Initialize particles
+        std::default_random_engine rndEngine(options.headless ? HEADLESS_RANDOM_SEED : (unsigned)time(nullptr));
+        std::uniform_real_distribution<float> rndDist(0.0f, 1.0f);
 
-        // Copy initial particle data to all storage buffers
-        for (size_t i = 0; i < MAX_FRAMES_IN_FLIGHT; i++) {
-            createBuffer(bufferSize, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_VERTEX_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, shaderStorageBuffers[i], shaderStorageBuffersMemory[i]);
-            copyBuffer(stagingBuffer, shaderStorageBuffers[i], bufferSize);
+        for (uint32_t first = 0; first < options.particleCount; first += chunkSize) {
+            uint32_t chunkCount = std::min(chunkSize, options.particleCount - first);
+
+            // Initial particle positions on a circle
+            for (uint32_t i = 0; i < chunkCount; i++) {
+                float r = 0.25f * sqrt(rndDist(rndEngine));
+                float theta = rndDist(rndEngine) * 2.0f * 3.14159265358979323846f;
+                float x = r * cos(theta) * HEIGHT / WIDTH;
+                float y = r * sin(theta);
+                positions[i] = glm::vec2(x, y);
+                velocities[i] = glm::normalize(glm::vec2(x,y)) * 0.00025f;
+                colors[i] = glm::packUnorm4x8(glm::vec4(rndDist(rndEngine), rndDist(rndEngine), rndDist(rndEngine), 1.0f));
+            }
+
+            // The storage buffers belong to the compute queue family, so they are initialized on its queue
+            VkCommandBuffer commandBuffer = beginSingleTimeCommands();
+
+            VkBufferCopy copyRegion{};
+            copyRegion.srcOffset = 0;
+            copyRegion.dstOffset = sizeof(Particle::Position) * static_cast<VkDeviceSize>(first);
+            copyRegion.size = sizeof(Particle::Position) * static_cast<VkDeviceSize>(chunkCount);
+            for (size_t i = 0; i < particleBufferCount; i++) {
+                vkCmdCopyBuffer(commandBuffer, stagingBuffer, particlePositionBuffers[i], 1, &copyRegion);
+            }
+
+            copyRegion.srcOffset = reinterpret_cast<char*>(velocities) - static_cast<char*>(data);
+            copyRegion.dstOffset = sizeof(Particle::Velocity) * static_cast<VkDeviceSize>(first);
+            copyRegion.size = sizeof(Particle::Velocity) * static_cast<VkDeviceSize>(chunkCount);
+            vkCmdCopyBuffer(commandBuffer, stagingBuffer, particleVelocityBuffer, 1, &copyRegion);
+
+            copyRegion.srcOffset = reinterpret_cast<char*>(colors) - static_cast<char*>(data);
+            copyRegion.dstOffset = sizeof(Particle::Color) * static_cast<VkDeviceSize>(first);
+            copyRegion.size = sizeof(Particle::Color) * static_cast<VkDeviceSize>(chunkCount);
+            vkCmdCopyBuffer(commandBuffer, stagingBuffer, particleColorBuffer, 1, &copyRegion);
+
+            // The first frame is drawn before the simulation has released any buffer to graphics
+            if (asyncCompute && first + chunkCount == options.particleCount) {
+                releaseParticleBuffer(commandBuffer, particlePositionBuffers.back(), VK_PIPELINE_STAGE_TRANSFER_BIT, VK_ACCESS_TRANSFER_WRITE_BIT);
+            }
+
+            // Waits for the copies, so the staging buffer can be refilled
+            endSingleTimeCommands(commandBuffer);
         }
 
+        vkUnmapMemory(device, stagingBufferMemory);
+
         vkDestroyBuffer(device, stagingBuffer, nullptr);
         vkFreeMemory(device, stagingBufferMemory, nullptr);
-
     }
 
     void createUniformBuffers() {
         VkDeviceSize bufferSize = sizeof(UniformBufferObject);
 
-        uniformBuffers.resize(MAX_FRAMES_IN_FLIGHT);
-        uniformBuffersMemory.resize(MAX_FRAMES_IN_FLIGHT);
-        uniformBuffersMapped.resize(MAX_FRAMES_IN_FLIGHT);
+        uniformBuffers.resize(particleBufferCount);
+        uniformBuffersMemory.resize(particleBufferCount);
+        uniformBuffersMapped.resize(particleBufferCount);
 
-        for (size_t i = 0; i < MAX_FRAMES_IN_FLIGHT; i++) {
+        for (size_t i = 0; i < particleBufferCount; i++) {
             createBuffer(bufferSize, VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, uniformBuffers[i], uniformBuffersMemory[i]);
 
             vkMapMemory(device, uniformBuffersMemory[i], 0, bufferSize, 0, &uniformBuffersMapped[i]);
@@ -837,16 +1944,16 @@ private:
     void createDescriptorPool() {
         std::array<VkDescriptorPoolSize, 2> poolSizes{};
         poolSizes[0].type = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
-        poolSizes[0].descriptorCount = static_cast<uint32_t>(MAX_FRAMES_IN_FLIGHT);
+        poolSizes[0].descriptorCount = particleBufferCount;
         
         poolSizes[1].type = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
-        poolSizes[1].descriptorCount = static_cast<uint32_t>(MAX_FRAMES_IN_FLIGHT) * 2;
+        poolSizes[1].descriptorCount = particleBufferCount * 3;
 
         VkDescriptorPoolCreateInfo poolInfo{};
         poolInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
         poolInfo.poolSizeCount = 2;
         poolInfo.pPoolSizes = poolSizes.data();
-        poolInfo.maxSets = static_cast<uint32_t>(MAX_FRAMES_IN_FLIGHT);
+        poolInfo.maxSets = particleBufferCount;
 
         if (vkCreateDescriptorPool(device, &poolInfo, nullptr, &descriptorPool) != VK_SUCCESS) {
             throw std::runtime_error("failed to create descriptor pool!");
@@ -854,25 +1961,25 @@ private:
     }
 
     void createComputeDescriptorSets() {
-        std::vector<VkDescriptorSetLayout> layouts(MAX_FRAMES_IN_FLIGHT, computeDescriptorSetLayout);
+        std::vector<VkDescriptorSetLayout> layouts(particleBufferCount, computeDescriptorSetLayout);
         VkDescriptorSetAllocateInfo allocInfo{};
         allocInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
         allocInfo.descriptorPool = descriptorPool;
-        allocInfo.descriptorSetCount = static_cast<uint32_t>(MAX_FRAMES_IN_FLIGHT);
+        allocInfo.descriptorSetCount = particleBufferCount;
         allocInfo.pSetLayouts = layouts.data();
 
-        computeDescriptorSets.resize(MAX_FRAMES_IN_FLIGHT);
+        computeDescriptorSets.resize(particleBufferCount);
         if (vkAllocateDescriptorSets(device, &allocInfo, computeDescriptorSets.data()) != VK_SUCCESS) {
             throw std::runtime_error("failed to allocate descriptor sets!");
         }
 
-        for (size_t i = 0; i < MAX_FRAMES_IN_FLIGHT; i++) {
+        for (size_t i = 0; i < particleBufferCount; i++) {
             VkDescriptorBufferInfo uniformBufferInfo{};
             uniformBufferInfo.buffer = uniformBuffers[i];
             uniformBufferInfo.offset = 0;
             uniformBufferInfo.range = sizeof(UniformBufferObject);
 
-            std::array<VkWriteDescriptorSet, 3> descriptorWrites{};
+            std::array<VkWriteDescriptorSet, 4> descriptorWrites{};
             descriptorWrites[0].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
             descriptorWrites[0].dstSet = computeDescriptorSets[i];
             descriptorWrites[0].dstBinding = 0;
@@ -882,9 +1989,9 @@ private:
             descriptorWrites[0].pBufferInfo = &uniformBufferInfo;
 
             VkDescriptorBufferInfo storageBufferInfoLastFrame{};
-            storageBufferInfoLastFrame.buffer = shaderStorageBuffers[(i - 1) % MAX_FRAMES_IN_FLIGHT];
+            storageBufferInfoLastFrame.buffer = particlePositionBuffers[(i + particleBufferCount - 1) % particleBufferCount];
             storageBufferInfoLastFrame.offset = 0;
-            storageBufferInfoLastFrame.range = sizeof(Particle) * PARTICLE_COUNT;
+            storageBufferInfoLastFrame.range = VK_WHOLE_SIZE;
 
             descriptorWrites[1].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
             descriptorWrites[1].dstSet = computeDescriptorSets[i];
@@ -895,9 +2002,9 @@ private:
             descriptorWrites[1].pBufferInfo = &storageBufferInfoLastFrame;
 
             VkDescriptorBufferInfo storageBufferInfoCurrentFrame{};
-            storageBufferInfoCurrentFrame.buffer = shaderStorageBuffers[i];
+            storageBufferInfoCurrentFrame.buffer = particlePositionBuffers[i];
             storageBufferInfoCurrentFrame.offset = 0;
-            storageBufferInfoCurrentFrame.range = sizeof(Particle) * PARTICLE_COUNT;
+            storageBufferInfoCurrentFrame.range = VK_WHOLE_SIZE;
 
             descriptorWrites[2].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
             descriptorWrites[2].dstSet = computeDescriptorSets[i];
@@ -907,18 +2014,40 @@ private:
             descriptorWrites[2].descriptorCount = 1;
             descriptorWrites[2].pBufferInfo = &storageBufferInfoCurrentFrame;
 
-            vkUpdateDescriptorSets(device, 3, descriptorWrites.data(), 0, nullptr);
+            VkDescriptorBufferInfo velocityBufferInfo{};
+            velocityBufferInfo.buffer = particleVelocityBuffer;
+            velocityBufferInfo.offset = 0;
+            velocityBufferInfo.range = VK_WHOLE_SIZE;
+
+            descriptorWrites[3].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+            descriptorWrites[3].dstSet = computeDescriptorSets[i];
+            descriptorWrites[3].dstBinding = 3;
+            descriptorWrites[3].dstArrayElement = 0;
+            descriptorWrites[3].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+            descriptorWrites[3].descriptorCount = 1;
+            descriptorWrites[3].pBufferInfo = &velocityBufferInfo;
+
+            vkUpdateDescriptorSets(device, static_cast<uint32_t>(descriptorWrites.size()), descriptorWrites.data(), 0, nullptr);
         }
     }
 
 
-    void createBuffer(VkDeviceSize size, VkBufferUsageFlags usage, VkMemoryPropertyFlags properties, VkBuffer& buffer, VkDeviceMemory& bufferMemory) {
+    // Shared buffers can be used by the graphics and compute queue families without ownership transfers
+    void createBuffer(VkDeviceSize size, VkBufferUsageFlags usage, VkMemoryPropertyFlags properties, VkBuffer& buffer, VkDeviceMemory& bufferMemory, bool shared = false) {
+        uint32_t queueFamilies[] = {graphicsQueueFamily, computeQueueFamily};
+
         VkBufferCreateInfo bufferInfo{};
         bufferInfo.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
         bufferInfo.size = size;
         bufferInfo.usage = usage;
         bufferInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
 
+        if (shared && graphicsQueueFamily != computeQueueFamily) {
+            bufferInfo.sharingMode = VK_SHARING_MODE_CONCURRENT;
+            bufferInfo.queueFamilyIndexCount = 2;
+            bufferInfo.pQueueFamilyIndices = queueFamilies;
+        }
+
         if (vkCreateBuffer(device, &bufferInfo, nullptr, &buffer) != VK_SUCCESS) {
             throw std::runtime_error("failed to create buffer!");
         }
@@ -938,11 +2067,12 @@ private:
         vkBindBufferMemory(device, buffer, bufferMemory, 0);
     }
 
-    void copyBuffer(VkBuffer srcBuffer, VkBuffer dstBuffer, VkDeviceSize size) {
+    // Single time commands run on the compute queue
+    VkCommandBuffer beginSingleTimeCommands() {
         VkCommandBufferAllocateInfo allocInfo{};
         allocInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
         allocInfo.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
-        allocInfo.commandPool = commandPool;
+        allocInfo.commandPool = computeCommandPool;
         allocInfo.commandBufferCount = 1;
 
         VkCommandBuffer commandBuffer;
@@ -954,10 +2084,10 @@ private:
 
         vkBeginCommandBuffer(commandBuffer, &beginInfo);
 
-        VkBufferCopy copyRegion{};
-        copyRegion.size = size;
-        vkCmdCopyBuffer(commandBuffer, srcBuffer, dstBuffer, 1, &copyRegion);
+        return commandBuffer;
+    }
 
+    void endSingleTimeCommands(VkCommandBuffer commandBuffer) {
         vkEndCommandBuffer(commandBuffer);
 
         VkSubmitInfo submitInfo{};
@@ -965,10 +2095,42 @@ private:
         submitInfo.commandBufferCount = 1;
         submitInfo.pCommandBuffers = &commandBuffer;
 
-        vkQueueSubmit(graphicsQueue, 1, &submitInfo, VK_NULL_HANDLE);
-        vkQueueWaitIdle(graphicsQueue);
+        vkQueueSubmit(computeQueue, 1, &submitInfo, VK_NULL_HANDLE);
+        vkQueueWaitIdle(computeQueue);
+
+        vkFreeCommandBuffers(device, computeCommandPool, 1, &commandBuffer);
+    }
+
+    // With async compute, particle buffers are handed from the compute to the graphics queue
+    // family with a release barrier on the compute queue and a matching acquire barrier on the
+    // graphics queue. Nothing is handed back: the simulation overwrites the whole buffer, so
+    // it doesn't need the contents graphics leaves behind.
+    VkBufferMemoryBarrier particleBufferOwnershipBarrier(VkBuffer buffer) {
+        VkBufferMemoryBarrier barrier{};
+        barrier.sType = VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER;
+        barrier.srcQueueFamilyIndex = computeQueueFamily;
+        barrier.dstQueueFamilyIndex = graphicsQueueFamily;
+        barrier.buffer = buffer;
+        barrier.offset = 0;
+        barrier.size = VK_WHOLE_SIZE;
+
+        return barrier;
+    }
+
+    void releaseParticleBuffer(VkCommandBuffer commandBuffer, VkBuffer buffer, VkPipelineStageFlags srcStage, VkAccessFlags srcAccess) {
+        VkBufferMemoryBarrier barrier = particleBufferOwnershipBarrier(buffer);
+        barrier.srcAccessMask = srcAccess;
+        barrier.dstAccessMask = 0;
+
+        vkCmdPipelineBarrier(commandBuffer, srcStage, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, 0, 0, nullptr, 1, &barrier, 0, nullptr);
+    }
+
+    void acquireParticleBuffer(VkCommandBuffer commandBuffer, VkBuffer buffer) {
+        VkBufferMemoryBarrier barrier = particleBufferOwnershipBarrier(buffer);
+        barrier.srcAccessMask = 0;
+        barrier.dstAccessMask = VK_ACCESS_VERTEX_ATTRIBUTE_READ_BIT;
 
-        vkFreeCommandBuffers(device, commandPool, 1, &commandBuffer);
+        vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, VK_PIPELINE_STAGE_VERTEX_INPUT_BIT, 0, 0, nullptr, 1, &barrier, 0, nullptr);
     }
 
     uint32_t findMemoryType(uint32_t typeFilter, VkMemoryPropertyFlags properties) {
@@ -985,7 +2147,7 @@ private:
     }
 
     void createCommandBuffers() {
-        commandBuffers.resize(MAX_FRAMES_IN_FLIGHT);
+        commandBuffers.resize(options.framesInFlight);
 
         VkCommandBufferAllocateInfo allocInfo{};
         allocInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
@@ -999,11 +2161,11 @@ private:
     }
 
     void createComputeCommandBuffers() {
-        computeCommandBuffers.resize(MAX_FRAMES_IN_FLIGHT);
+        computeCommandBuffers.resize(options.framesInFlight);
 
         VkCommandBufferAllocateInfo allocInfo{};
         allocInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
-        allocInfo.commandPool = commandPool;
+        allocInfo.commandPool = computeCommandPool;
         allocInfo.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
         allocInfo.commandBufferCount = (uint32_t)computeCommandBuffers.size();
 
@@ -1012,7 +2174,7 @@ private:
         }
     }
 
-    void recordCommandBuffer(VkCommandBuffer commandBuffer, uint32_t imageIndex) {
+    void recordCommandBuffer(VkCommandBuffer commandBuffer, uint32_t imageIndex, uint32_t particleBuffer) {
         VkCommandBufferBeginInfo beginInfo{};
         beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
 
@@ -1020,6 +2182,10 @@ private:
             throw std::runtime_error("failed to begin recording command buffer!");
         }
 
+        if (asyncCompute) {
+            acquireParticleBuffer(commandBuffer, particlePositionBuffers[particleBuffer]);
+        }
+
         VkRenderPassBeginInfo renderPassInfo{};
         renderPassInfo.sType = VK_STRUCTURE_TYPE_RENDER_PASS_BEGIN_INFO;
         renderPassInfo.renderPass = renderPass;
@@ -1031,6 +2197,8 @@ private:
         renderPassInfo.clearValueCount = 1;
         renderPassInfo.pClearValues = &clearColor;
 
+        gpuProfiler.beginScope(commandBuffer, currentFrame, PROFILER_SCOPE_RENDER_PASS);
+
         vkCmdBeginRenderPass(commandBuffer, &renderPassInfo, VK_SUBPASS_CONTENTS_INLINE);
 
             vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, graphicsPipeline);
@@ -1049,19 +2217,41 @@ private:
             scissor.extent = swapChainExtent;
             vkCmdSetScissor(commandBuffer, 0, 1, &scissor);            
 
-            VkDeviceSize offsets[] = {0};
-            vkCmdBindVertexBuffers(commandBuffer, 0, 1, &shaderStorageBuffers[currentFrame], offsets);
+            VkBuffer vertexBuffers[] = {particlePositionBuffers[particleBuffer], particleColorBuffer};
+            VkDeviceSize offsets[] = {0, 0};
+            vkCmdBindVertexBuffers(commandBuffer, 0, 2, vertexBuffers, offsets);
 
-            vkCmdDraw(commandBuffer, PARTICLE_COUNT, 1, 0, 0);
+            vkCmdDraw(commandBuffer, options.particleCount, 1, 0, 0);
 
         vkCmdEndRenderPass(commandBuffer);
 
+        gpuProfiler.endScope(commandBuffer, currentFrame, PROFILER_SCOPE_RENDER_PASS);
+
+        if (vkEndCommandBuffer(commandBuffer) != VK_SUCCESS) {
+            throw std::runtime_error("failed to record command buffer!");
+        }
+    }
+
+    // Stands in for a frame that is not drawn because the swap chain was out of date. It
+    // completes the ownership transfer the simulation started for this frame.
+    void recordSkippedFrameCommandBuffer(VkCommandBuffer commandBuffer, uint32_t particleBuffer) {
+        VkCommandBufferBeginInfo beginInfo{};
+        beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+
+        if (vkBeginCommandBuffer(commandBuffer, &beginInfo) != VK_SUCCESS) {
+            throw std::runtime_error("failed to begin recording command buffer!");
+        }
+
+        if (asyncCompute) {
+            acquireParticleBuffer(commandBuffer, particlePositionBuffers[particleBuffer]);
+        }
+
         if (vkEndCommandBuffer(commandBuffer) != VK_SUCCESS) {
             throw std::runtime_error("failed to record command buffer!");
         }
     }
 
-    void recordComputeCommandBuffer(VkCommandBuffer commandBuffer) {
+    void recordComputeCommandBuffer(VkCommandBuffer commandBuffer, uint32_t particleBuffer) {
         VkCommandBufferBeginInfo beginInfo{};
         beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
 
@@ -1069,11 +2259,30 @@ private:
             throw std::runtime_error("failed to begin recording compute command buffer!");
         }
 
+        gpuProfiler.beginScope(commandBuffer, currentFrame, PROFILER_SCOPE_COMPUTE);
+
         vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, computePipeline);
 
-        vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, computePipelineLayout, 0, 1, &computeDescriptorSets[currentFrame], 0, nullptr);
+        vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, computePipelineLayout, 0, 1, &computeDescriptorSets[particleBuffer], 0, nullptr);
+
+        ComputePushConstants pushConstants{options.particleCount};
+        vkCmdPushConstants(commandBuffer, computePipelineLayout, VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(pushConstants), &pushConstants);
+
+        // Round up so the last partial workgroup is dispatched too; the shader skips the
+        // invocations past the end. Rows of workgroups are used once a single row would
+        // exceed the device's limit (at least 65535 groups, ~16M particles).
+        uint32_t groupCount = (options.particleCount + PARTICLE_WORKGROUP_SIZE - 1) / PARTICLE_WORKGROUP_SIZE;
+        uint32_t groupCountX = std::min(groupCount, maxComputeWorkGroupCountX);
+        uint32_t groupCountY = (groupCount + groupCountX - 1) / groupCountX;
+        vkCmdDispatch(commandBuffer, groupCountX, groupCountY, 1);
+
+        gpuProfiler.endScope(commandBuffer, currentFrame, PROFILER_SCOPE_COMPUTE);
 
-        vkCmdDispatch(commandBuffer, PARTICLE_COUNT / 256, 1, 1);
+        // The input of this step is what graphics draws next frame
+        if (asyncCompute) {
+            VkBuffer input = particlePositionBuffers[(particleBuffer + particleBufferCount - 1) % particleBufferCount];
+            releaseParticleBuffer(commandBuffer, input, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_ACCESS_SHADER_WRITE_BIT);
+        }
 
         if (vkEndCommandBuffer(commandBuffer) != VK_SUCCESS) {
             throw std::runtime_error("failed to record compute command buffer!");
@@ -1081,31 +2290,26 @@ private:
 
     }
 
+    void createGpuProfiler() {
+        gpuProfiler.init(physicalDevice, device, options.framesInFlight, {{"compute", computeQueueFamily}, {"render pass", graphicsQueueFamily}});
+        gpuProfiler.trackOverlap(PROFILER_SCOPE_COMPUTE, PROFILER_SCOPE_RENDER_PASS);
+    }
+
     void createSyncObjects() {
-        imageAvailableSemaphores.resize(MAX_FRAMES_IN_FLIGHT);
-        renderFinishedSemaphores.resize(MAX_FRAMES_IN_FLIGHT);
-        computeFinishedSemaphores.resize(MAX_FRAMES_IN_FLIGHT);
-        inFlightFences.resize(MAX_FRAMES_IN_FLIGHT);
-        computeInFlightFences.resize(MAX_FRAMES_IN_FLIGHT);
+        imageAvailableSemaphores.resize(options.framesInFlight);
+        renderFinishedSemaphores.resize(options.framesInFlight);
 
         VkSemaphoreCreateInfo semaphoreInfo{};
         semaphoreInfo.sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO;
 
-        VkFenceCreateInfo fenceInfo{};
-        fenceInfo.sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO;
-        fenceInfo.flags = VK_FENCE_CREATE_SIGNALED_BIT;
-
-        for (size_t i = 0; i < MAX_FRAMES_IN_FLIGHT; i++) {
+        for (size_t i = 0; i < options.framesInFlight; i++) {
             if (vkCreateSemaphore(device, &semaphoreInfo, nullptr, &imageAvailableSemaphores[i]) != VK_SUCCESS ||
-                vkCreateSemaphore(device, &semaphoreInfo, nullptr, &renderFinishedSemaphores[i]) != VK_SUCCESS ||
-                vkCreateFence(device, &fenceInfo, nullptr, &inFlightFences[i]) != VK_SUCCESS) {
-                throw std::runtime_error("failed to create graphics synchronization objects for a frame!");
-            }
-            if (vkCreateSemaphore(device, &semaphoreInfo, nullptr, &computeFinishedSemaphores[i]) != VK_SUCCESS ||
-                vkCreateFence(device, &fenceInfo, nullptr, &computeInFlightFences[i]) != VK_SUCCESS) {
-                throw std::runtime_error("failed to create compute synchronization objects for a frame!");
+                vkCreateSemaphore(device, &semaphoreInfo, nullptr, &renderFinishedSemaphores[i]) != VK_SUCCESS) {
+                throw std::runtime_error("failed to create synchronization objects for a frame!");
             }
         }
+
+        frameScheduler.init(device, options.framesInFlight);
     }
 
     void updateUniformBuffer(uint32_t currentImage) {
@@ -1116,63 +2320,73 @@ private:
     }
 
     void drawFrame() {
-        VkSubmitInfo submitInfo{};
-        submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+        frameScheduler.beginFrame();
+        currentFrame = frameScheduler.frameIndex();
+        uint64_t frame = frameScheduler.currentFrameNumber();
+        uint32_t framesInFlight = frameScheduler.getFramesInFlight();
 
-        // Compute submission        
-        vkWaitForFences(device, 1, &computeInFlightFences[currentFrame], VK_TRUE, UINT64_MAX);
-
-        updateUniformBuffer(currentFrame);
-
-        vkResetFences(device, 1, &computeInFlightFences[currentFrame]);
+        // Compute submission
+        uint32_t particleBuffer = static_cast<uint32_t>(frame % particleBufferCount);
+        updateUniformBuffer(particleBuffer);
 
         vkResetCommandBuffer(computeCommandBuffers[currentFrame], /*VkCommandBufferResetFlagBits*/ 0);
-        recordComputeCommandBuffer(computeCommandBuffers[currentFrame]);
-
-        submitInfo.commandBufferCount = 1;
-        submitInfo.pCommandBuffers = &computeCommandBuffers[currentFrame];
-        submitInfo.signalSemaphoreCount = 1;
-        submitInfo.pSignalSemaphores = &computeFinishedSemaphores[currentFrame];
+        recordComputeCommandBuffer(computeCommandBuffers[currentFrame], particleBuffer);
 
-        if (vkQueueSubmit(computeQueue, 1, &submitInfo, computeInFlightFences[currentFrame]) != VK_SUCCESS) {
-            throw std::runtime_error("failed to submit compute command buffer!");
+        // The particles are integrated from the previous frame's output, and this frame's
+        // output buffer may still be the vertex buffer of an older frame being drawn
+        std::vector<SemaphoreWait> computeWaits = {
+            frameScheduler.waitFor(SCHEDULER_QUEUE_COMPUTE, frame - 1, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT)
         };
+        if (frame > framesInFlight) {
+            computeWaits.push_back(frameScheduler.waitFor(SCHEDULER_QUEUE_GRAPHICS, frame - framesInFlight, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT));
+        }
 
-        // Graphics submission
-        vkWaitForFences(device, 1, &inFlightFences[currentFrame], VK_TRUE, UINT64_MAX);
-
-        uint32_t imageIndex;
-        VkResult result = vkAcquireNextImageKHR(device, swapChain, UINT64_MAX, imageAvailableSemaphores[currentFrame], VK_NULL_HANDLE, &imageIndex);
+        frameScheduler.submit(computeQueue, SCHEDULER_QUEUE_COMPUTE, computeCommandBuffers[currentFrame], computeWaits);
 
-        if (result == VK_ERROR_OUT_OF_DATE_KHR) {
-            recreateSwapChain();
-            return;
-        } else if (result != VK_SUCCESS && result != VK_SUBOPTIMAL_KHR) {
-            throw std::runtime_error("failed to acquire swap chain image!");
+        // Graphics submission
+        uint32_t imageIndex = currentFrame;
+        bool imageAcquired = true;
+        if (!options.headless) {
+            VkResult result = vkAcquireNextImageKHR(device, swapChain, UINT64_MAX, imageAvailableSemaphores[currentFrame], VK_NULL_HANDLE, &imageIndex);
+
+            if (result == VK_ERROR_OUT_OF_DATE_KHR) {
+                recreateSwapChain();
+                imageAcquired = false;
+            } else if (result != VK_SUCCESS && result != VK_SUBOPTIMAL_KHR) {
+                throw std::runtime_error("failed to acquire swap chain image!");
+            }
         }
 
-        vkResetFences(device, 1, &inFlightFences[currentFrame]);
+        // With async compute, rendering only depends on the previous simulation step, which
+        // released its input buffer to graphics. This frame's step runs at the same time.
+        uint32_t drawnParticleBuffer = particleBuffer;
+        uint64_t drawnComputeFrame = frame;
+        if (asyncCompute) {
+            drawnParticleBuffer = static_cast<uint32_t>((frame + particleBufferCount - 2) % particleBufferCount);
+            drawnComputeFrame = frame - 1;
+        }
 
         vkResetCommandBuffer(commandBuffers[currentFrame], /*VkCommandBufferResetFlagBits*/ 0);
-        recordCommandBuffer(commandBuffers[currentFrame], imageIndex);
-
-        VkSemaphore waitSemaphores[] = { computeFinishedSemaphores[currentFrame], imageAvailableSemaphores[currentFrame] };
-        VkPipelineStageFlags waitStages[] = { VK_PIPELINE_STAGE_VERTEX_INPUT_BIT, VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT };
-        submitInfo = {};
-        submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+        if (imageAcquired) {
+            recordCommandBuffer(commandBuffers[currentFrame], imageIndex, drawnParticleBuffer);
+        } else {
+            recordSkippedFrameCommandBuffer(commandBuffers[currentFrame], drawnParticleBuffer);
+        }
 
-        submitInfo.waitSemaphoreCount = 2;
-        submitInfo.pWaitSemaphores = waitSemaphores;
-        submitInfo.pWaitDstStageMask = waitStages;
-        submitInfo.commandBufferCount = 1;
-        submitInfo.pCommandBuffers = &commandBuffers[currentFrame];
-        submitInfo.signalSemaphoreCount = 1;
-        submitInfo.pSignalSemaphores = &renderFinishedSemaphores[currentFrame];
+        std::vector<SemaphoreWait> graphicsWaits = {
+            frameScheduler.waitFor(SCHEDULER_QUEUE_COMPUTE, drawnComputeFrame, VK_PIPELINE_STAGE_VERTEX_INPUT_BIT)
+        };
 
-        if (vkQueueSubmit(graphicsQueue, 1, &submitInfo, inFlightFences[currentFrame]) != VK_SUCCESS) {
-            throw std::runtime_error("failed to submit draw command buffer!");
+        // Nothing is acquired or presented in headless mode. A frame whose image could not be
+        // acquired is still submitted, because later frames wait for its value on the timeline.
+        if (options.headless || !imageAcquired) {
+            frameScheduler.submit(graphicsQueue, SCHEDULER_QUEUE_GRAPHICS, commandBuffers[currentFrame], graphicsWaits);
+            return;
         }
 
+        graphicsWaits.push_back({imageAvailableSemaphores[currentFrame], 0, VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT});
+        frameScheduler.submit(graphicsQueue, SCHEDULER_QUEUE_GRAPHICS, commandBuffers[currentFrame], graphicsWaits, renderFinishedSemaphores[currentFrame]);
+
         VkPresentInfoKHR presentInfo{};
         presentInfo.sType = VK_STRUCTURE_TYPE_PRESENT_INFO_KHR;
 
@@ -1185,7 +2399,7 @@ private:
 
         presentInfo.pImageIndices = &imageIndex;
 
-        result = vkQueuePresentKHR(presentQueue, &presentInfo);
+        VkResult result = vkQueuePresentKHR(presentQueue, &presentInfo);
 
         if (result == VK_ERROR_OUT_OF_DATE_KHR || result == VK_SUBOPTIMAL_KHR || framebufferResized) {
             framebufferResized = false;
@@ -1193,11 +2407,21 @@ private:
         } else if (result != VK_SUCCESS) {
             throw std::runtime_error("failed to present swap chain image!");
         }
+    }
 
-        currentFrame = (currentFrame + 1) % MAX_FRAMES_IN_FLIGHT;
+    void printPipelineCreationTime(const char* name, std::chrono::high_resolution_clock::time_point start) {
+        auto end = std::chrono::high_resolution_clock::now();
+        float milliseconds = std::chrono::duration<float, std::chrono::milliseconds::period>(end - start).count();
+
+        std::cout << name << " pipeline created in " << milliseconds << " ms (" << (pipelineCacheWarm ? "warm" : "cold") << " pipeline cache)" << std::endl;
     }
 
-    VkShaderModule createShaderModule(const std::vector<char>& code) {
+    VkShaderModule createShaderModule(const MappedFile& code) {
+        // The mapping starts on a page boundary, so the SPIR-V words can be passed to the driver in place
+        if (code.size() % sizeof(uint32_t) != 0 || reinterpret_cast<uintptr_t>(code.data()) % alignof(uint32_t) != 0) {
+            throw std::runtime_error("failed to create shader module!");
+        }
+
         VkShaderModuleCreateInfo createInfo{};
         createInfo.sType = VK_STRUCTURE_TYPE_SHADER_MODULE_CREATE_INFO;
         createInfo.codeSize = code.size();
@@ -1279,13 +2503,32 @@ private:
 
         bool extensionsSupported = checkDeviceExtensionSupport(device);
 
-        bool swapChainAdequate = false;
-        if (extensionsSupported) {
+        bool swapChainAdequate = options.headless;
+        if (extensionsSupported && !options.headless) {
             SwapChainSupportDetails swapChainSupport = querySwapChainSupport(device);
             swapChainAdequate = !swapChainSupport.formats.empty() && !swapChainSupport.presentModes.empty();
         }
 
-        return indices.isComplete() && extensionsSupported && swapChainAdequate;
+        return indices.isComplete() && extensionsSupported && swapChainAdequate && checkTimelineSemaphoreSupport(device);
+    }
+
+    bool checkTimelineSemaphoreSupport(VkPhysicalDevice device) {
+        VkPhysicalDeviceProperties properties;
+        vkGetPhysicalDeviceProperties(device, &properties);
+
+        if (properties.apiVersion < VK_API_VERSION_1_2) {
+            return false;
+        }
+
+        VkPhysicalDeviceVulkan12Features vulkan12Features{};
+        vulkan12Features.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_VULKAN_1_2_FEATURES;
+
+        VkPhysicalDeviceFeatures2 features{};
+        features.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_FEATURES_2;
+        features.pNext = &vulkan12Features;
+        vkGetPhysicalDeviceFeatures2(device, &features);
+
+        return vulkan12Features.timelineSemaphore;
     }
 
     bool checkDeviceExtensionSupport(VkPhysicalDevice device) {
@@ -1295,7 +2538,8 @@ private:
         std::vector<VkExtensionProperties> availableExtensions(extensionCount);
         vkEnumerateDeviceExtensionProperties(device, nullptr, &extensionCount, availableExtensions.data());
 
-        std::set<std::string> requiredExtensions(deviceExtensions.begin(), deviceExtensions.end());
+        auto extensions = getRequiredDeviceExtensions();
+        std::set<std::string> requiredExtensions(extensions.begin(), extensions.end());
 
         for (const auto& extension : availableExtensions) {
             requiredExtensions.erase(extension.extensionName);
@@ -1315,19 +2559,28 @@ private:
 
         int i = 0;
         for (const auto& queueFamily : queueFamilies) {
-            if ((queueFamily.queueFlags & VK_QUEUE_GRAPHICS_BIT) && (queueFamily.queueFlags & VK_QUEUE_COMPUTE_BIT)) {
-                indices.graphicsAndComputeFamily = i;
-            }
+            if (!indices.isComplete()) {
+                if ((queueFamily.queueFlags & VK_QUEUE_GRAPHICS_BIT) && (queueFamily.queueFlags & VK_QUEUE_COMPUTE_BIT)) {
+                    indices.graphicsAndComputeFamily = i;
+                }
 
-            VkBool32 presentSupport = false;
-            vkGetPhysicalDeviceSurfaceSupportKHR(device, i, surface, &presentSupport);
+                VkBool32 presentSupport = false;
+                if (options.headless) {
+                    // Nothing is presented, the graphics family stands in for the present family
+                    presentSupport = (queueFamily.queueFlags & VK_QUEUE_GRAPHICS_BIT) != 0;
+                } else {
+                    vkGetPhysicalDeviceSurfaceSupportKHR(device, i, surface, &presentSupport);
+                }
 
-            if (presentSupport) {
-                indices.presentFamily = i;
+                if (presentSupport) {
+                    indices.presentFamily = i;
+                }
             }
 
-            if (indices.isComplete()) {
-                break;
+            if ((queueFamily.queueFlags & VK_QUEUE_COMPUTE_BIT) && !(queueFamily.queueFlags & VK_QUEUE_GRAPHICS_BIT)) {
+                if (!indices.asyncComputeFamily.has_value()) {
+                    indices.asyncComputeFamily = i;
+                }
             }
 
             i++;
@@ -1337,11 +2590,15 @@ private:
     }
 
     std::vector<const char*> getRequiredExtensions() {
-        uint32_t glfwExtensionCount = 0;
-        const char** glfwExtensions;
-        glfwExtensions = glfwGetRequiredInstanceExtensions(&glfwExtensionCount);
+        std::vector<const char*> extensions;
+
+        if (!options.headless) {
+            uint32_t glfwExtensionCount = 0;
+            const char** glfwExtensions;
+            glfwExtensions = glfwGetRequiredInstanceExtensions(&glfwExtensionCount);
 
-        std::vector<const char*> extensions(glfwExtensions, glfwExtensions + glfwExtensionCount);
+            extensions.assign(glfwExtensions, glfwExtensions + glfwExtensionCount);
+        }
 
         if (enableValidationLayers) {
             extensions.push_back(VK_EXT_DEBUG_UTILS_EXTENSION_NAME);
@@ -1350,6 +2607,15 @@ private:
         return extensions;
     }
 
+    std::vector<const char*> getRequiredDeviceExtensions() {
+        // Headless mode renders into plain images and has no use for a swap chain
+        if (options.headless) {
+            return {};
+        }
+
+        return deviceExtensions;
+    }
+
     bool checkValidationLayerSupport() {
         uint32_t layerCount;
         vkEnumerateInstanceLayerProperties(&layerCount, nullptr);
@@ -1375,22 +2641,14 @@ private:
         return true;
     }
 
-    static std::vector<char> readFile(const std::string& filename) {
-        std::ifstream file(filename, std::ios::ate | std::ios::binary);
+    static MappedFile readFile(const std::string& filename) {
+        MappedFile file;
 
-        if (!file.is_open()) {
+        if (!file.open(filename)) {
             throw std::runtime_error("failed to open file!");
         }
 
-        size_t fileSize = (size_t) file.tellg();
-        std::vector<char> buffer(fileSize);
-
-        file.seekg(0);
-        file.read(buffer.data(), fileSize);
-
-        file.close();
-
-        return buffer;
+        return file;
     }
 
     static VKAPI_ATTR VkBool32 VKAPI_CALL debugCallback(VkDebugUtilsMessageSeverityFlagBitsEXT messageSeverity, VkDebugUtilsMessageTypeFlagsEXT messageType, const VkDebugUtilsMessengerCallbackDataEXT* pCallbackData, void* pUserData) {
@@ -1400,11 +2658,11 @@ private:
     }
 };
 
-int main() {
+int main(int argc, char** argv) {
     ComputeShaderApplication app;
 
     try {
-        app.run();
+        app.run(parseArguments(argc, argv));
     } catch (const std::exception& e) {
         std::cerr << e.what() << std::endl;
         return EXIT_FAILURE;
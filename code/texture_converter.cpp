@@ -0,0 +1,569 @@
+// Offline tool that turns an image into KTX2 files with block compressed formats and a
+// prebuilt mip chain, so the chapters can upload textures without decoding them first.
+//
+// Usage: texture_converter <input image> <output prefix>
+//
+// Writes <output prefix>_bc7.ktx2, <output prefix>_bc1.ktx2 and <output prefix>_etc2.ktx2.
+// The encoders favour simplicity over quality: BC7 only uses mode 6, BC1 fits the
+// endpoints along the principal axis and ETC2 only emits ETC1 compatible blocks.
+
+#include <vulkan/vulkan.h>
+
+#define STB_IMAGE_IMPLEMENTATION
+#include <stb_image.h>
+
+#include <iostream>
+#include <fstream>
+#include <stdexcept>
+#include <algorithm>
+#include <vector>
+#include <string>
+#include <array>
+#include <cmath>
+#include <cstring>
+#include <cstdlib>
+#include <cstdint>
+
+struct Image {
+    uint32_t width;
+    uint32_t height;
+    std::vector<uint8_t> pixels; // RGBA8, sRGB encoded
+};
+
+struct Color {
+    float channels[4];
+};
+
+float srgbToLinear(uint8_t value) {
+    float c = value / 255.0f;
+    return c <= 0.04045f ? c / 12.92f : std::pow((c + 0.055f) / 1.055f, 2.4f);
+}
+
+uint8_t linearToSrgb(float value) {
+    float c = value <= 0.0031308f ? value * 12.92f : 1.055f * std::pow(value, 1.0f / 2.4f) - 0.055f;
+    return static_cast<uint8_t>(std::clamp(c * 255.0f + 0.5f, 0.0f, 255.0f));
+}
+
+// Halves both dimensions with a box filter, averaging the colors in linear space
+Image downsample(const Image& source) {
+    Image result;
+    result.width = std::max(1u, source.width / 2);
+    result.height = std::max(1u, source.height / 2);
+    result.pixels.resize(result.width * result.height * 4);
+
+    for (uint32_t y = 0; y < result.height; y++) {
+        for (uint32_t x = 0; x < result.width; x++) {
+            uint32_t x0 = std::min(x * 2, source.width - 1), x1 = std::min(x * 2 + 1, source.width - 1);
+            uint32_t y0 = std::min(y * 2, source.height - 1), y1 = std::min(y * 2 + 1, source.height - 1);
+            const uint8_t* texels[] = {
+                &source.pixels[(y0 * source.width + x0) * 4], &source.pixels[(y0 * source.width + x1) * 4],
+                &source.pixels[(y1 * source.width + x0) * 4], &source.pixels[(y1 * source.width + x1) * 4]
+            };
+
+            uint8_t* destination = &result.pixels[(y * result.width + x) * 4];
+            for (int c = 0; c < 3; c++) {
+                float sum = 0.0f;
+                for (const uint8_t* texel : texels) {
+                    sum += srgbToLinear(texel[c]);
+                }
+                destination[c] = linearToSrgb(sum / 4.0f);
+            }
+
+            uint32_t alpha = 0;
+            for (const uint8_t* texel : texels) {
+                alpha += texel[3];
+            }
+            destination[3] = static_cast<uint8_t>((alpha + 2) / 4);
+        }
+    }
+
+    return result;
+}
+
+// Fetches a 4x4 block, replicating the edge texels of images that aren't a multiple of 4
+void fetchBlock(const Image& image, uint32_t blockX, uint32_t blockY, uint8_t block[16][4]) {
+    for (uint32_t y = 0; y < 4; y++) {
+        for (uint32_t x = 0; x < 4; x++) {
+            uint32_t sourceX = std::min(blockX * 4 + x, image.width - 1);
+            uint32_t sourceY = std::min(blockY * 4 + y, image.height - 1);
+            memcpy(block[y * 4 + x], &image.pixels[(sourceY * image.width + sourceX) * 4], 4);
+        }
+    }
+}
+
+int colorDistance(const uint8_t* a, const uint8_t* b, int channelCount) {
+    int distance = 0;
+    for (int c = 0; c < channelCount; c++) {
+        int delta = int(a[c]) - int(b[c]);
+        distance += delta * delta;
+    }
+    return distance;
+}
+
+// Returns the two extremes of the block along its principal axis
+void fitEndpoints(const uint8_t block[16][4], int channelCount, Color& low, Color& high) {
+    float mean[4] = {};
+    for (int i = 0; i < 16; i++) {
+        for (int c = 0; c < channelCount; c++) {
+            mean[c] += block[i][c] / 16.0f;
+        }
+    }
+
+    float covariance[4][4] = {};
+    for (int i = 0; i < 16; i++) {
+        for (int a = 0; a < channelCount; a++) {
+            for (int b = 0; b < channelCount; b++) {
+                covariance[a][b] += (block[i][a] - mean[a]) * (block[i][b] - mean[b]);
+            }
+        }
+    }
+
+    // Power iteration for the dominant eigenvector
+    float axis[4] = {1.0f, 1.0f, 1.0f, 1.0f};
+    for (int iteration = 0; iteration < 8; iteration++) {
+        float next[4] = {};
+        float length = 0.0f;
+        for (int a = 0; a < channelCount; a++) {
+            for (int b = 0; b < channelCount; b++) {
+                next[a] += covariance[a][b] * axis[b];
+            }
+            length += next[a] * next[a];
+        }
+
+        if (length < 1e-6f) {
+            break;
+        }
+
+        length = std::sqrt(length);
+        for (int a = 0; a < channelCount; a++) {
+            axis[a] = next[a] / length;
+        }
+    }
+
+    float minProjection = 0.0f, maxProjection = 0.0f;
+    for (int i = 0; i < 16; i++) {
+        float projection = 0.0f;
+        for (int c = 0; c < channelCount; c++) {
+            projection += (block[i][c] - mean[c]) * axis[c];
+        }
+        minProjection = std::min(minProjection, projection);
+        maxProjection = std::max(maxProjection, projection);
+    }
+
+    for (int c = 0; c < 4; c++) {
+        float value = c < channelCount ? mean[c] : 255.0f;
+        float direction = c < channelCount ? axis[c] : 0.0f;
+        low.channels[c] = std::clamp(value + direction * minProjection, 0.0f, 255.0f);
+        high.channels[c] = std::clamp(value + direction * maxProjection, 0.0f, 255.0f);
+    }
+}
+
+void encodeBC1Block(const uint8_t block[16][4], uint8_t* output) {
+    Color low, high;
+    fitEndpoints(block, 3, low, high);
+
+    auto pack565 = [](const Color& color) {
+        uint16_t r = static_cast<uint16_t>(std::lround(color.channels[0] * 31.0f / 255.0f));
+        uint16_t g = static_cast<uint16_t>(std::lround(color.channels[1] * 63.0f / 255.0f));
+        uint16_t b = static_cast<uint16_t>(std::lround(color.channels[2] * 31.0f / 255.0f));
+        return static_cast<uint16_t>((r << 11) | (g << 5) | b);
+    };
+
+    uint16_t color0 = pack565(high);
+    uint16_t color1 = pack565(low);
+
+    // color0 > color1 selects the four color mode
+    if (color0 < color1) {
+        std::swap(color0, color1);
+    }
+
+    uint8_t palette[4][4] = {};
+    for (int i = 0; i < 2; i++) {
+        uint16_t packed = i == 0 ? color0 : color1;
+        uint8_t r = (packed >> 11) & 31, g = (packed >> 5) & 63, b = packed & 31;
+        palette[i][0] = static_cast<uint8_t>((r << 3) | (r >> 2));
+        palette[i][1] = static_cast<uint8_t>((g << 2) | (g >> 4));
+        palette[i][2] = static_cast<uint8_t>((b << 3) | (b >> 2));
+    }
+    for (int c = 0; c < 3; c++) {
+        palette[2][c] = static_cast<uint8_t>((2 * palette[0][c] + palette[1][c]) / 3);
+        palette[3][c] = static_cast<uint8_t>((palette[0][c] + 2 * palette[1][c]) / 3);
+    }
+
+    uint32_t indices = 0;
+    if (color0 != color1) {
+        for (int i = 0; i < 16; i++) {
+            int bestIndex = 0;
+            int bestDistance = colorDistance(block[i], palette[0], 3);
+            for (int p = 1; p < 4; p++) {
+                int distance = colorDistance(block[i], palette[p], 3);
+                if (distance < bestDistance) {
+                    bestDistance = distance;
+                    bestIndex = p;
+                }
+            }
+            indices |= static_cast<uint32_t>(bestIndex) << (i * 2);
+        }
+    }
+
+    output[0] = color0 & 0xFF;
+    output[1] = color0 >> 8;
+    output[2] = color1 & 0xFF;
+    output[3] = color1 >> 8;
+    for (int i = 0; i < 4; i++) {
+        output[4 + i] = (indices >> (i * 8)) & 0xFF;
+    }
+}
+
+class BitWriter {
+public:
+    explicit BitWriter(uint8_t* output) : output(output) {
+        memset(output, 0, 16);
+    }
+
+    void write(uint32_t value, int bitCount) {
+        for (int i = 0; i < bitCount; i++, position++) {
+            if (value & (1u << i)) {
+                output[position / 8] |= 1 << (position % 8);
+            }
+        }
+    }
+
+private:
+    uint8_t* output;
+    int position = 0;
+};
+
+// Mode 6: a single subset with 7.7.7.7 endpoints, a p-bit per endpoint and 4-bit indices
+void encodeBC7Block(const uint8_t block[16][4], uint8_t* output) {
+    static const int weights[16] = {0, 4, 9, 13, 17, 21, 26, 30, 34, 38, 43, 47, 51, 55, 60, 64};
+
+    Color fitted[2];
+    fitEndpoints(block, 4, fitted[0], fitted[1]);
+
+    // Pick the p-bit that reproduces each endpoint best
+    uint8_t endpoints[2][4];
+    uint32_t quantized[2][4];
+    uint32_t pBits[2];
+    for (int e = 0; e < 2; e++) {
+        float bestError = -1.0f;
+        for (uint32_t p = 0; p < 2; p++) {
+            float error = 0.0f;
+            uint32_t candidate[4];
+            for (int c = 0; c < 4; c++) {
+                candidate[c] = static_cast<uint32_t>(std::clamp(std::lround((fitted[e].channels[c] - p) / 2.0f), 0L, 127L));
+                float delta = float((candidate[c] << 1) | p) - fitted[e].channels[c];
+                error += delta * delta;
+            }
+            if (bestError < 0.0f || error < bestError) {
+                bestError = error;
+                pBits[e] = p;
+                memcpy(quantized[e], candidate, sizeof(candidate));
+            }
+        }
+        for (int c = 0; c < 4; c++) {
+            endpoints[e][c] = static_cast<uint8_t>((quantized[e][c] << 1) | pBits[e]);
+        }
+    }
+
+    uint8_t palette[16][4];
+    for (int i = 0; i < 16; i++) {
+        for (int c = 0; c < 4; c++) {
+            palette[i][c] = static_cast<uint8_t>(((64 - weights[i]) * endpoints[0][c] + weights[i] * endpoints[1][c] + 32) >> 6);
+        }
+    }
+
+    uint32_t indices[16];
+    for (int i = 0; i < 16; i++) {
+        int bestDistance = colorDistance(block[i], palette[0], 4);
+        indices[i] = 0;
+        for (uint32_t p = 1; p < 16; p++) {
+            int distance = colorDistance(block[i], palette[p], 4);
+            if (distance < bestDistance) {
+                bestDistance = distance;
+                indices[i] = p;
+            }
+        }
+    }
+
+    // The most significant bit of the first index is implied to be 0
+    if (indices[0] & 8) {
+        std::swap(quantized[0], quantized[1]);
+        std::swap(pBits[0], pBits[1]);
+        for (auto& index : indices) {
+            index = 15 - index;
+        }
+    }
+
+    BitWriter writer(output);
+    writer.write(1 << 6, 7);
+    for (int c = 0; c < 4; c++) {
+        writer.write(quantized[0][c], 7);
+        writer.write(quantized[1][c], 7);
+    }
+    writer.write(pBits[0], 1);
+    writer.write(pBits[1], 1);
+    writer.write(indices[0], 3);
+    for (int i = 1; i < 16; i++) {
+        writer.write(indices[i], 4);
+    }
+}
+
+// ETC1 blocks decode identically as ETC2, so only the individual and differential modes are used
+void encodeETC2Block(const uint8_t block[16][4], uint8_t* output) {
+    static const int modifierTable[8][2] = {{2, 8}, {5, 17}, {9, 29}, {13, 42}, {18, 60}, {24, 80}, {33, 106}, {47, 183}};
+    // Pixel index values 0..3 select +a, +b, -a, -b
+    static const int modifierSign[4] = {1, 1, -1, -1};
+    static const int modifierColumn[4] = {0, 1, 0, 1};
+
+    uint64_t bestBits = 0;
+    int64_t bestError = -1;
+
+    for (uint32_t flip = 0; flip < 2; flip++) {
+        // Texels are addressed column-major, as in the index bits
+        std::array<std::array<int, 8>, 2> subBlocks;
+        int counts[2] = {};
+        for (int x = 0; x < 4; x++) {
+            for (int y = 0; y < 4; y++) {
+                int subBlock = flip ? (y >= 2) : (x >= 2);
+                subBlocks[subBlock][counts[subBlock]++] = x * 4 + y;
+            }
+        }
+
+        float averages[2][3] = {};
+        for (int s = 0; s < 2; s++) {
+            for (int texel : subBlocks[s]) {
+                for (int c = 0; c < 3; c++) {
+                    averages[s][c] += block[(texel % 4) * 4 + texel / 4][c] / 8.0f;
+                }
+            }
+        }
+
+        int base5[2][3];
+        bool differential = true;
+        for (int s = 0; s < 2; s++) {
+            for (int c = 0; c < 3; c++) {
+                base5[s][c] = static_cast<int>(std::lround(averages[s][c] * 31.0f / 255.0f));
+            }
+        }
+        for (int c = 0; c < 3; c++) {
+            int delta = base5[1][c] - base5[0][c];
+            differential = differential && delta >= -4 && delta <= 3;
+        }
+
+        int baseColors[2][3];
+        uint64_t bits = 0;
+        for (int c = 0; c < 3; c++) {
+            if (differential) {
+                int delta = base5[1][c] - base5[0][c];
+                bits |= uint64_t(base5[0][c]) << (59 - c * 8);
+                bits |= uint64_t(delta & 7) << (56 - c * 8);
+                for (int s = 0; s < 2; s++) {
+                    baseColors[s][c] = (base5[s][c] << 3) | (base5[s][c] >> 2);
+                }
+            } else {
+                for (int s = 0; s < 2; s++) {
+                    int base4 = static_cast<int>(std::lround(averages[s][c] * 15.0f / 255.0f));
+                    bits |= uint64_t(base4) << (60 - c * 8 - s * 4);
+                    baseColors[s][c] = (base4 << 4) | base4;
+                }
+            }
+        }
+        bits |= uint64_t(differential ? 1 : 0) << 33;
+        bits |= uint64_t(flip) << 32;
+
+        int64_t totalError = 0;
+        for (int s = 0; s < 2; s++) {
+            int64_t bestTableError = -1;
+            uint32_t bestTable = 0;
+            uint32_t bestIndices[8] = {};
+
+            for (uint32_t table = 0; table < 8; table++) {
+                int64_t tableError = 0;
+                uint32_t tableIndices[8];
+
+                for (int t = 0; t < 8; t++) {
+                    int texel = subBlocks[s][t];
+                    const uint8_t* color = block[(texel % 4) * 4 + texel / 4];
+
+                    int bestTexelError = -1;
+                    for (uint32_t index = 0; index < 4; index++) {
+                        int modifier = modifierSign[index] * modifierTable[table][modifierColumn[index]];
+                        int error = 0;
+                        for (int c = 0; c < 3; c++) {
+                            int delta = std::clamp(baseColors[s][c] + modifier, 0, 255) - color[c];
+                            error += delta * delta;
+                        }
+                        if (bestTexelError < 0 || error < bestTexelError) {
+                            bestTexelError = error;
+                            tableIndices[t] = index;
+                        }
+                    }
+                    tableError += bestTexelError;
+                }
+
+                if (bestTableError < 0 || tableError < bestTableError) {
+                    bestTableError = tableError;
+                    bestTable = table;
+                    memcpy(bestIndices, tableIndices, sizeof(tableIndices));
+                }
+            }
+
+            bits |= uint64_t(bestTable) << (37 - s * 3);
+            for (int t = 0; t < 8; t++) {
+                int texel = subBlocks[s][t];
+                bits |= uint64_t(bestIndices[t] >> 1) << (16 + texel);
+                bits |= uint64_t(bestIndices[t] & 1) << texel;
+            }
+            totalError += bestTableError;
+        }
+
+        if (bestError < 0 || totalError < bestError) {
+            bestError = totalError;
+            bestBits = bits;
+        }
+    }
+
+    for (int i = 0; i < 8; i++) {
+        output[i] = static_cast<uint8_t>(bestBits >> (56 - i * 8));
+    }
+}
+
+struct TargetFormat {
+    const char* suffix;
+    VkFormat format;
+    uint32_t blockSize;
+    uint8_t dfdColorModel;
+    uint8_t dfdChannelType;
+    void (*encodeBlock)(const uint8_t block[16][4], uint8_t* output);
+};
+
+// Color models and channel types from the Khronos Data Format Specification
+const std::array<TargetFormat, 3> TARGET_FORMATS = {{
+    {"_bc7.ktx2", VK_FORMAT_BC7_SRGB_BLOCK, 16, 134, 0, encodeBC7Block},
+    {"_bc1.ktx2", VK_FORMAT_BC1_RGB_SRGB_BLOCK, 8, 128, 0, encodeBC1Block},
+    {"_etc2.ktx2", VK_FORMAT_ETC2_R8G8B8_SRGB_BLOCK, 8, 161, 2, encodeETC2Block},
+}};
+
+std::vector<uint8_t> compressLevel(const Image& image, const TargetFormat& target) {
+    uint32_t blocksX = (image.width + 3) / 4;
+    uint32_t blocksY = (image.height + 3) / 4;
+    std::vector<uint8_t> data(blocksX * blocksY * target.blockSize);
+
+    uint8_t block[16][4];
+    for (uint32_t y = 0; y < blocksY; y++) {
+        for (uint32_t x = 0; x < blocksX; x++) {
+            fetchBlock(image, x, y, block);
+            target.encodeBlock(block, &data[(y * blocksX + x) * target.blockSize]);
+        }
+    }
+
+    return data;
+}
+
+std::vector<uint32_t> createDataFormatDescriptor(const TargetFormat& target) {
+    const uint32_t blockWords = 6 + 4;
+
+    std::vector<uint32_t> dfd;
+    dfd.push_back(4 * (1 + blockWords)); // dfdTotalSize
+    dfd.push_back(0);                    // vendorId KHRONOS, descriptorType BASICFORMAT
+    dfd.push_back(2 | ((blockWords * 4) << 16)); // versionNumber 2, descriptorBlockSize
+    dfd.push_back(target.dfdColorModel | (1 << 8) | (2 << 16)); // BT.709 primaries, sRGB transfer function
+    dfd.push_back(3 | (3 << 8));         // 4x4 texel blocks
+    dfd.push_back(target.blockSize);     // bytesPlane0
+    dfd.push_back(0);
+    // A single sample covering the whole block
+    dfd.push_back(((target.blockSize * 8 - 1) << 16) | (uint32_t(target.dfdChannelType) << 24));
+    dfd.push_back(0);
+    dfd.push_back(0);
+    dfd.push_back(0xFFFFFFFF);
+
+    return dfd;
+}
+
+void writeKtx2(const std::string& path, const TargetFormat& target, const std::vector<Image>& mipChain) {
+    std::vector<std::vector<uint8_t>> levels;
+    for (const Image& level : mipChain) {
+        levels.push_back(compressLevel(level, target));
+    }
+
+    std::vector<uint32_t> dfd = createDataFormatDescriptor(target);
+
+    const uint8_t identifier[12] = {0xAB, 0x4B, 0x54, 0x58, 0x20, 0x32, 0x30, 0xBB, 0x0D, 0x0A, 0x1A, 0x0A};
+    uint32_t levelCount = static_cast<uint32_t>(levels.size());
+
+    uint32_t header[13] = {
+        static_cast<uint32_t>(target.format), 1, mipChain[0].width, mipChain[0].height, 0, 0, 1, levelCount, 0
+    };
+
+    size_t levelIndexOffset = sizeof(identifier) + 9 * 4 + 4 * 4 + 2 * 8;
+    size_t dfdOffset = levelIndexOffset + levelCount * 3 * sizeof(uint64_t);
+    header[9] = static_cast<uint32_t>(dfdOffset);
+    header[10] = static_cast<uint32_t>(dfd.size() * sizeof(uint32_t));
+
+    // Mip levels are stored smallest first, each aligned to the block size
+    std::vector<uint64_t> levelIndex(levelCount * 3);
+    size_t offset = dfdOffset + dfd.size() * sizeof(uint32_t);
+    for (uint32_t i = levelCount; i-- > 0;) {
+        offset = (offset + target.blockSize - 1) / target.blockSize * target.blockSize;
+        levelIndex[i * 3 + 0] = offset;
+        levelIndex[i * 3 + 1] = levels[i].size();
+        levelIndex[i * 3 + 2] = levels[i].size();
+        offset += levels[i].size();
+    }
+
+    std::vector<uint8_t> file(offset, 0);
+    uint64_t supercompressionGlobalData[2] = {0, 0};
+    memcpy(&file[0], identifier, sizeof(identifier));
+    memcpy(&file[sizeof(identifier)], header, sizeof(header));
+    memcpy(&file[sizeof(identifier) + sizeof(header)], supercompressionGlobalData, sizeof(supercompressionGlobalData));
+    memcpy(&file[levelIndexOffset], levelIndex.data(), levelIndex.size() * sizeof(uint64_t));
+    memcpy(&file[dfdOffset], dfd.data(), dfd.size() * sizeof(uint32_t));
+    for (uint32_t i = 0; i < levelCount; i++) {
+        memcpy(&file[levelIndex[i * 3]], levels[i].data(), levels[i].size());
+    }
+
+    std::ofstream output(path, std::ios::binary | std::ios::trunc);
+    output.write(reinterpret_cast<const char*>(file.data()), file.size());
+
+    if (!output) {
+        throw std::runtime_error("failed to write " + path + "!");
+    }
+
+    std::cout << path << ": " << levelCount << " levels, " << file.size() / 1024 << " KiB" << std::endl;
+}
+
+int main(int argc, char** argv) {
+    if (argc != 3) {
+        std::cerr << "usage: " << argv[0] << " <input image> <output prefix>" << std::endl;
+        return EXIT_FAILURE;
+    }
+
+    try {
+        int width, height, channels;
+        stbi_uc* pixels = stbi_load(argv[1], &width, &height, &channels, STBI_rgb_alpha);
+
+        if (!pixels) {
+            throw std::runtime_error("failed to load texture image!");
+        }
+
+        std::vector<Image> mipChain(1);
+        mipChain[0].width = static_cast<uint32_t>(width);
+        mipChain[0].height = static_cast<uint32_t>(height);
+        mipChain[0].pixels.assign(pixels, pixels + width * height * 4);
+        stbi_image_free(pixels);
+
+        while (mipChain.back().width > 1 || mipChain.back().height > 1) {
+            mipChain.push_back(downsample(mipChain.back()));
+        }
+
+        for (const TargetFormat& target : TARGET_FORMATS) {
+            writeKtx2(std::string(argv[2]) + target.suffix, target, mipChain);
+        }
+    } catch (const std::exception& e) {
+        std::cerr << e.what() << std::endl;
+        return EXIT_FAILURE;
+    }
+
+    return EXIT_SUCCESS;
+}